@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// File: Depth_VS.hlsl
+//
+// Position only vertex shader for depth passes, reads the packed position stream
+//--------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffer Variables
+//--------------------------------------------------------------------------------------
+
+cbuffer ConstantBufferTransforms : register(b0)
+{
+    matrix World;
+    matrix View;
+    matrix Projection;
+}
+
+//--------------------------------------------------------------------------------------
+struct VS_INPUT
+{
+    float4 Pos : POSITION;
+};
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Vertex Shader
+//--------------------------------------------------------------------------------------
+// same transform order as Tutorial06_VS so the depth values match exactly
+PS_INPUT VS(VS_INPUT input)
+{
+    PS_INPUT output = (PS_INPUT) 0;
+    output.Pos = mul(input.Pos, World);
+    output.Pos = mul(output.Pos, View);
+    output.Pos = mul(output.Pos, Projection);
+    return output;
+}
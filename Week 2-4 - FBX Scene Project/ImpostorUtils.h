@@ -0,0 +1,472 @@
+#pragma once
+#include <directxmath.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include "MeshUtils.h"
+
+using namespace std;
+using namespace DirectX;
+
+// 32-bit RGBA image on the CPU, R in the lowest byte (DXGI_FORMAT_R8G8B8A8_UNORM)
+struct ImpostorImage
+{
+	int width = 0;
+	int height = 0;
+	vector<uint32_t> pixels;
+};
+
+// Octahedral impostor: framesPerSide x framesPerSide views of a mesh, each
+// looking at the mesh from the direction OctDecode maps the frame center to.
+// color holds the albedo with coverage in alpha, normal the surface normal
+// in the frame's (right, up, towards viewer) basis packed to 0..1
+struct ImpostorAtlas
+{
+	int framesPerSide = 0;
+	int frameSize = 0;
+	// sphere the frames are fitted to, in mesh space
+	XMFLOAT3 center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float radius = 0.0f;
+	ImpostorImage color;
+	ImpostorImage normal;
+};
+
+namespace ImpostorUtils
+{
+	uint32_t PackRGBA(float r, float g, float b, float a)
+	{
+		auto unorm8 = [](float v) { return (uint32_t)(min(max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+		return unorm8(r) | (unorm8(g) << 8) | (unorm8(b) << 16) | (unorm8(a) << 24);
+	}
+
+	XMFLOAT4 UnpackRGBA(uint32_t c)
+	{
+		return XMFLOAT4((c & 0xff) / 255.0f, ((c >> 8) & 0xff) / 255.0f, ((c >> 16) & 0xff) / 255.0f, (c >> 24) / 255.0f);
+	}
+
+	// Reads uncompressed 32-bit and DXT1 DDS files, the formats used by the
+	// assets. Only the top mip is loaded. The header is checked against the
+	// file size before anything is allocated, so a bad file just fails
+	bool LoadDDSImage(const std::string& filename, ImpostorImage& image)
+	{
+		std::ifstream file(filename, std::ios_base::binary | std::ios_base::ate);
+		size_t fileSize = file ? (size_t)file.tellg() : 0;
+		file.seekg(0);
+		uint32_t magic = 0;
+		uint32_t header[31] = {};
+		file.read((char*)&magic, sizeof(magic));
+		file.read((char*)header, sizeof(header));
+		if (!file || magic != 0x20534444) // "DDS "
+			return false;
+
+		// D3D11's largest 2D texture
+		const uint32_t maxDimension = 16384;
+		uint32_t height = header[2], width = header[3];
+		if (width == 0 || height == 0 || width > maxDimension || height > maxDimension)
+			return false;
+
+		uint32_t formatFlags = header[19];
+		uint32_t fourCC = header[20];
+		uint32_t bitCount = header[21];
+		bool rgb = (formatFlags & 0x40) && bitCount == 32; // DDPF_RGB
+		bool dxt1 = fourCC == 0x31545844; // "DXT1"
+
+		// bytes of the top mip: rows of pitch bytes or 8 byte blocks of 4x4
+		size_t pitch = (size_t)width * 4, dataSize;
+		if (rgb)
+		{
+			if (header[1] & 0x8) // DDSD_PITCH
+				pitch = header[4];
+			if (pitch < (size_t)width * 4)
+				return false;
+			dataSize = pitch * height;
+		}
+		else if (dxt1)
+			dataSize = (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+		else
+			return false;
+		if (fileSize < sizeof(magic) + sizeof(header) + dataSize)
+			return false;
+
+		image.height = (int)height;
+		image.width = (int)width;
+		image.pixels.assign((size_t)image.width * image.height, 0);
+
+		if (rgb)
+		{
+			// move each channel from its mask to the RGBA byte order,
+			// skipping any padding at the end of the rows
+			uint32_t masks[4] = { header[22], header[23], header[24], (formatFlags & 0x1) ? header[25] : 0u };
+			vector<uint32_t> source(image.pixels.size());
+			for (uint32_t y = 0; y < height; y++)
+			{
+				file.read((char*)(source.data() + (size_t)y * width), (size_t)width * sizeof(uint32_t));
+				file.seekg(pitch - (size_t)width * 4, std::ios_base::cur);
+			}
+			for (size_t p = 0; p < source.size(); p++)
+			{
+				uint32_t rgba = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					uint32_t value = 0xff;
+					if (masks[c])
+					{
+						int shift = 0;
+						while (!((masks[c] >> shift) & 1))
+							shift++;
+						value = (source[p] & masks[c]) >> shift;
+					}
+					rgba |= (value & 0xff) << (c * 8);
+				}
+				image.pixels[p] = rgba;
+			}
+			return (bool)file;
+		}
+
+		if (dxt1)
+		{
+			auto expand565 = [](uint16_t c)
+			{
+				uint32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+				return XMFLOAT4((r << 3 | r >> 2) / 255.0f, (g << 2 | g >> 4) / 255.0f, (b << 3 | b >> 2) / 255.0f, 1.0f);
+			};
+
+			int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+			for (int by = 0; by < blocksY; by++)
+			{
+				for (int bx = 0; bx < blocksX; bx++)
+				{
+					uint16_t endpoints[2];
+					uint32_t selectors;
+					file.read((char*)endpoints, sizeof(endpoints));
+					file.read((char*)&selectors, sizeof(selectors));
+
+					XMFLOAT4 c0 = expand565(endpoints[0]), c1 = expand565(endpoints[1]);
+					uint32_t palette[4];
+					palette[0] = PackRGBA(c0.x, c0.y, c0.z, 1.0f);
+					palette[1] = PackRGBA(c1.x, c1.y, c1.z, 1.0f);
+					if (endpoints[0] > endpoints[1])
+					{
+						palette[2] = PackRGBA((2 * c0.x + c1.x) / 3, (2 * c0.y + c1.y) / 3, (2 * c0.z + c1.z) / 3, 1.0f);
+						palette[3] = PackRGBA((c0.x + 2 * c1.x) / 3, (c0.y + 2 * c1.y) / 3, (c0.z + 2 * c1.z) / 3, 1.0f);
+					}
+					else
+					{
+						palette[2] = PackRGBA((c0.x + c1.x) / 2, (c0.y + c1.y) / 2, (c0.z + c1.z) / 2, 1.0f);
+						palette[3] = 0;
+					}
+
+					for (int i = 0; i < 16; i++)
+					{
+						int x = bx * 4 + i % 4, y = by * 4 + i / 4;
+						if (x < image.width && y < image.height)
+							image.pixels[(size_t)y * image.width + x] = palette[(selectors >> (i * 2)) & 3];
+					}
+				}
+			}
+			return (bool)file;
+		}
+
+		return false;
+	}
+
+	// Writes an uncompressed R8G8B8A8 DDS without mips, which
+	// CreateDDSTextureFromFile loads as DXGI_FORMAT_R8G8B8A8_UNORM
+	bool SaveDDSImage(const std::string& filename, const ImpostorImage& image)
+	{
+		uint32_t magic = 0x20534444; // "DDS "
+		uint32_t header[31] = {};
+		header[0] = 124;
+		header[1] = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000; // CAPS | HEIGHT | WIDTH | PITCH | PIXELFORMAT
+		header[2] = (uint32_t)image.height;
+		header[3] = (uint32_t)image.width;
+		header[4] = (uint32_t)image.width * 4;
+		header[18] = 32;
+		header[19] = 0x40 | 0x1; // DDPF_RGB | DDPF_ALPHAPIXELS
+		header[21] = 32;
+		header[22] = 0x000000ff;
+		header[23] = 0x0000ff00;
+		header[24] = 0x00ff0000;
+		header[25] = 0xff000000;
+		header[26] = 0x1000; // DDSCAPS_TEXTURE
+
+		std::ofstream file(filename, std::ios_base::binary);
+		file.write((const char*)&magic, sizeof(magic));
+		file.write((const char*)header, sizeof(header));
+		file.write((const char*)image.pixels.data(), image.pixels.size() * sizeof(uint32_t));
+		return (bool)file;
+	}
+
+	// Bilinear sample with wrapping, uv in D3D convention (v down)
+	XMFLOAT4 SampleImage(const ImpostorImage& image, XMFLOAT2 uv)
+	{
+		float x = uv.x * image.width - 0.5f, y = uv.y * image.height - 0.5f;
+		float fx = floorf(x), fy = floorf(y);
+		float tx = x - fx, ty = y - fy;
+		auto wrap = [](int v, int size) { v %= size; return v < 0 ? v + size : v; };
+		int x0 = wrap((int)fx, image.width), x1 = wrap((int)fx + 1, image.width);
+		int y0 = wrap((int)fy, image.height), y1 = wrap((int)fy + 1, image.height);
+
+		auto texel = [&](int x, int y)
+		{
+			XMFLOAT4 c = UnpackRGBA(image.pixels[(size_t)y * image.width + x]);
+			return XMLoadFloat4(&c);
+		};
+		XMVECTOR c00 = texel(x0, y0), c10 = texel(x1, y0), c01 = texel(x0, y1), c11 = texel(x1, y1);
+		XMFLOAT4 result;
+		XMStoreFloat4(&result, XMVectorLerp(XMVectorLerp(c00, c10, tx), XMVectorLerp(c01, c11, tx), ty));
+		return result;
+	}
+
+	// Direction (mesh space, towards the viewer) frame x, y was baked from
+	XMFLOAT3 FrameDirection(int frameX, int frameY, int framesPerSide)
+	{
+		return MeshUtils::OctDecode(XMFLOAT2((frameX + 0.5f) / framesPerSide * 2.0f - 1.0f,
+			(frameY + 0.5f) / framesPerSide * 2.0f - 1.0f));
+	}
+
+	// The frame whose octahedral cell contains dir
+	void SelectFrame(XMFLOAT3 dir, int framesPerSide, int& frameX, int& frameY)
+	{
+		XMFLOAT2 oct = MeshUtils::OctEncode(dir);
+		frameX = min(max((int)((oct.x * 0.5f + 0.5f) * framesPerSide), 0), framesPerSide - 1);
+		frameY = min(max((int)((oct.y * 0.5f + 0.5f) * framesPerSide), 0), framesPerSide - 1);
+	}
+
+	// Screen axes of a view looking along -dir, as XMMatrixLookAtLH builds them
+	void FrameBasis(FXMVECTOR dir, XMVECTOR& right, XMVECTOR& up)
+	{
+		XMVECTOR forward = XMVectorNegate(dir);
+		XMVECTOR worldUp = fabsf(XMVectorGetY(dir)) > 0.999f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		right = XMVector3Normalize(XMVector3Cross(worldUp, forward));
+		up = XMVector3Cross(forward, right);
+	}
+
+	// Orthographic z-buffered raster of the mesh into one frame. Pixels the
+	// mesh does not cover are left at 0 (alpha 0)
+	void BakeFrame(const SimpleMesh<SimpleVertex>& mesh, const ImpostorImage* texture, const ImpostorAtlas& atlas,
+		XMFLOAT3 frameDir, vector<uint32_t>& color, vector<uint32_t>& normal, vector<float>& depth)
+	{
+		int size = atlas.frameSize;
+		color.assign((size_t)size * size, 0);
+		normal.assign((size_t)size * size, 0);
+		depth.assign((size_t)size * size, FLT_MAX);
+
+		XMVECTOR dir = XMLoadFloat3(&frameDir), right, up;
+		FrameBasis(dir, right, up);
+		XMVECTOR center = XMLoadFloat3(&atlas.center);
+		float pixelsPerUnit = 0.5f * size / atlas.radius;
+
+		// pixel x, y and depth (smaller is closer) of each vertex,
+		// and its normal in the frame basis
+		vector<XMFLOAT3> projected(mesh.vertexList.size());
+		vector<XMFLOAT3> frameNormals(mesh.vertexList.size());
+		for (size_t v = 0; v < mesh.vertexList.size(); v++)
+		{
+			XMVECTOR p = XMVectorSubtract(XMLoadFloat3(&mesh.vertexList[v].Pos), center);
+			projected[v] = XMFLOAT3(0.5f * size + XMVectorGetX(XMVector3Dot(p, right)) * pixelsPerUnit,
+				0.5f * size - XMVectorGetX(XMVector3Dot(p, up)) * pixelsPerUnit,
+				-XMVectorGetX(XMVector3Dot(p, dir)));
+			XMVECTOR n = XMLoadFloat3(&mesh.vertexList[v].Normal);
+			frameNormals[v] = XMFLOAT3(XMVectorGetX(XMVector3Dot(n, right)), XMVectorGetX(XMVector3Dot(n, up)),
+				XMVectorGetX(XMVector3Dot(n, dir)));
+		}
+
+		size_t indexCount = mesh.lods.empty() ? mesh.indicesList.size() : mesh.lods[0].indexCount;
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			int tri[3] = { mesh.indicesList[i], mesh.indicesList[i + 1], mesh.indicesList[i + 2] };
+			XMFLOAT3 a = projected[tri[0]], b = projected[tri[1]], c = projected[tri[2]];
+			float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+			if (fabsf(area) < 1e-12f)
+				continue;
+			float invArea = 1.0f / area;
+
+			int minX = max((int)floorf(min(min(a.x, b.x), c.x)), 0), maxX = min((int)ceilf(max(max(a.x, b.x), c.x)), size - 1);
+			int minY = max((int)floorf(min(min(a.y, b.y), c.y)), 0), maxY = min((int)ceilf(max(max(a.y, b.y), c.y)), size - 1);
+			for (int y = minY; y <= maxY; y++)
+			{
+				for (int x = minX; x <= maxX; x++)
+				{
+					// barycentrics at the pixel center, positive inside for either winding
+					float px = x + 0.5f, py = y + 0.5f;
+					float w0 = ((b.x - px) * (c.y - py) - (b.y - py) * (c.x - px)) * invArea;
+					float w1 = ((c.x - px) * (a.y - py) - (c.y - py) * (a.x - px)) * invArea;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					size_t pixel = (size_t)y * size + x;
+					float z = w0 * a.z + w1 * b.z + w2 * c.z;
+					if (z >= depth[pixel])
+						continue;
+					depth[pixel] = z;
+
+					const SimpleVertex& v0 = mesh.vertexList[tri[0]];
+					const SimpleVertex& v1 = mesh.vertexList[tri[1]];
+					const SimpleVertex& v2 = mesh.vertexList[tri[2]];
+					XMFLOAT4 albedo(1.0f, 1.0f, 1.0f, 1.0f);
+					if (texture)
+					{
+						XMFLOAT2 uv(w0 * v0.Tex.x + w1 * v1.Tex.x + w2 * v2.Tex.x, w0 * v0.Tex.y + w1 * v1.Tex.y + w2 * v2.Tex.y);
+						albedo = SampleImage(*texture, uv);
+					}
+					color[pixel] = PackRGBA(albedo.x, albedo.y, albedo.z, 1.0f);
+
+					XMFLOAT3 n0 = frameNormals[tri[0]], n1 = frameNormals[tri[1]], n2 = frameNormals[tri[2]];
+					XMVECTOR n = XMVector3Normalize(XMVectorSet(w0 * n0.x + w1 * n1.x + w2 * n2.x,
+						w0 * n0.y + w1 * n1.y + w2 * n2.y, w0 * n0.z + w1 * n1.z + w2 * n2.z, 0.0f));
+					normal[pixel] = PackRGBA(XMVectorGetX(n) * 0.5f + 0.5f, XMVectorGetY(n) * 0.5f + 0.5f,
+						XMVectorGetZ(n) * 0.5f + 0.5f, 1.0f);
+				}
+			}
+		}
+	}
+
+	// Spread color into uncovered pixels next to covered ones (alpha stays 0),
+	// so bilinear filtering at the silhouette doesn't blend in black
+	void DilateFrame(vector<uint32_t>& pixels, int size, int passes)
+	{
+		vector<uint32_t> source;
+		for (int pass = 0; pass < passes; pass++)
+		{
+			source = pixels;
+			for (int y = 0; y < size; y++)
+			{
+				for (int x = 0; x < size; x++)
+				{
+					if (source[(size_t)y * size + x] >> 24)
+						continue;
+
+					XMVECTOR sum = XMVectorZero();
+					int count = 0;
+					const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+					for (const auto& o : offsets)
+					{
+						int nx = x + o[0], ny = y + o[1];
+						if (nx < 0 || ny < 0 || nx >= size || ny >= size)
+							continue;
+						uint32_t neighbour = source[(size_t)ny * size + nx];
+						// covered, or already dilated in an earlier pass
+						if ((neighbour >> 24) || (neighbour & 0xffffff))
+						{
+							XMFLOAT4 c = UnpackRGBA(neighbour);
+							sum = XMVectorAdd(sum, XMLoadFloat4(&c));
+							count++;
+						}
+					}
+					if (count)
+					{
+						XMFLOAT4 average;
+						XMStoreFloat4(&average, XMVectorScale(sum, 1.0f / count));
+						pixels[(size_t)y * size + x] = PackRGBA(average.x, average.y, average.z, 0.0f);
+					}
+				}
+			}
+		}
+	}
+
+	// Bake framesPerSide^2 views of the mesh into a color and a normal atlas of
+	// (framesPerSide * frameSize)^2 pixels. Runs on the CPU only, so it can be
+	// used by tools without a device. texture may be null for an untextured mesh
+	void BakeImpostor(const SimpleMesh<SimpleVertex>& mesh, const ImpostorImage* texture, int framesPerSide, int frameSize,
+		ImpostorAtlas& atlas)
+	{
+		auto start = chrono::high_resolution_clock::now();
+
+		atlas.framesPerSide = framesPerSide;
+		atlas.frameSize = frameSize;
+		MeshBounds bounds = mesh.bounds;
+		if (!bounds.valid)
+			MeshUtils::ComputeBoundingSphere(mesh.vertexList.data(), mesh.vertexList.size(), bounds.sphereCenter, bounds.sphereRadius);
+		atlas.center = bounds.sphereCenter;
+		// leave a pixel of border around every frame for filtering
+		atlas.radius = max(bounds.sphereRadius, 1e-6f) * frameSize / max(frameSize - 2, 1);
+
+		int atlasSize = framesPerSide * frameSize;
+		for (ImpostorImage* image : { &atlas.color, &atlas.normal })
+		{
+			image->width = atlasSize;
+			image->height = atlasSize;
+			image->pixels.assign((size_t)atlasSize * atlasSize, 0);
+		}
+
+		vector<uint32_t> color, normal;
+		vector<float> depth;
+		size_t covered = 0;
+		for (int frameY = 0; frameY < framesPerSide; frameY++)
+		{
+			for (int frameX = 0; frameX < framesPerSide; frameX++)
+			{
+				BakeFrame(mesh, texture, atlas, FrameDirection(frameX, frameY, framesPerSide), color, normal, depth);
+				for (uint32_t c : color)
+					covered += (c >> 24) != 0;
+				DilateFrame(color, frameSize, 2);
+				DilateFrame(normal, frameSize, 2);
+
+				for (int y = 0; y < frameSize; y++)
+				{
+					size_t row = (size_t)(frameY * frameSize + y) * atlasSize + frameX * frameSize;
+					memcpy(&atlas.color.pixels[row], &color[(size_t)y * frameSize], frameSize * sizeof(uint32_t));
+					memcpy(&atlas.normal.pixels[row], &normal[(size_t)y * frameSize], frameSize * sizeof(uint32_t));
+				}
+			}
+		}
+
+		cout << "impostor bake: " << framesPerSide * framesPerSide << " frames of " << frameSize << "x" << frameSize
+			<< ", " << mesh.indicesList.size() / 3 << " triangles, " << MeshUtils::ElapsedMs(start) << " ms, "
+			<< (float)covered / atlas.color.pixels.size() * 100.0f << "% of the atlas covered" << endl;
+	}
+
+	// A quad in the xy plane from -1 to 1 facing +z, textured with the whole
+	// frame. ImpostorWorld scales and turns it so +z points at the viewer
+	void MakeImpostorQuad(SimpleMesh<SimpleVertex>& mesh)
+	{
+		mesh.vertexList =
+		{
+			{ XMFLOAT3(-1.0f, -1.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(0.0f, 1.0f) },
+			{ XMFLOAT3(1.0f, -1.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(1.0f, 1.0f) },
+			{ XMFLOAT3(1.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(1.0f, 0.0f) },
+			{ XMFLOAT3(-1.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(0.0f, 0.0f) },
+		};
+		// clockwise as seen from the viewer
+		mesh.indicesList = { 0, 3, 2, 0, 2, 1 };
+	}
+
+	// World matrix for the impostor quad of a mesh placed at world, seen from
+	// eye. The quad is turned to the frame nearest to the view direction and
+	// atlasFrame receives that frame's uv offset (xy) and scale (zw).
+	// Rows 0..2 are the frame's right, up and towards viewer axes
+	XMMATRIX ImpostorWorld(const ImpostorAtlas& atlas, CXMMATRIX world, FXMVECTOR eye, XMFLOAT4& atlasFrame)
+	{
+		XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&atlas.center), world);
+		XMVECTOR determinant;
+		XMMATRIX inverseWorld = XMMatrixInverse(&determinant, world);
+		XMFLOAT3 viewDir;
+		XMStoreFloat3(&viewDir, XMVector3TransformNormal(XMVectorSubtract(eye, center), inverseWorld));
+
+		int frameX, frameY;
+		SelectFrame(viewDir, atlas.framesPerSide, frameX, frameY);
+		float frameScale = 1.0f / atlas.framesPerSide;
+		atlasFrame = XMFLOAT4(frameX * frameScale, frameY * frameScale, frameScale, frameScale);
+
+		XMFLOAT3 frameDir = FrameDirection(frameX, frameY, atlas.framesPerSide);
+		XMVECTOR dir = XMLoadFloat3(&frameDir), right, up;
+		FrameBasis(dir, right, up);
+
+		float worldScale = max(max(XMVectorGetX(XMVector3Length(world.r[0])),
+			XMVectorGetX(XMVector3Length(world.r[1]))), XMVectorGetX(XMVector3Length(world.r[2])));
+		float size = atlas.radius * worldScale;
+		XMMATRIX quadWorld;
+		quadWorld.r[0] = XMVectorScale(XMVector3Normalize(XMVector3TransformNormal(right, world)), size);
+		quadWorld.r[1] = XMVectorScale(XMVector3Normalize(XMVector3TransformNormal(up, world)), size);
+		quadWorld.r[2] = XMVectorScale(XMVector3Normalize(XMVector3TransformNormal(dir, world)), size);
+		quadWorld.r[3] = XMVectorSetW(center, 1.0f);
+		return quadWorld;
+	}
+}
@@ -0,0 +1,55 @@
+//--------------------------------------------------------------------------------------
+// File: Impostor_PS.hlsl
+//
+// Tutorial06_PS lighting for an impostor, with the normal read from the atlas
+//--------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffer Variables
+//--------------------------------------------------------------------------------------
+Texture2D txDiffuse : register(t0);
+Texture2D txNormal : register(t1);
+SamplerState samLinear : register(s0);
+
+cbuffer ConstantBuffer : register(b0)
+{
+    float4 vLightDir[2];
+    float4 vLightColor[2];
+    float4 vOutputColor;
+}
+
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float2 Tex : TEXCOORD1;
+    float3 Right : TEXCOORD2;
+    float3 Up : TEXCOORD3;
+    float3 Facing : TEXCOORD4;
+};
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader
+//--------------------------------------------------------------------------------------
+float4 PS(PS_INPUT input) : SV_Target
+{
+    float4 albedo = txDiffuse.Sample(samLinear, input.Tex);
+    // alpha is the coverage of the baked frame
+    clip(albedo.a - 0.5f);
+
+    float3 n = txNormal.Sample(samLinear, input.Tex).xyz * 2.0f - 1.0f;
+    float3 norm = normalize(n.x * input.Right + n.y * input.Up + n.z * input.Facing);
+
+    float4 finalColor = 0;
+
+    //do NdotL lighting for 2 lights
+    for (int i = 0; i < 2; i++)
+    {
+        finalColor += saturate(dot((float3) vLightDir[i], norm) * vLightColor[i]);
+    }
+
+    finalColor *= albedo;
+    finalColor.a = 1.0f;
+    return finalColor;
+}
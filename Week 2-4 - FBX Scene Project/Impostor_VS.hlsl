@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------
+// File: Impostor_VS.hlsl
+//
+// Draws the quad of an octahedral impostor (see ImpostorUtils.h)
+//--------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffer Variables
+//--------------------------------------------------------------------------------------
+
+cbuffer ConstantBufferImpostor : register(b0)
+{
+    matrix World;      // rows: frame right, up and towards viewer, then center
+    matrix View;
+    matrix Projection;
+    float4 AtlasFrame; // uv offset (xy) and scale (zw) of the frame
+}
+
+//--------------------------------------------------------------------------------------
+struct VS_INPUT
+{
+    float4 Pos : POSITION;
+    float3 Norm : NORMAL;
+    float2 Tex : TEXCOORD0;
+};
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float2 Tex : TEXCOORD1;
+    float3 Right : TEXCOORD2;
+    float3 Up : TEXCOORD3;
+    float3 Facing : TEXCOORD4;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Vertex Shader
+//--------------------------------------------------------------------------------------
+PS_INPUT VS(VS_INPUT input)
+{
+    PS_INPUT output = (PS_INPUT) 0;
+    output.Pos = mul(input.Pos, World);
+    output.Pos = mul(output.Pos, View);
+    output.Pos = mul(output.Pos, Projection);
+    output.Tex = AtlasFrame.xy + input.Tex * AtlasFrame.zw;
+    // the baked normals are stored in this basis
+    output.Right = normalize(World[0].xyz);
+    output.Up = normalize(World[1].xyz);
+    output.Facing = normalize(World[2].xyz);
+    return output;
+}
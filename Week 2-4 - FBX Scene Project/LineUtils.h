@@ -2,6 +2,7 @@
 
 #include <directxmath.h>
 #include <vector>
+#include "VertexFormat.h"
 
 using namespace DirectX;
 using namespace std;
@@ -12,6 +13,16 @@ struct ColorVertex
 	XMFLOAT4 color;
 };
 
+template <>
+struct VertexFormat<ColorVertex>
+{
+	static constexpr VertexElement elements[] =
+	{
+		{ "POSITION", 0, VertexElementType::Float3, offsetof(ColorVertex, pos1) },
+		{ "COLOR", 0, VertexElementType::Float4, offsetof(ColorVertex, color) },
+	};
+};
+
 struct DebugLines
 {
 	vector<ColorVertex> vertexList;
@@ -8,35 +8,80 @@
 #include <fbxsdk.h>
 #include "MeshUtils.h"
 #include <string>
+#include <sstream>
+#include <mutex>
 
 FbxManager* gSdkManager;
 
+// Optional mesh processing passes run by LoadFBX
+struct FBXLoadOptions
+{
+	// reorder triangle clusters to reduce overdraw (opaque meshes only)
+	bool optimizeOverdraw = false;
+	// 1.0 keeps nearly all of the vertex cache gain, larger values
+	// give more freedom to reduce overdraw at the cost of cache hits
+	float overdrawThreshold = 1.05f;
+	// simplified levels of detail to append, as fractions of the full
+	// triangle count (e.g. { 0.5f, 0.25f, 0.125f }), none when empty
+	vector<float> lodRatios;
+	// also fit an oriented box (PCA) into MeshBounds
+	bool computeOBB = false;
+	// back to front triangle orders to precompute for blending, one per
+	// view direction bucket (8 or 26), none when 0
+	int viewOrderBuckets = 0;
+	// threads the mesh nodes of one file are built and optimized on, for
+	// scene files holding many meshes
+	unsigned nodeThreads = 1;
+};
+
+// One mesh node built on its own by ProcessFBXMeshNode: its indexed mesh,
+// the texture of its material and what it reported, printed at the merge
+struct FBXMeshPart
+{
+	SimpleMesh<SimpleVertex> mesh;
+	std::string textureFilename;
+	std::ostringstream log;
+};
+
 // funtime random normal
 //#define RAND_NORMAL XMFLOAT3(rand()/float(RAND_MAX),rand()/float(RAND_MAX),rand()/float(RAND_MAX))
 
 // Add FBX mesh process function declaration here
 void ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float scale, std::string& textureFilename);
-
-void InitFBX()
+template <typename Func>
+void ProcessFBXMeshNodes(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float scale, std::string& textureFilename,
+	unsigned threadCount, Func optimize);
+void BenchmarkFBXExtraction(const std::string& filename);
+
+// A new SDK manager with its IO settings. Managers aren't thread safe,
+// threads that import at the same time each need their own
+FbxManager* CreateFBXManager()
 {
-	gSdkManager = FbxManager::Create();
+	FbxManager* manager = FbxManager::Create();
 
 	// create an IOSettings object
-	FbxIOSettings* ios = FbxIOSettings::Create(gSdkManager, IOSROOT);
-	gSdkManager->SetIOSettings(ios);
+	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+	manager->SetIOSettings(ios);
+	return manager;
 }
 
-void LoadFBX(const std::string& filename, SimpleMesh<SimpleVertex> &simpleMesh, float scale, std::string& textureFilename)
+void InitFBX()
+{
+	gSdkManager = CreateFBXManager();
+}
+
+// Load the FBX file into a new scene, the caller destroys it
+FbxScene* ImportFBXScene(const std::string& filename, FbxManager* manager = gSdkManager)
 {
 	const char* ImportFileName = filename.c_str(); 
 
 	// Create a scene
-	FbxScene* lScene = FbxScene::Create(gSdkManager, "");
+	FbxScene* lScene = FbxScene::Create(manager, "");
 
-	FbxImporter* lImporter = FbxImporter::Create(gSdkManager, "");
+	FbxImporter* lImporter = FbxImporter::Create(manager, "");
 
 	// Initialize the importer by providing a filename.
-	if (!lImporter->Initialize(ImportFileName, -1, gSdkManager->GetIOSettings())) {
+	if (!lImporter->Initialize(ImportFileName, -1, manager->GetIOSettings())) {
 		printf("Call to FbxImporter::Initialize() failed.\n");
 		printf("Error returned: %s\n\n", lImporter->GetStatus().GetErrorString());
 		//exit(-1);
@@ -48,14 +93,284 @@ void LoadFBX(const std::string& filename, SimpleMesh<SimpleVertex> &simpleMesh,
 	// Destroy the importer
 	lImporter->Destroy();
 
+	return lScene;
+}
+
+// Import the FBX file into an indexed SimpleMesh
+void ImportFBX(const std::string& filename, SimpleMesh<SimpleVertex>& simpleMesh, float scale, std::string& textureFilename,
+	FbxManager* manager = gSdkManager)
+{
+	FbxScene* lScene = ImportFBXScene(filename, manager);
+
 	// Process the scene and build DirectX Arrays
 	ProcessFBXMesh(lScene->GetRootNode(), simpleMesh, scale, textureFilename);
 
-	// Optimize the mesh
-	MeshUtils::Compactify(simpleMesh);
+	// Destroy the (no longer needed) scene
+	lScene->Destroy();
+}
+
+void LoadFBX(const std::string& filename, SimpleMesh<SimpleVertex> &simpleMesh, float scale, std::string& textureFilename,
+	const FBXLoadOptions& options = FBXLoadOptions(), FbxManager* manager = gSdkManager)
+{
+	FbxScene* lScene = ImportFBXScene(filename, manager);
+
+	// Each mesh node is welded as it is imported (no Compactify needed),
+	// then its triangles are reordered for the post transform vertex cache
+	// and its vertices to follow the final triangle order. The nodes are
+	// independent tasks and each becomes one contiguous submesh
+	cout << "\nName:" << lScene->GetRootNode()->GetName();
+	ProcessFBXMeshNodes(lScene->GetRootNode(), simpleMesh, scale, textureFilename, options.nodeThreads, [&](FBXMeshPart& part)
+	{
+		part.log << "\n";
+		MeshUtils::OptimizeVertexCache(part.mesh, part.log);
+
+		if (options.optimizeOverdraw)
+			MeshUtils::OptimizeOverdraw(part.mesh, options.overdrawThreshold, part.log);
+
+		MeshUtils::OptimizeVertexFetch(part.mesh, true, part.log);
+	});
+	cout << endl;
 
 	// Destroy the (no longer needed) scene
 	lScene->Destroy();
+
+	// LODs share the vertex list and go after the full detail indices,
+	// each level covers all submeshes together
+	if (!options.lodRatios.empty())
+		MeshUtils::GenerateLODChain(simpleMesh, options.lodRatios);
+
+	// and the sorted orders after the LODs
+	if (options.viewOrderBuckets > 0)
+		MeshUtils::GenerateViewOrders(simpleMesh, options.viewOrderBuckets);
+
+	MeshUtils::ComputeMeshBounds(simpleMesh, options.computeOBB);
+}
+
+// One file for LoadFBX and what it produced
+struct FBXLoadJob
+{
+	std::string filename;
+	float scale = 1.0f;
+	FBXLoadOptions options;
+	SimpleMesh<SimpleVertex> mesh;
+	std::string textureFilename;
+	// time the job took on its thread, onLoaded included
+	double loadTime = 0.0;
+};
+
+// Run LoadFBX on every job using up to threadCount threads, the calling
+// thread being one of them. Each thread imports through its own manager,
+// created up front on this thread. onLoaded(i) runs on the thread that
+// loaded job i right after it, e.g. to create GPU resources with the free
+// threaded ID3D11Device calls. The results only depend on the job, so any
+// thread count gives the same meshes (the log lines may interleave)
+template <typename Func>
+void LoadFBXJobs(vector<FBXLoadJob>& jobs, unsigned threadCount, Func onLoaded)
+{
+	threadCount = max(min(threadCount, (unsigned)jobs.size()), 1u);
+	vector<FbxManager*> managers(threadCount);
+	for (FbxManager*& manager : managers)
+		manager = CreateFBXManager();
+
+	atomic<size_t> nextJob(0);
+	auto worker = [&](unsigned workerIndex)
+	{
+		for (size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+		{
+			FBXLoadJob& job = jobs[i];
+			auto start = chrono::high_resolution_clock::now();
+			LoadFBX(job.filename, job.mesh, job.scale, job.textureFilename, job.options, managers[workerIndex]);
+			onLoaded(i);
+			job.loadTime = MeshUtils::ElapsedMs(start);
+		}
+	};
+
+	vector<thread> workers;
+	for (unsigned i = 1; i < threadCount; i++)
+		workers.emplace_back(worker, i);
+	worker(0);
+	for (thread& t : workers)
+		t.join();
+
+	for (FbxManager* manager : managers)
+		manager->Destroy();
+}
+
+// Time ProcessFBXMesh with its built-in triangulation against running the
+// SDK's FbxGeometryConverter::Triangulate on the scene first
+void BenchmarkFBXTriangulation(const std::string& filename)
+{
+	SimpleMesh<SimpleVertex> builtIn, converted;
+	std::string textureFilename;
+
+	FbxScene* scene = ImportFBXScene(filename);
+	auto start = chrono::high_resolution_clock::now();
+	ProcessFBXMesh(scene->GetRootNode(), builtIn, 1.0f, textureFilename);
+	double builtInTime = MeshUtils::ElapsedMs(start);
+	scene->Destroy();
+
+	scene = ImportFBXScene(filename);
+	start = chrono::high_resolution_clock::now();
+	FbxGeometryConverter converter(gSdkManager);
+	converter.Triangulate(scene, true);
+	double triangulateTime = MeshUtils::ElapsedMs(start);
+	ProcessFBXMesh(scene->GetRootNode(), converted, 1.0f, textureFilename);
+	double convertedTime = MeshUtils::ElapsedMs(start);
+	scene->Destroy();
+
+	cout << "\nTriangulation: built-in " << builtIn.indicesList.size() / 3 << " triangles in " << builtInTime
+		<< " ms, FbxGeometryConverter " << converted.indicesList.size() / 3 << " triangles in " << convertedTime
+		<< " ms (" << triangulateTime << " ms of it triangulating)" << endl;
+}
+
+// Time building the indexed mesh directly in ProcessFBXMesh against the
+// old path of expanding every polygon-vertex and welding afterwards
+void BenchmarkFBXIndexing(const std::string& filename)
+{
+	SimpleMesh<SimpleVertex> direct;
+	std::string textureFilename;
+
+	FbxScene* scene = ImportFBXScene(filename);
+	auto start = chrono::high_resolution_clock::now();
+	ProcessFBXMesh(scene->GetRootNode(), direct, 1.0f, textureFilename);
+	double directTime = MeshUtils::ElapsedMs(start);
+	scene->Destroy();
+
+	SimpleMesh<SimpleVertex> welded = direct;
+	start = chrono::high_resolution_clock::now();
+	MeshUtils::ExpandMesh(welded);
+	double expandTime = MeshUtils::ElapsedMs(start);
+	size_t expandedCount = welded.vertexList.size();
+	start = chrono::high_resolution_clock::now();
+	MeshUtils::Compactify(welded);
+	double weldTime = MeshUtils::ElapsedMs(start);
+
+	bool identical = welded.indicesList == direct.indicesList &&
+		welded.vertexList.size() == direct.vertexList.size() &&
+		memcmp(welded.vertexList.data(), direct.vertexList.data(), direct.vertexList.size() * sizeof(SimpleVertex)) == 0;
+
+	// the old importer read the attributes into the expanded array (and
+	// copied it) before welding, the direct pass reads and welds at once
+	cout << "\nIndexing: direct " << directTime << " ms, " << direct.vertexList.size() * sizeof(SimpleVertex) / 1024
+		<< " KB of vertices; expand + weld " << expandTime << " + " << weldTime << " ms on top of the reads, "
+		<< 2 * expandedCount * sizeof(SimpleVertex) / 1024 << " KB of vertices; output ";
+	if (identical)
+	{
+		cout << "identical" << endl;
+		return;
+	}
+	cout << direct.vertexList.size() << " vertices, " << direct.indicesList.size() << " indices vs "
+		<< welded.vertexList.size() << " vertices, " << welded.indicesList.size() << " indices";
+
+	// only an ordering difference when both hold the same vertices
+	bool sameVertices = false;
+	if (welded.vertexList.size() == direct.vertexList.size() && welded.indicesList.size() == direct.indicesList.size())
+	{
+		auto byBytes = [](const SimpleVertex& a, const SimpleVertex& b) { return memcmp(&a, &b, sizeof(SimpleVertex)) < 0; };
+		vector<SimpleVertex> directSorted = direct.vertexList, weldedSorted = welded.vertexList;
+		sort(directSorted.begin(), directSorted.end(), byBytes);
+		sort(weldedSorted.begin(), weldedSorted.end(), byBytes);
+		sameVertices = memcmp(directSorted.data(), weldedSorted.data(), directSorted.size() * sizeof(SimpleVertex)) == 0;
+	}
+	cout << (sameVertices ? " (vertex order differs)" : " (output differs)") << endl;
+}
+
+// Time LoadFBX's node processing over a range of thread counts and check
+// every count gives the serial mesh. Only files with several mesh nodes
+// have anything to spread over the threads
+void BenchmarkFBXNodeThreads(const std::string& filename)
+{
+	FBXLoadOptions options;
+	options.optimizeOverdraw = true;
+	SimpleMesh<SimpleVertex> serial;
+	std::string textureFilename;
+
+	// the per node reports are noise here
+	streambuf* coutBuffer = cout.rdbuf();
+	ostringstream discard;
+	cout.rdbuf(discard.rdbuf());
+	auto start = chrono::high_resolution_clock::now();
+	LoadFBX(filename, serial, 1.0f, textureFilename, options);
+	double serialTime = MeshUtils::ElapsedMs(start);
+	cout.rdbuf(coutBuffer);
+
+	cout << "\nNode threads, " << serial.submeshes.size() << " mesh nodes" << endl;
+	cout << "  1 thread: " << serialTime << " ms" << endl;
+
+	unsigned maxThreads = max(thread::hardware_concurrency(), 1u);
+	for (unsigned threadCount = 2; threadCount <= maxThreads; threadCount *= 2)
+	{
+		SimpleMesh<SimpleVertex> parallel;
+		std::string parallelTextureFilename;
+		options.nodeThreads = threadCount;
+		cout.rdbuf(discard.rdbuf());
+		start = chrono::high_resolution_clock::now();
+		LoadFBX(filename, parallel, 1.0f, parallelTextureFilename, options);
+		double parallelTime = MeshUtils::ElapsedMs(start);
+		cout.rdbuf(coutBuffer);
+
+		bool identical = parallel.indicesList == serial.indicesList &&
+			parallel.vertexList.size() == serial.vertexList.size() &&
+			memcmp(parallel.vertexList.data(), serial.vertexList.data(), serial.vertexList.size() * sizeof(SimpleVertex)) == 0 &&
+			parallel.submeshes.size() == serial.submeshes.size() &&
+			memcmp(parallel.submeshes.data(), serial.submeshes.data(), serial.submeshes.size() * sizeof(MeshSubmesh)) == 0 &&
+			parallel.materials == serial.materials && parallelTextureFilename == textureFilename;
+
+		cout << "  " << threadCount << " threads: " << parallelTime << " ms, "
+			<< serialTime / max(parallelTime, 0.001) << "x, output " << (identical ? "identical" : "MISMATCH") << endl;
+	}
+}
+
+// Import each file and report how the mesh processing passes perform on it
+void BenchmarkFBXAssets(const vector<std::string>& filenames)
+{
+	for (const std::string& filename : filenames)
+	{
+		SimpleMesh<SimpleVertex> simpleMesh;
+		std::string textureFilename;
+		ImportFBX(filename, simpleMesh, 1.0f, textureFilename);
+
+		cout << "\n\n==== " << filename << " ====" << endl;
+		BenchmarkFBXExtraction(filename);
+		BenchmarkFBXTriangulation(filename);
+		BenchmarkFBXIndexing(filename);
+		BenchmarkFBXNodeThreads(filename);
+
+		// the welds are measured on the expanded layout
+		SimpleMesh<SimpleVertex> expanded = simpleMesh;
+		MeshUtils::ExpandMesh(expanded);
+		MeshUtils::BenchmarkCompactify(expanded);
+
+		MeshUtils::OptimizeVertexCache(simpleMesh);
+		MeshUtils::OptimizeOverdraw(simpleMesh, FBXLoadOptions().overdrawThreshold);
+		MeshUtils::OptimizeVertexFetch(simpleMesh, true);
+		MeshUtils::BenchmarkMeshlets(simpleMesh);
+		MeshUtils::BenchmarkBounds(simpleMesh);
+
+		auto start = chrono::high_resolution_clock::now();
+		MeshUtils::GenerateLODChain(simpleMesh, { 0.5f, 0.25f, 0.125f });
+		cout << "LOD chain time: " << MeshUtils::ElapsedMs(start) << " ms" << endl;
+		MeshUtils::BenchmarkProgressiveMesh(simpleMesh);
+
+		SimpleMesh<PackedVertex> packedMesh;
+		MeshUtils::QuantizationInfo info;
+		MeshUtils::QuantizeMesh(simpleMesh, packedMesh, info);
+
+		MeshUtils::BenchmarkMeshCodec(simpleMesh, "SimpleVertex");
+		MeshUtils::BenchmarkMeshCodec(packedMesh, "PackedVertex");
+	}
+}
+
+// Sweep the welding thread count on one (large) file
+void BenchmarkFBXWeldThreads(const std::string& filename, int copies)
+{
+	SimpleMesh<SimpleVertex> simpleMesh;
+	std::string textureFilename;
+	ImportFBX(filename, simpleMesh, 1.0f, textureFilename);
+	MeshUtils::ExpandMesh(simpleMesh);
+
+	cout << "\n\n==== " << filename << " x" << copies << " ====" << endl;
+	MeshUtils::BenchmarkCompactifyThreads(simpleMesh, copies);
 }
 
 string getFileName(const string& s)
@@ -89,118 +404,306 @@ void replaceExt(string& s, const string& newExt) {
 	}
 }
 
-void ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float scale, std::string& textureFilename)
+// Index into a layer element's direct array for one polygon-vertex,
+// following the element's mapping and reference modes. This is the per
+// element path ExtractFBXAttributes replaced, kept as the benchmark reference
+template <typename T>
+int FBXElementIndex(const FbxLayerElementTemplate<T>* element, int polygon, int polygonVertex, int controlPoint)
 {
-	int childrenCount = Node->GetChildCount();
+	int index = polygonVertex;
+	if (element->GetMappingMode() == FbxLayerElement::eByControlPoint)
+		index = controlPoint;
+	else if (element->GetMappingMode() == FbxLayerElement::eByPolygon)
+		index = polygon;
+	else if (element->GetMappingMode() == FbxLayerElement::eAllSame)
+		index = 0;
+
+	if (element->GetReferenceMode() != FbxLayerElement::eDirect)
+		index = element->GetIndexArray().GetAt(index);
+	return index;
+}
 
-	cout << "\nName:" << Node->GetName();
-	// check each child node for a FbxMesh
-	for (int i = 0; i < childrenCount; i++)
-	{
-		FbxNode* childNode = Node->GetChild(i);
-		FbxMesh* mesh = childNode->GetMesh();
+// Read lock on a layer element array for the scope, its contents are at data
+template <typename T>
+struct FBXLockedArray
+{
+	FbxLayerElementArrayTemplate<T>& array;
+	T* data;
+
+	FBXLockedArray(const FbxLayerElementArrayTemplate<T>& lockedArray)
+		: array(const_cast<FbxLayerElementArrayTemplate<T>&>(lockedArray)),
+		data(array.GetLocked(FbxLayerElementArray::eReadLock)) {}
+	~FBXLockedArray() { array.Release(&data); }
+};
+
+// A layer element narrowed to floats. indices maps each polygon-vertex to
+// its entry in values (mapping and reference modes already applied) and is
+// empty when that is the identity, so lookups never check the modes
+template <typename T>
+struct FBXAttribute
+{
+	vector<T> values;
+	vector<int> indices;
 
-		// Found a mesh on this node
-		if (mesh != NULL)
-		{
-			cout << "\nMesh:" << childNode->GetName();
+	bool Empty() const { return values.empty(); }
+	const T& Get(int polygonVertex) const { return values[indices.empty() ? polygonVertex : indices[polygonVertex]]; }
+};
 
-			// Get index count from mesh
-			int numVertices = mesh->GetControlPointsCount();
-			cout << "\nVertex Count:" << numVertices;
+// The attributes of one FbxMesh, positions per control point
+struct FBXMeshAttributes
+{
+	vector<XMFLOAT3> positions;
+	FBXAttribute<XMFLOAT3> normals;
+	FBXAttribute<XMFLOAT2> uvs;
+};
+
+static_assert(sizeof(FbxVector4) == 4 * sizeof(double), "FbxVector4 is read as 4 doubles");
+static_assert(sizeof(FbxVector2) == 2 * sizeof(double), "FbxVector2 is read as 2 doubles");
+
+// Convert the whole direct array of element with convert(doubles, count,
+// dest) and resolve its index array per polygon-vertex, all under one lock
+template <typename T, typename FbxT, typename Convert>
+void ExtractFBXAttribute(FbxMesh* mesh, const FbxLayerElementTemplate<FbxT>* element, FBXAttribute<T>& attribute, Convert convert)
+{
+	attribute.values.clear();
+	attribute.indices.clear();
+	if (element == NULL)
+		return;
+
+	FBXLockedArray<FbxT> direct(element->GetDirectArray());
+	attribute.values.resize(element->GetDirectArray().GetCount());
+	convert((const double*)direct.data, attribute.values.size(), attribute.values.data());
+
+	int numIndices = mesh->GetPolygonVertexCount();
+	bool indexed = element->GetReferenceMode() != FbxLayerElement::eDirect;
+	FBXLockedArray<int> indexArray(element->GetIndexArray());
+	FbxLayerElement::EMappingMode mapping = element->GetMappingMode();
+	if (mapping == FbxLayerElement::eByPolygonVertex)
+	{
+		// the usual case: the index array is already per polygon-vertex
+		if (indexed)
+			attribute.indices.assign(indexArray.data, indexArray.data + numIndices);
+		return;
+	}
 
-			// Resize the vertex vector to size of this mesh
-			simpleMesh.vertexList.resize(numVertices);
+	const int* controlPoints = mesh->GetPolygonVertices();
+	attribute.indices.resize(numIndices);
+	int polygonCount = mesh->GetPolygonCount();
+	for (int polygon = 0; polygon < polygonCount; polygon++)
+	{
+		int first = mesh->GetPolygonVertexIndex(polygon);
+		int last = first + mesh->GetPolygonSize(polygon);
+		for (int polygonVertex = first; polygonVertex < last; polygonVertex++)
+		{
+			int index = mapping == FbxLayerElement::eByControlPoint ? controlPoints[polygonVertex] :
+				mapping == FbxLayerElement::eByPolygon ? polygon : 0;
+			attribute.indices[polygonVertex] = indexed ? indexArray.data[index] : index;
+		}
+	}
+}
 
-			//================= Process Vertices ===============
-			for (int j = 0; j < numVertices; j++)
-			{
-				FbxVector4 vert = mesh->GetControlPointAt(j);
-				simpleMesh.vertexList[j].Pos.x = (float)vert.mData[0] * scale;
-				simpleMesh.vertexList[j].Pos.y = (float)vert.mData[1] * scale;
-				simpleMesh.vertexList[j].Pos.z = (float)vert.mData[2] * scale;
-				// Generate random normal for first attempt at getting to render
-				//simpleMesh.vertexList[j].Normal = RAND_NORMAL;
-			}
+// Pull the control points, first normal element and first uv set of mesh
+// out of the SDK arrays in bulk: scale, the uv V flip and the double to
+// float narrowing are all done by the SIMD kernels in MeshUtils
+void ExtractFBXAttributes(FbxMesh* mesh, float scale, FBXMeshAttributes& attributes)
+{
+	attributes.positions.resize(mesh->GetControlPointsCount());
+	MeshUtils::ConvertDouble4ToFloat3((const double*)mesh->GetControlPoints(), attributes.positions.size(), scale,
+		attributes.positions.data());
+
+	ExtractFBXAttribute(mesh, mesh->GetElementNormal(0), attributes.normals,
+		[](const double* source, size_t count, XMFLOAT3* dest) { MeshUtils::ConvertDouble4ToFloat3(source, count, 1.0f, dest); });
+
+	//get all UV set names
+	FbxStringList lUVSetNameList;
+	mesh->GetUVSetNames(lUVSetNameList);
+	const char* lUVSetName = lUVSetNameList.GetStringAt(0);
+	ExtractFBXAttribute(mesh, mesh->GetElementUV(lUVSetName), attributes.uvs, MeshUtils::ConvertDouble2ToFlippedFloat2);
+}
 
-			int numIndices = mesh->GetPolygonVertexCount();
-			cout << "\nIndice Count:" << numIndices;
+// Append the mesh nodes under node, depth first in child order. Mesh nodes
+// can have mesh nodes of their own (a raft's sail, a boat's oars)
+void CollectFBXMeshNodes(FbxNode* node, vector<FbxNode*>& meshNodes)
+{
+	for (int i = 0; i < node->GetChildCount(); i++)
+	{
+		FbxNode* childNode = node->GetChild(i);
+		if (childNode->GetMesh() != NULL)
+			meshNodes.push_back(childNode);
+		CollectFBXMeshNodes(childNode, meshNodes);
+	}
+}
 
-			// No need to allocate int array, FBX does for us
-			int* indices = mesh->GetPolygonVertices();
+// The node's global transform times its geometric transform, which
+// applies to the node's own geometry only and isn't inherited
+FbxAMatrix FBXGeometryTransform(FbxNode* node)
+{
+	FbxAMatrix geometry(node->GetGeometricTranslation(FbxNode::eSourcePivot),
+		node->GetGeometricRotation(FbxNode::eSourcePivot), node->GetGeometricScaling(FbxNode::eSourcePivot));
+	return node->EvaluateGlobalTransform() * geometry;
+}
 
-			// Fill indiceList
-			simpleMesh.indicesList.resize(numIndices);
-			memcpy(simpleMesh.indicesList.data(), indices, numIndices * sizeof(int));
-		
-			// Get the Normals array from the mesh
-			FbxArray<FbxVector4> normalsVec;
-			mesh->GetPolygonVertexNormals(normalsVec);
-			cout << "\nNormalVec Count:" << normalsVec.Size();
+// Where each mesh node's geometry sits relative to the first one's, with
+// the translation scaled like the positions. The first node keeps its own
+// space so single mesh files load as before, the world matrices set up
+// for them already account for their node transform
+void FBXMeshPlacements(const vector<FbxNode*>& meshNodes, float scale, vector<XMFLOAT4X4>& placements)
+{
+	placements.resize(meshNodes.size());
+	if (meshNodes.empty())
+		return;
+	XMStoreFloat4x4(&placements[0], XMMatrixIdentity());
+	FbxAMatrix rootInverse = FBXGeometryTransform(meshNodes[0]).Inverse();
+	for (size_t i = 1; i < meshNodes.size(); i++)
+	{
+		// both are row vector matrices with the translation in row 3
+		FbxAMatrix placement = rootInverse * FBXGeometryTransform(meshNodes[i]);
+		for (int row = 0; row < 4; row++)
+			for (int column = 0; column < 4; column++)
+				placements[i].m[row][column] = (float)placement.Get(row, column);
+		for (int column = 0; column < 3; column++)
+			placements[i].m[3][column] *= scale;
+	}
+}
 
-			//get all UV set names
+// Time reading every polygon-vertex's position, normal and uv element by
+// element through GetAt (the old ProcessFBXMesh loop) against the bulk
+// ExtractFBXAttributes path, both writing the expanded vertices
+void BenchmarkFBXExtraction(const std::string& filename)
+{
+	const int runs = 5;
+	FbxScene* scene = ImportFBXScene(filename);
+	vector<FbxNode*> meshNodes;
+	CollectFBXMeshNodes(scene->GetRootNode(), meshNodes);
+
+	size_t polygonVertexCount = 0;
+	double perElementTime = 0.0, bulkTime = 0.0;
+	bool identical = true;
+	vector<SimpleVertex> perElement, bulk;
+	for (FbxNode* node : meshNodes)
+	{
+		FbxMesh* mesh = node->GetMesh();
+		int numIndices = mesh->GetPolygonVertexCount();
+		const int* indices = mesh->GetPolygonVertices();
+		int polygonCount = mesh->GetPolygonCount();
+		polygonVertexCount += numIndices;
+		perElement.assign(numIndices, SimpleVertex());
+		bulk.assign(numIndices, SimpleVertex());
+
+		// best of a few runs for each
+		double best = DBL_MAX;
+		for (int run = 0; run < runs; run++)
+		{
+			auto start = chrono::high_resolution_clock::now();
+			const FbxVector4* controlPoints = mesh->GetControlPoints();
+			const FbxGeometryElementNormal* lNormalElement = mesh->GetElementNormal(0);
 			FbxStringList lUVSetNameList;
 			mesh->GetUVSetNames(lUVSetNameList);
-			const char* lUVSetName = lUVSetNameList.GetStringAt(0);
-			const FbxGeometryElementUV* lUVElement = mesh->GetElementUV(lUVSetName);
-			
-			// Declare a new vector for the expanded vertex data
-			// Note the size is numIndices not numVertices
-			vector<SimpleVertex> vertexListExpanded;
-			vertexListExpanded.resize(numIndices);
-
-			// align (expand) vertex array and set the normals
-			for (int j = 0; j < numIndices; j++)
+			const FbxGeometryElementUV* lUVElement = mesh->GetElementUV(lUVSetNameList.GetStringAt(0));
+			for (int polygon = 0; polygon < polygonCount; polygon++)
 			{
-				// copy the original vertex position to the new vector
-				// by using the index to look up the correct vertex
-				// this is the "unindexing" step
-				vertexListExpanded[j].Pos.x = simpleMesh.vertexList[indices[j]].Pos.x;
-				vertexListExpanded[j].Pos.y = simpleMesh.vertexList[indices[j]].Pos.y;
-				vertexListExpanded[j].Pos.z = simpleMesh.vertexList[indices[j]].Pos.z;
-				// copy normal data directly, no need to unindex
-				vertexListExpanded[j].Normal.x = (float)normalsVec.GetAt(j)[0];
-				vertexListExpanded[j].Normal.y = (float)normalsVec.GetAt(j)[1];
-				vertexListExpanded[j].Normal.z = (float)normalsVec.GetAt(j)[2];
-
-				if (lUVElement->GetReferenceMode() == FbxLayerElement::eDirect)
+				int first = mesh->GetPolygonVertexIndex(polygon);
+				int last = first + mesh->GetPolygonSize(polygon);
+				for (int polygonVertex = first; polygonVertex < last; polygonVertex++)
 				{
-					FbxVector2 lUVValue = lUVElement->GetDirectArray().GetAt(indices[j]);
-
-					vertexListExpanded[j].Tex.x = (float)lUVValue[0];
-					vertexListExpanded[j].Tex.y = 1.0f - (float)lUVValue[1];
-				}
-				else if (lUVElement->GetReferenceMode() == FbxLayerElement::eIndexToDirect)
-				{
-					auto& index_array = lUVElement->GetIndexArray();
-
-					FbxVector2 lUVValue = lUVElement->GetDirectArray().GetAt(index_array[j]);
-
-					vertexListExpanded[j].Tex.x = (float)lUVValue[0];
-					vertexListExpanded[j].Tex.y = 1.0f - (float)lUVValue[1];
+					int controlPoint = indices[polygonVertex];
+					SimpleVertex& vert = perElement[polygonVertex];
+					const FbxVector4& pos = controlPoints[controlPoint];
+					vert.Pos = XMFLOAT3((float)pos.mData[0], (float)pos.mData[1], (float)pos.mData[2]);
+					if (lNormalElement != NULL)
+					{
+						FbxVector4 lNormal = lNormalElement->GetDirectArray().GetAt(
+							FBXElementIndex(lNormalElement, polygon, polygonVertex, controlPoint));
+						vert.Normal = XMFLOAT3((float)lNormal[0], (float)lNormal[1], (float)lNormal[2]);
+					}
+					if (lUVElement != NULL)
+					{
+						FbxVector2 lUVValue = lUVElement->GetDirectArray().GetAt(
+							FBXElementIndex(lUVElement, polygon, polygonVertex, controlPoint));
+						vert.Tex = XMFLOAT2((float)lUVValue[0], 1.0f - (float)lUVValue[1]);
+					}
 				}
 			}
+			best = min(best, MeshUtils::ElapsedMs(start));
+		}
+		perElementTime += best;
 
-			// make new indices to match the new vertexListExpanded
-			vector<int> indicesList;
-			indicesList.resize(numIndices);
-			for (int j = 0; j < numIndices; j++)
+		best = DBL_MAX;
+		FBXMeshAttributes attributes;
+		for (int run = 0; run < runs; run++)
+		{
+			auto start = chrono::high_resolution_clock::now();
+			ExtractFBXAttributes(mesh, 1.0f, attributes);
+			for (int polygonVertex = 0; polygonVertex < numIndices; polygonVertex++)
 			{
-				indicesList[j] = j; //literally the index is the count
+				SimpleVertex& vert = bulk[polygonVertex];
+				vert.Pos = attributes.positions[indices[polygonVertex]];
+				if (!attributes.normals.Empty())
+					vert.Normal = attributes.normals.Get(polygonVertex);
+				if (!attributes.uvs.Empty())
+					vert.Tex = attributes.uvs.Get(polygonVertex);
 			}
+			best = min(best, MeshUtils::ElapsedMs(start));
+		}
+		bulkTime += best;
+
+		identical = identical && memcmp(perElement.data(), bulk.data(), numIndices * sizeof(SimpleVertex)) == 0;
+	}
+	scene->Destroy();
+
+	double millions = max(polygonVertexCount, (size_t)1) / 1e6;
+	cout << "\nExtraction: " << meshNodes.size() << " mesh nodes, " << polygonVertexCount << " polygon-vertices; per element "
+		<< perElementTime / millions << " ms, bulk " << bulkTime / millions << " ms per million polygon-vertices ("
+		<< perElementTime / max(bulkTime, 1e-6) << "x), output " << (identical ? "identical" : "DIFFERS") << endl;
+}
+
+// Build the indexed mesh of one mesh node on its own, vertices numbered
+// from 0, and find the texture of its material. Only touches node and part,
+// so several nodes can be processed at once. The SDK doesn't document its
+// getters as thread safe, so everything read from the scene is read while
+// holding sdkMutex, and the weld that follows only works on those copies.
+// The vertices end up transformed by placement (see FBXMeshPlacements)
+void ProcessFBXMeshNode(FbxNode* node, float scale, const XMFLOAT4X4& placement, FBXMeshPart& part, std::mutex& sdkMutex)
+{
+	FbxMesh* mesh = node->GetMesh();
+	int numVertices, numIndices, polygonCount;
+	// control point of each polygon-vertex, positions, normals and uvs
+	// converted to floats up front, and each polygon's polygon-vertices
+	vector<int> indices;
+	FBXMeshAttributes attributes;
+	vector<int> polygonStarts, polygonSizes;
+	{
+		std::lock_guard<std::mutex> lock(sdkMutex);
+		part.log << "\nMesh:" << node->GetName();
+
+		// Get index count from mesh
+		numVertices = mesh->GetControlPointsCount();
+		part.log << "\nVertex Count:" << numVertices;
 
-			// copy working data to the global SimpleMesh
-			simpleMesh.indicesList = indicesList;
-			simpleMesh.vertexList = vertexListExpanded;
+		numIndices = mesh->GetPolygonVertexCount();
+		part.log << "\nIndice Count:" << numIndices;
+
+		indices.assign(mesh->GetPolygonVertices(), mesh->GetPolygonVertices() + numIndices);
+		ExtractFBXAttributes(mesh, scale, attributes);
+
+		polygonCount = mesh->GetPolygonCount();
+		polygonStarts.resize(polygonCount);
+		polygonSizes.resize(polygonCount);
+		for (int polygon = 0; polygon < polygonCount; polygon++)
+		{
+			polygonStarts[polygon] = mesh->GetPolygonVertexIndex(polygon);
+			polygonSizes[polygon] = mesh->GetPolygonSize(polygon);
+		}
 
 		//================= Texture ========================================
 
-		int materialCount = childNode->GetSrcObjectCount<FbxSurfaceMaterial>();
+		std::string& nodeTextureFilename = part.textureFilename;
+		int materialCount = node->GetSrcObjectCount<FbxSurfaceMaterial>();
 		//cout << "\nmaterial count: " << materialCount << std::endl;
 
 		for (int index = 0; index < materialCount; index++)
 		{
-			FbxSurfaceMaterial* material = (FbxSurfaceMaterial*)childNode->GetSrcObject<FbxSurfaceMaterial>(index);
+			FbxSurfaceMaterial* material = (FbxSurfaceMaterial*)node->GetSrcObject<FbxSurfaceMaterial>(index);
 			//cout << "\nmaterial: " << material << std::endl;
 
 			if (material != NULL)
@@ -238,7 +741,7 @@ void ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float s
 						// Then, you can get all the properties of the texture, include its name
 						const char* textureName = texture->GetFileName();
 						//cout << "\nTexture Filename " << textureName;
-						textureFilename = textureName;
+						nodeTextureFilename = textureName;
 						FbxProperty p = texture->RootProperty.Find("Filename");
 						//cout << p.Get<FbxString>() << std::endl;
 
@@ -246,15 +749,172 @@ void ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float s
 				}
 
 				// strip out the path and change the file extension
-				textureFilename = getFileName(textureFilename);
-				replaceExt(textureFilename, "dds");
-				//cout << "\nTexture Filename " << textureFilename << endl;
+				nodeTextureFilename = getFileName(nodeTextureFilename);
+				replaceExt(nodeTextureFilename, "dds");
+				//cout << "\nTexture Filename " << nodeTextureFilename << endl;
 
 			}
 		}
 	}
-	// did not find a mesh here so recurse
+
+	// Build the indexed mesh in one pass. Every polygon-vertex is keyed
+	// on its control point, normal and uv and looked up in an open
+	// addressing table (as in MeshUtils::WeldVertices) to find the
+	// vertex it shares; only the first use of a key is stored.
+	// Quads and ngons are triangulated on the way: fans for convex
+	// polygons, ear clipping for concave ones. The scratch vectors
+	// are reused so there are no allocations per polygon.
+	auto indexStart = chrono::high_resolution_clock::now();
+	SimpleMesh<SimpleVertex>& simpleMesh = part.mesh;
+	simpleMesh.vertexList.reserve(numVertices);
+	simpleMesh.indicesList.reserve(numIndices);
+	// control point of each of this node's vertices
+	vector<int> vertexControlPoints;
+	vertexControlPoints.reserve(numVertices);
+
+	size_t tableSize = 16;
+	while (tableSize < (size_t)numIndices * 2)
+		tableSize <<= 1;
+	size_t mask = tableSize - 1;
+	vector<int> table(tableSize, -1);
+
+	vector<XMFLOAT3> corners;
+	vector<XMFLOAT2> projected;
+	vector<int> polygonVertices, faceTriangles, remaining;
+	int fanCount = 0, earClippedCount = 0;
+	for (int polygon = 0; polygon < polygonCount; polygon++)
+	{
+		int polygonSize = polygonSizes[polygon];
+		if (polygonSize < 3)
+			continue;
+
+		// first polygon-vertex of this polygon
+		int first = polygonStarts[polygon];
+		polygonVertices.resize(polygonSize);
+		corners.resize(polygonSize);
+		for (int k = 0; k < polygonSize; k++)
+		{
+			int polygonVertex = first + k;
+			int controlPoint = indices[polygonVertex];
+
+			SimpleVertex vert = {};
+			vert.Pos = attributes.positions[controlPoint];
+			if (!attributes.normals.Empty())
+				vert.Normal = attributes.normals.Get(polygonVertex);
+			if (!attributes.uvs.Empty())
+				vert.Tex = attributes.uvs.Get(polygonVertex);
+
+			// linear probe until we hit a match or an empty slot,
+			// the table holds vertex numbers within this node
+			size_t slot = MeshUtils::HashVertex(vert) & mask;
+			while (table[slot] != -1 && (vertexControlPoints[table[slot]] != controlPoint ||
+				!MeshUtils::VertexEqual(simpleMesh.vertexList[table[slot]], vert)))
+				slot = (slot + 1) & mask;
+
+			if (table[slot] == -1)
+			{
+				table[slot] = (int)vertexControlPoints.size();
+				simpleMesh.vertexList.push_back(vert);
+				vertexControlPoints.push_back(controlPoint);
+			}
+			polygonVertices[k] = table[slot];
+			corners[k] = vert.Pos;
+		}
+
+		if (polygonSize == 3)
+		{
+			simpleMesh.indicesList.insert(simpleMesh.indicesList.end(),
+				{ polygonVertices[0], polygonVertices[1], polygonVertices[2] });
+			continue;
+		}
+
+		faceTriangles.clear();
+		if (MeshUtils::TriangulateFace(corners.data(), polygonSize, faceTriangles, projected, remaining))
+			fanCount++;
 		else
-		ProcessFBXMesh(childNode, simpleMesh, scale, textureFilename);
+			earClippedCount++;
+		for (int corner : faceTriangles)
+			simpleMesh.indicesList.push_back(polygonVertices[corner]);
+	}
+	part.log << "\nPolygons:" << polygonCount << " (" << fanCount << " fanned, " << earClippedCount
+		<< " ear clipped) -> " << simpleMesh.indicesList.size() / 3 << " triangles";
+	part.log << "\nIndexed " << numIndices << " polygon-vertices into " << simpleMesh.vertexList.size()
+		<< " vertices in " << MeshUtils::ElapsedMs(indexStart) << " ms";
+
+	// welded in the node's space, a transform can't merge or split vertices
+	XMMATRIX transform = XMLoadFloat4x4(&placement);
+	if (!XMMatrixIsIdentity(transform))
+		MeshUtils::TransformMesh(simpleMesh, transform);
+}
+
+// Append the parts in node order, each as a submesh. Submeshes with the
+// same texture share a material, the first texture is the one the caller
+// gets in textureFilename
+void MergeFBXMeshParts(vector<FBXMeshPart>& parts, SimpleMesh<SimpleVertex>& simpleMesh, std::string& textureFilename)
+{
+	size_t vertexCount = simpleMesh.vertexList.size(), indexCount = simpleMesh.indicesList.size();
+	for (const FBXMeshPart& part : parts)
+	{
+		vertexCount += part.mesh.vertexList.size();
+		indexCount += part.mesh.indicesList.size();
 	}
-}
\ No newline at end of file
+	simpleMesh.vertexList.reserve(vertexCount);
+	simpleMesh.indicesList.reserve(indexCount);
+
+	for (FBXMeshPart& part : parts)
+	{
+		cout << part.log.str();
+
+		MeshSubmesh submesh;
+		submesh.indexStart = (int)simpleMesh.indicesList.size();
+		submesh.indexCount = (int)part.mesh.indicesList.size();
+		submesh.baseVertex = (int)simpleMesh.vertexList.size();
+		submesh.vertexCount = (int)part.mesh.vertexList.size();
+		simpleMesh.vertexList.insert(simpleMesh.vertexList.end(), part.mesh.vertexList.begin(), part.mesh.vertexList.end());
+		for (int index : part.mesh.indicesList)
+			simpleMesh.indicesList.push_back(submesh.baseVertex + index);
+
+		if (part.textureFilename != "")
+		{
+			auto found = find(simpleMesh.materials.begin(), simpleMesh.materials.end(), part.textureFilename);
+			submesh.material = (int)(found - simpleMesh.materials.begin());
+			if (found == simpleMesh.materials.end())
+				simpleMesh.materials.push_back(part.textureFilename);
+			if (textureFilename == "")
+				textureFilename = part.textureFilename;
+		}
+		simpleMesh.submeshes.push_back(submesh);
+	}
+}
+
+// Collect the mesh nodes under Node and their placements first, then build
+// each one with ProcessFBXMeshNode followed by optimize(part) as a task on
+// up to threadCount threads, their reads from the scene taking turns, and
+// merge the parts in node order. The output only
+// depends on the file, not on the thread count or which task ends first
+template <typename Func>
+void ProcessFBXMeshNodes(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float scale, std::string& textureFilename,
+	unsigned threadCount, Func optimize)
+{
+	vector<FbxNode*> meshNodes;
+	CollectFBXMeshNodes(Node, meshNodes);
+
+	vector<XMFLOAT4X4> placements;
+	FBXMeshPlacements(meshNodes, scale, placements);
+
+	vector<FBXMeshPart> parts(meshNodes.size());
+	std::mutex sdkMutex;
+	MeshUtils::ParallelFor((unsigned)meshNodes.size(), max(threadCount, 1u), [&](unsigned i)
+	{
+		ProcessFBXMeshNode(meshNodes[i], scale, placements[i], parts[i], sdkMutex);
+		optimize(parts[i]);
+	});
+
+	MergeFBXMeshParts(parts, simpleMesh, textureFilename);
+}
+
+void ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, float scale, std::string& textureFilename)
+{
+	cout << "\nName:" << Node->GetName();
+	ProcessFBXMeshNodes(Node, simpleMesh, scale, textureFilename, 1, [](FBXMeshPart&) {});
+}
@@ -1,9 +1,31 @@
 #pragma once
 #include <directxmath.h>
+#include <DirectXPackedVector.h>
 #include <vector>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <array>
+#include <cfloat>
+#include <string>
+#include "VertexFormat.h"
+#if defined(_M_X64) || defined(__SSSE3__)
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 using namespace std;
 using namespace DirectX;
+using namespace DirectX::PackedVector;
 
 struct SimpleVertex
 {
@@ -12,75 +34,4083 @@ struct SimpleVertex
 	XMFLOAT2 Tex;
 };
 
+template <>
+struct VertexFormat<SimpleVertex>
+{
+	static constexpr VertexElement elements[] =
+	{
+		{ "POSITION", 0, VertexElementType::Float3, offsetof(SimpleVertex, Pos) },
+		{ "NORMAL", 0, VertexElementType::Float3, offsetof(SimpleVertex, Normal) },
+		{ "TEXCOORD", 0, VertexElementType::Float2, offsetof(SimpleVertex, Tex) },
+	};
+};
+
+// Quantized vertex, 16 bytes instead of 32
+// Pos is unorm16 inside the mesh bounds (w unused), Normal is an
+// octahedral encoded unit vector and Tex is half float.
+// An snorm8 normal would not shrink the vertex further since every
+// element still has to start on a 4 byte boundary
+struct PackedVertex
+{
+	XMUSHORTN4 Pos;
+	XMSHORTN2 Normal;
+	XMHALF2 Tex;
+};
+
+template <>
+struct VertexFormat<PackedVertex>
+{
+	static constexpr VertexElement elements[] =
+	{
+		{ "POSITION", 0, VertexElementType::UNorm16x4, offsetof(PackedVertex, Pos) },
+		{ "NORMAL", 0, VertexElementType::SNorm16x2, offsetof(PackedVertex, Normal) },
+		{ "TEXCOORD", 0, VertexElementType::Half2, offsetof(PackedVertex, Tex) },
+	};
+};
+
+// Bounding volumes of a mesh, in mesh space until transformed
+struct MeshBounds
+{
+	// false until ComputeMeshBounds has run
+	bool valid = false;
+	XMFLOAT3 aabbMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 aabbMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 sphereCenter = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float sphereRadius = 0.0f;
+	// oriented box as center, unit axes and half extents along the axes,
+	// only filled in when requested (otherwise hasOBB is false)
+	bool hasOBB = false;
+	XMFLOAT3 obbCenter = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 obbAxes[3] = { XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f) };
+	XMFLOAT3 obbExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+};
+
+// One level of detail stored as a range of the shared index list
+struct MeshLOD
+{
+	int indexStart = 0;
+	int indexCount = 0;
+	// simplification error in mesh units
+	float error = 0.0f;
+};
+
+// Full detail triangles sorted back to front for views looking along
+// direction (mesh space), stored as a range of the shared index list
+struct ViewOrder
+{
+	int indexStart = 0;
+	int indexCount = 0;
+	XMFLOAT3 direction = XMFLOAT3(0.0f, 0.0f, 1.0f);
+};
+
+// One part of a multi-part mesh (one mesh node of an FBX file): a range
+// of the full detail indices over its own range of the vertices. Indices
+// stay absolute, baseVertex is where the part's vertices start
+struct MeshSubmesh
+{
+	int indexStart = 0;
+	int indexCount = 0;
+	int baseVertex = 0;
+	int vertexCount = 0;
+	// index into SimpleMesh::materials, -1 for none
+	int material = -1;
+};
+
 template <typename T>
 struct SimpleMesh
 {
 	vector<T> vertexList;
 	vector<int> indicesList;
+	// empty, or LOD 0 (full detail) followed by the simplified levels
+	vector<MeshLOD> lods;
+	// back to front orders for blending, after the LODs in indicesList
+	vector<ViewOrder> viewOrders;
+	// optional tightly packed copy of the positions for position only passes
+	vector<XMFLOAT3> positionList;
+	MeshBounds bounds;
+	// empty for single part meshes, else the parts of the full detail level
+	vector<MeshSubmesh> submeshes;
+	// texture filename of each material the submeshes use
+	vector<string> materials;
 };
 
-namespace MeshUtils
-{
-	void Compactify(SimpleMesh<SimpleVertex>& simpleMesh)
+namespace MeshUtils
+{
+	// milliseconds elapsed since start, used for the timing reports
+	double ElapsedMs(chrono::high_resolution_clock::time_point start)
+	{
+		return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Hash the exact bit pattern of every 32 bit word of the vertex's
+	// elements (see VertexFormat). -0.0f is folded into 0.0f in float
+	// elements so that vertices which compare equal with == always land
+	// in the same bucket
+	template <typename T>
+	uint32_t HashVertex(const T& vert)
+	{
+		uint32_t hash = 0x811c9dc5;
+		ForEachVertexElement<T>([&](auto i)
+		{
+			constexpr VertexElement element = VertexFormat<T>::elements[decltype(i)::value];
+			const uint8_t* data = (const uint8_t*)&vert + element.offset;
+			for (unsigned word = 0; word < VertexElementSize(element.type) / 4; word++)
+			{
+				uint32_t bits;
+				memcpy(&bits, data + word * 4, sizeof(bits));
+				if (VertexElementIsFloat(element.type) && (bits & 0x7fffffff) == 0)
+					bits = 0;
+
+				// murmur style mix of each 32 bit word
+				bits *= 0xcc9e2d51;
+				bits = (bits << 15) | (bits >> 17);
+				hash ^= bits * 0x1b873593;
+				hash = ((hash << 13) | (hash >> 19)) * 5 + 0xe6546b64;
+			}
+		});
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6b;
+		hash ^= hash >> 13;
+		return hash;
+	}
+
+	// Float elements compare with == like the original welding loop,
+	// packed elements by their bits
+	template <typename T>
+	bool VertexEqual(const T& a, const T& b)
+	{
+		bool equal = true;
+		ForEachVertexElement<T>([&](auto i)
+		{
+			constexpr VertexElement element = VertexFormat<T>::elements[decltype(i)::value];
+			const uint8_t* dataA = (const uint8_t*)&a + element.offset;
+			const uint8_t* dataB = (const uint8_t*)&b + element.offset;
+			if constexpr (VertexElementIsFloat(element.type))
+			{
+				for (unsigned component = 0; component < VertexElementSize(element.type) / 4; component++)
+					equal = equal && ((const float*)dataA)[component] == ((const float*)dataB)[component];
+			}
+			else
+				equal = equal && memcmp(dataA, dataB, VertexElementSize(element.type)) == 0;
+		});
+		return equal;
+	}
+
+	// Weld identical vertices using an open addressing hash table.
+	// remap[i] receives the compacted index of vertexList[i]; compacted
+	// vertices are kept in order of first appearance
+	template <typename T>
+	void WeldVertices(const vector<T>& vertexList,
+		vector<T>& compactedVertexList, vector<int>& remap)
+	{
+		size_t numVertices = vertexList.size();
+
+		compactedVertexList.clear();
+		compactedVertexList.reserve(numVertices);
+		remap.resize(numVertices);
+
+		// power of two table at least twice the vertex count
+		// keeps the probe chains short
+		size_t tableSize = 16;
+		while (tableSize < numVertices * 2)
+			tableSize <<= 1;
+		size_t mask = tableSize - 1;
+		vector<int> table(tableSize, -1);
+
+		for (size_t i = 0; i < numVertices; i++)
+		{
+			const T& vert = vertexList[i];
+
+			// linear probe until we hit a match or an empty slot
+			size_t slot = HashVertex(vert) & mask;
+			while (table[slot] != -1 && !VertexEqual(compactedVertexList[table[slot]], vert))
+				slot = (slot + 1) & mask;
+
+			if (table[slot] == -1)
+			{
+				table[slot] = (int)compactedVertexList.size();
+				compactedVertexList.push_back(vert);
+			}
+			remap[i] = table[slot];
+		}
+	}
+
+	// The original O(n^2) welding loop, kept as the reference
+	// implementation for BenchmarkCompactify
+	template <typename T>
+	void WeldVerticesBruteForce(const vector<T>& vertexList,
+		vector<T>& compactedVertexList, vector<int>& remap)
+	{
+		compactedVertexList.clear();
+		remap.resize(vertexList.size());
+
+		// for each vertex in the expanded array
+		// compare to the compacted array for a matching
+		// vertex, if found, skip adding and set the index
+		for (size_t i = 0; i < vertexList.size(); i++)
+		{
+			bool found = false;
+			for (size_t j = 0; j < compactedVertexList.size(); j++)
+			{
+				if (VertexEqual(vertexList[i], compactedVertexList[j]))
+				{
+					remap[i] = (int)j;
+					found = true;
+					break;
+				}
+			}
+			// didn't find a duplicate so keep (push back) the current vertex
+			if (!found)
+			{
+				remap[i] = (int)compactedVertexList.size();
+				compactedVertexList.push_back(vertexList[i]);
+			}
+		}
+	}
+
+	// Run func(0) .. func(taskCount - 1) spread over threadCount threads,
+	// the calling thread takes part as one of the workers
+	template <typename Func>
+	void ParallelFor(unsigned taskCount, unsigned threadCount, Func func)
+	{
+		atomic<unsigned> nextTask(0);
+		auto worker = [&]()
+		{
+			for (unsigned task = nextTask++; task < taskCount; task = nextTask++)
+				func(task);
+		};
+
+		vector<thread> workers;
+		for (unsigned i = 1; i < threadCount && i < taskCount; i++)
+			workers.emplace_back(worker);
+		worker();
+		for (thread& t : workers)
+			t.join();
+	}
+
+	// Sharded version of WeldVertices for very large meshes.
+	// Vertices are partitioned by key hash so each shard can be welded
+	// on its own thread, then the remap table is stitched back together.
+	// Every shard visits its vertices in ascending order, so the first
+	// occurrence of each key wins exactly as in the single threaded weld
+	// and the output is identical for any thread count
+	template <typename T>
+	void WeldVerticesParallel(const vector<T>& vertexList,
+		vector<T>& compactedVertexList, vector<int>& remap, unsigned threadCount)
+	{
+		size_t numVertices = vertexList.size();
+		unsigned shardCount = threadCount * 4;
+		unsigned chunkCount = threadCount * 4;
+		size_t chunkSize = (numVertices + chunkCount - 1) / chunkCount;
+
+		vector<uint32_t> hashes(numVertices);
+		vector<int> firstIndex(numVertices);
+		remap.resize(numVertices);
+
+		// 1. hash every vertex and bucket it by (chunk, shard)
+		vector<vector<int>> buckets(chunkCount * shardCount);
+		ParallelFor(chunkCount, threadCount, [&](unsigned chunk)
+		{
+			size_t begin = min(chunk * chunkSize, numVertices);
+			size_t end = min(begin + chunkSize, numVertices);
+			for (size_t i = begin; i < end; i++)
+			{
+				uint32_t hash = HashVertex(vertexList[i]);
+				hashes[i] = hash;
+				// high bits pick the shard, low bits pick the table slot
+				unsigned shard = (unsigned)(((uint64_t)hash * shardCount) >> 32);
+				buckets[chunk * shardCount + shard].push_back((int)i);
+			}
+		});
+
+		// 2. weld each shard, recording the first expanded index of every key
+		ParallelFor(shardCount, threadCount, [&](unsigned shard)
+		{
+			size_t shardVertices = 0;
+			for (unsigned chunk = 0; chunk < chunkCount; chunk++)
+				shardVertices += buckets[chunk * shardCount + shard].size();
+
+			size_t tableSize = 16;
+			while (tableSize < shardVertices * 2)
+				tableSize <<= 1;
+			size_t mask = tableSize - 1;
+			vector<int> table(tableSize, -1);
+
+			for (unsigned chunk = 0; chunk < chunkCount; chunk++)
+			{
+				for (int i : buckets[chunk * shardCount + shard])
+				{
+					size_t slot = hashes[i] & mask;
+					while (table[slot] != -1 && !VertexEqual(vertexList[table[slot]], vertexList[i]))
+						slot = (slot + 1) & mask;
+
+					if (table[slot] == -1)
+						table[slot] = i;
+					firstIndex[i] = table[slot];
+				}
+			}
+		});
+
+		// 3. count the kept vertices per chunk and prefix sum them
+		// to find where each chunk writes its compacted vertices
+		vector<int> chunkBase(chunkCount + 1, 0);
+		ParallelFor(chunkCount, threadCount, [&](unsigned chunk)
+		{
+			size_t begin = min(chunk * chunkSize, numVertices);
+			size_t end = min(begin + chunkSize, numVertices);
+			int kept = 0;
+			for (size_t i = begin; i < end; i++)
+				kept += firstIndex[i] == (int)i;
+			chunkBase[chunk + 1] = kept;
+		});
+		for (unsigned chunk = 0; chunk < chunkCount; chunk++)
+			chunkBase[chunk + 1] += chunkBase[chunk];
+
+		// 4. write out the kept vertices in order of first appearance
+		compactedVertexList.resize(chunkBase[chunkCount]);
+		ParallelFor(chunkCount, threadCount, [&](unsigned chunk)
+		{
+			size_t begin = min(chunk * chunkSize, numVertices);
+			size_t end = min(begin + chunkSize, numVertices);
+			int compactedIndex = chunkBase[chunk];
+			for (size_t i = begin; i < end; i++)
+			{
+				if (firstIndex[i] == (int)i)
+				{
+					compactedVertexList[compactedIndex] = vertexList[i];
+					remap[i] = compactedIndex++;
+				}
+			}
+		});
+
+		// 5. stitch the duplicates to their first occurrence
+		ParallelFor(chunkCount, threadCount, [&](unsigned chunk)
+		{
+			size_t begin = min(chunk * chunkSize, numVertices);
+			size_t end = min(begin + chunkSize, numVertices);
+			for (size_t i = begin; i < end; i++)
+			{
+				if (firstIndex[i] != (int)i)
+					remap[i] = remap[firstIndex[i]];
+			}
+		});
+	}
+
+	// below this many vertices the threading overhead outweighs the gain
+	const size_t parallelWeldThreshold = 1 << 16;
+
+	template <typename T>
+	void Compactify(SimpleMesh<T>& simpleMesh, unsigned threadCount = 1)
+	{
+		vector<T> compactedVertexList;
+		vector<int> remap;
+
+		auto start = chrono::high_resolution_clock::now();
+		if (threadCount > 1 && simpleMesh.vertexList.size() >= parallelWeldThreshold)
+			WeldVerticesParallel(simpleMesh.vertexList, compactedVertexList, remap, threadCount);
+		else
+			WeldVertices(simpleMesh.vertexList, compactedVertexList, remap);
+
+		// point the indices at the welded vertices
+		for (int& index : simpleMesh.indicesList)
+			index = remap[index];
+		double weldTime = ElapsedMs(start);
+
+		int numIndices = (int)simpleMesh.indicesList.size();
+		int numVertices = (int)simpleMesh.vertexList.size();
+
+		// print out some stats
+		cout << "index count BEFORE/AFTER compaction " << numIndices << endl;
+		cout << "vertex count UNOPTIMIZED (SimpleMesh In): " << numVertices << endl;
+		cout << "vertex count AFTER compaction (SimpleMesh Out): " << compactedVertexList.size() << endl;
+		cout << "Size reduction: " << ((numVertices - compactedVertexList.size()) / (float)numVertices) * 100.00f << "%" << endl;
+		cout << "or " << (compactedVertexList.size() / (float)numVertices) << " of the expanded size" << endl;
+		cout << "compaction time: " << weldTime << " ms" << endl;
+
+		// move working data to the global SimpleMesh
+		simpleMesh.vertexList = move(compactedVertexList);
+	}
+
+	// Undo the indexing: one vertex per index and indices 0 .. n-1, the
+	// layout the welds above start from
+	template <typename T>
+	void ExpandMesh(SimpleMesh<T>& simpleMesh)
+	{
+		vector<T> expanded;
+		expanded.reserve(simpleMesh.indicesList.size());
+		for (int& index : simpleMesh.indicesList)
+		{
+			expanded.push_back(simpleMesh.vertexList[index]);
+			index = (int)expanded.size() - 1;
+		}
+		simpleMesh.vertexList = move(expanded);
+
+		// each part now owns the vertices of its own indices
+		for (MeshSubmesh& submesh : simpleMesh.submeshes)
+		{
+			submesh.baseVertex = submesh.indexStart;
+			submesh.vertexCount = submesh.indexCount;
+		}
+	}
+
+	// Run pass on every part of a multi-part mesh on its own, so the
+	// reordering passes never move triangles or vertices between parts.
+	// The pass gets a mesh holding just the part, it may reorder or drop
+	// vertices but must keep the triangle count. Meshes with at most one
+	// submesh are passed as they are
+	template <typename T, typename Pass>
+	void ForEachSubmesh(SimpleMesh<T>& simpleMesh, Pass pass)
+	{
+		if (simpleMesh.submeshes.size() <= 1)
+		{
+			pass(simpleMesh);
+			return;
+		}
+
+		vector<T> vertexList;
+		vertexList.reserve(simpleMesh.vertexList.size());
+		for (MeshSubmesh& submesh : simpleMesh.submeshes)
+		{
+			SimpleMesh<T> part;
+			part.vertexList.assign(simpleMesh.vertexList.begin() + submesh.baseVertex,
+				simpleMesh.vertexList.begin() + submesh.baseVertex + submesh.vertexCount);
+			part.indicesList.assign(simpleMesh.indicesList.begin() + submesh.indexStart,
+				simpleMesh.indicesList.begin() + submesh.indexStart + submesh.indexCount);
+			for (int& index : part.indicesList)
+				index -= submesh.baseVertex;
+
+			pass(part);
+
+			submesh.baseVertex = (int)vertexList.size();
+			submesh.vertexCount = (int)part.vertexList.size();
+			vertexList.insert(vertexList.end(), part.vertexList.begin(), part.vertexList.end());
+			for (int i = 0; i < submesh.indexCount; i++)
+				simpleMesh.indicesList[submesh.indexStart + i] = submesh.baseVertex + part.indicesList[i];
+		}
+		simpleMesh.vertexList = move(vertexList);
+	}
+
+	// Time the hash weld against the brute force weld on an expanded
+	// (not yet compacted) mesh and check both produce the same output
+	template <typename T>
+	void BenchmarkCompactify(const SimpleMesh<T>& simpleMesh)
+	{
+		vector<T> hashedVertices, bruteVertices;
+		vector<int> hashedRemap, bruteRemap;
+
+		auto start = chrono::high_resolution_clock::now();
+		WeldVerticesBruteForce(simpleMesh.vertexList, bruteVertices, bruteRemap);
+		double bruteTime = ElapsedMs(start);
+
+		start = chrono::high_resolution_clock::now();
+		WeldVertices(simpleMesh.vertexList, hashedVertices, hashedRemap);
+		double hashedTime = ElapsedMs(start);
+
+		bool identical = hashedRemap == bruteRemap &&
+			hashedVertices.size() == bruteVertices.size() &&
+			memcmp(hashedVertices.data(), bruteVertices.data(), hashedVertices.size() * sizeof(T)) == 0;
+
+		cout << "Compactify " << simpleMesh.vertexList.size() << " -> " << hashedVertices.size() << " vertices" << endl;
+		cout << "  brute force: " << bruteTime << " ms" << endl;
+		cout << "  hashed: " << hashedTime << " ms" << endl;
+		cout << "  speedup: " << bruteTime / max(hashedTime, 0.001) << "x" << endl;
+		cout << "  output " << (identical ? "identical" : "MISMATCH") << endl;
+	}
+
+	// Time the sharded weld for 1, 2, 4 .. hardware thread counts.
+	// The mesh is tiled copies times (each copy offset so nothing welds
+	// across copies) to reach a size where threading matters
+	void BenchmarkCompactifyThreads(const SimpleMesh<SimpleVertex>& simpleMesh, int copies)
+	{
+		vector<SimpleVertex> tiled;
+		tiled.reserve(simpleMesh.vertexList.size() * copies);
+		for (int copy = 0; copy < copies; copy++)
+		{
+			for (SimpleVertex vert : simpleMesh.vertexList)
+			{
+				vert.Pos.x += copy * 1000.0f;
+				tiled.push_back(vert);
+			}
+		}
+
+		vector<SimpleVertex> serialVertices;
+		vector<int> serialRemap;
+		auto start = chrono::high_resolution_clock::now();
+		WeldVertices(tiled, serialVertices, serialRemap);
+		double serialTime = ElapsedMs(start);
+
+		cout << "Compactify thread sweep, " << tiled.size() << " -> " << serialVertices.size() << " vertices" << endl;
+		cout << "  serial: " << serialTime << " ms" << endl;
+
+		unsigned maxThreads = max(thread::hardware_concurrency(), 1u);
+		for (unsigned threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+		{
+			vector<SimpleVertex> parallelVertices;
+			vector<int> parallelRemap;
+			start = chrono::high_resolution_clock::now();
+			WeldVerticesParallel(tiled, parallelVertices, parallelRemap, threadCount);
+			double parallelTime = ElapsedMs(start);
+
+			bool identical = parallelRemap == serialRemap &&
+				parallelVertices.size() == serialVertices.size() &&
+				memcmp(parallelVertices.data(), serialVertices.data(), serialVertices.size() * sizeof(SimpleVertex)) == 0;
+
+			cout << "  " << threadCount << " threads: " << parallelTime << " ms, "
+				<< serialTime / max(parallelTime, 0.001) << "x, output "
+				<< (identical ? "identical" : "MISMATCH") << endl;
+		}
+	}
+
+	// Post transform vertex cache statistics
+	// ACMR = vertices transformed per triangle (0.5 is ideal, 3 is worst)
+	// ATVR = vertices transformed per referenced vertex (1.0 is ideal)
+	struct VertexCacheStats
+	{
+		float acmr = 0.0f;
+		float atvr = 0.0f;
+	};
+
+	// Simulate a FIFO post transform cache of cacheSize entries
+	VertexCacheStats AnalyzeVertexCache(const int* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize = 16)
+	{
+		VertexCacheStats stats;
+		if (indexCount < 3)
+			return stats;
+
+		// cacheTime[v] is the miss counter value when v entered the cache
+		vector<size_t> cacheTime(vertexCount, 0);
+		vector<bool> referenced(vertexCount, false);
+		size_t misses = 0;
+		size_t uniqueVertices = 0;
+
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			int v = indices[i];
+			if (!referenced[v])
+			{
+				referenced[v] = true;
+				uniqueVertices++;
+			}
+			// in a FIFO the vertex is still resident if fewer than
+			// cacheSize misses happened since it was loaded
+			if (cacheTime[v] == 0 || misses + 1 - cacheTime[v] > cacheSize)
+			{
+				misses++;
+				cacheTime[v] = misses;
+			}
+		}
+
+		stats.acmr = misses / (float)(indexCount / 3);
+		stats.atvr = misses / (float)uniqueVertices;
+		return stats;
+	}
+
+	// Reorder triangles for post transform cache reuse using Tom Forsyth's
+	// "Linear-Speed Vertex Cache Optimisation". Triangles are emitted greedily,
+	// always taking the highest scoring one, where vertices score for being
+	// recently used and for having few triangles left to draw
+	void OptimizeVertexCache(int* indices, size_t indexCount, size_t vertexCount)
+	{
+		const int cacheSize = 32;
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+			return;
+
+		// precomputed score tables
+		float cacheScores[cacheSize];
+		for (int i = 0; i < cacheSize; i++)
+		{
+			// the last triangle's vertices get a fixed score so the algorithm
+			// doesn't favour strips over fans
+			if (i < 3)
+				cacheScores[i] = 0.75f;
+			else
+				cacheScores[i] = powf(1.0f - (i - 3) / (float)(cacheSize - 3), 1.5f);
+		}
+		const int maxValence = 32;
+		float valenceScores[maxValence];
+		for (int i = 0; i < maxValence; i++)
+			valenceScores[i] = i == 0 ? 0.0f : 2.0f / sqrtf((float)i);
+
+		// vertex -> triangle adjacency
+		vector<int> triangleCounts(vertexCount, 0);
+		for (size_t i = 0; i < indexCount; i++)
+			triangleCounts[indices[i]]++;
+
+		vector<int> triangleOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			triangleOffsets[v + 1] = triangleOffsets[v] + triangleCounts[v];
+
+		vector<int> adjacency(indexCount);
+		vector<int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < indexCount; i++)
+			adjacency[fill[indices[i]]++] = (int)(i / 3);
+
+		// remaining (live) triangles per vertex live at the front of each adjacency list
+		vector<int> liveTriangles = triangleCounts;
+		vector<int> cachePosition(vertexCount, -1);
+
+		auto vertexScore = [&](int v)
+		{
+			int live = liveTriangles[v];
+			if (live == 0)
+				return -1.0f;
+			float score = cachePosition[v] >= 0 ? cacheScores[cachePosition[v]] : 0.0f;
+			return score + (live < maxValence ? valenceScores[live] : 2.0f / sqrtf((float)live));
+		};
+
+		vector<float> vertexScores(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScores[v] = vertexScore((int)v);
+
+		vector<float> triangleScores(triangleCount);
+		vector<bool> emitted(triangleCount, false);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			triangleScores[t] = vertexScores[indices[t * 3 + 0]] +
+				vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		}
+
+		vector<int> output;
+		output.reserve(indexCount);
+
+		// extra 3 slots hold the vertices pushed past the end of the cache
+		int cache[cacheSize + 3];
+		int cacheCount = 0;
+		size_t nextCandidate = 0;
+		int bestTriangle = -1;
+
+		for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+		{
+			// nothing adjacent to the cache scored, take the next unused triangle
+			if (bestTriangle < 0)
+			{
+				while (emitted[nextCandidate])
+					nextCandidate++;
+				bestTriangle = (int)nextCandidate;
+			}
+
+			int tri = bestTriangle;
+			emitted[tri] = true;
+
+			int newCache[cacheSize + 3];
+			int newCacheCount = 0;
+
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[tri * 3 + k];
+				output.push_back(v);
+				newCache[newCacheCount++] = v;
+
+				// remove the triangle from the vertex's live list
+				int* list = &adjacency[triangleOffsets[v]];
+				int live = liveTriangles[v];
+				for (int j = 0; j < live; j++)
+				{
+					if (list[j] == tri)
+					{
+						swap(list[j], list[live - 1]);
+						break;
+					}
+				}
+				liveTriangles[v]--;
+			}
+
+			// the rest of the old cache moves back behind the new triangle
+			for (int i = 0; i < cacheCount; i++)
+			{
+				int v = cache[i];
+				if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+					newCache[newCacheCount++] = v;
+			}
+
+			// update cache positions, anything past the end falls out
+			for (int i = 0; i < newCacheCount; i++)
+				cachePosition[newCache[i]] = i < cacheSize ? i : -1;
+
+			// rescore every vertex whose cache position changed (the ones
+			// that fell out included) and the triangles using them
+			for (int i = 0; i < newCacheCount; i++)
+			{
+				int v = newCache[i];
+				float score = vertexScore(v);
+				float delta = score - vertexScores[v];
+				vertexScores[v] = score;
+
+				int* list = &adjacency[triangleOffsets[v]];
+				for (int j = 0; j < liveTriangles[v]; j++)
+					triangleScores[list[j]] += delta;
+			}
+
+			// only then pick the best triangle touching the cache, so no
+			// candidate is compared on a partly updated score
+			bestTriangle = -1;
+			float bestScore = -1.0f;
+			for (int i = 0; i < newCacheCount; i++)
+			{
+				int v = newCache[i];
+				int* list = &adjacency[triangleOffsets[v]];
+				for (int j = 0; j < liveTriangles[v]; j++)
+				{
+					int t = list[j];
+					if (triangleScores[t] > bestScore)
+					{
+						bestScore = triangleScores[t];
+						bestTriangle = t;
+					}
+				}
+			}
+
+			cacheCount = min(newCacheCount, cacheSize);
+			memcpy(cache, newCache, cacheCount * sizeof(int));
+		}
+
+		memcpy(indices, output.data(), indexCount * sizeof(int));
+	}
+
+	// Optimize the triangle order of a whole mesh and report the win to log
+	template <typename T>
+	void OptimizeVertexCache(SimpleMesh<T>& simpleMesh, ostream& log = cout)
+	{
+		int* indices = simpleMesh.indicesList.data();
+		size_t indexCount = simpleMesh.indicesList.size();
+		size_t vertexCount = simpleMesh.vertexList.size();
+
+		VertexCacheStats before = AnalyzeVertexCache(indices, indexCount, vertexCount);
+		auto start = chrono::high_resolution_clock::now();
+		OptimizeVertexCache(indices, indexCount, vertexCount);
+		double optimizeTime = ElapsedMs(start);
+		VertexCacheStats after = AnalyzeVertexCache(indices, indexCount, vertexCount);
+
+		log << "vertex cache ACMR BEFORE/AFTER: " << before.acmr << " / " << after.acmr << endl;
+		log << "vertex cache ATVR BEFORE/AFTER: " << before.atvr << " / " << after.atvr << endl;
+		log << "vertex cache optimization time: " << optimizeTime << " ms" << endl;
+	}
+
+	// Pixel overdraw measured by the CPU rasterizer in AnalyzeOverdraw
+	// overdraw = pixelsShaded / pixelsCovered (1.0 is ideal)
+	struct OverdrawStats
+	{
+		float overdraw = 0.0f;
+		size_t pixelsCovered = 0;
+		size_t pixelsShaded = 0;
+	};
+
+	// Estimate overdraw without a GPU by rasterizing the mesh with a depth
+	// test into a small grid from the six axis directions, culling back faces.
+	// A fragment counts as shaded whenever it passes the depth test
+	template <typename T>
+	OverdrawStats AnalyzeOverdraw(const int* indices, size_t indexCount, const vector<T>& vertexList)
+	{
+		const int gridSize = 256;
+		OverdrawStats stats;
+		if (vertexList.empty() || indexCount < 3)
+			return stats;
+
+		// normalize the mesh into the unit cube
+		XMFLOAT3 minPos = vertexList[0].Pos, maxPos = vertexList[0].Pos;
+		for (const T& vert : vertexList)
+		{
+			minPos = XMFLOAT3(min(minPos.x, vert.Pos.x), min(minPos.y, vert.Pos.y), min(minPos.z, vert.Pos.z));
+			maxPos = XMFLOAT3(max(maxPos.x, vert.Pos.x), max(maxPos.y, vert.Pos.y), max(maxPos.z, vert.Pos.z));
+		}
+		float extent = max(max(maxPos.x - minPos.x, maxPos.y - minPos.y), maxPos.z - minPos.z);
+		float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+		vector<float> depth(gridSize * gridSize);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int sign = 1; sign >= -1; sign -= 2)
+			{
+				// anything past the far plane (1.0) means nothing drawn
+				fill(depth.begin(), depth.end(), 2.0f);
+
+				for (size_t i = 0; i + 2 < indexCount; i += 3)
+				{
+					float sx[3], sy[3], sz[3];
+					for (int k = 0; k < 3; k++)
+					{
+						const XMFLOAT3& pos = vertexList[indices[i + k]].Pos;
+						float p[3] = { (pos.x - minPos.x) * scale, (pos.y - minPos.y) * scale, (pos.z - minPos.z) * scale };
+						sx[k] = p[(axis + 1) % 3] * gridSize;
+						sy[k] = p[(axis + 2) % 3] * gridSize;
+						sz[k] = sign > 0 ? p[axis] : 1.0f - p[axis];
+					}
+
+					// clockwise triangles are front facing, as in the default
+					// raster state. Looking down the negative axis mirrors the
+					// image, which flips which winding is front facing
+					float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+					if (area * sign >= 0.0f)
+						continue;
+
+					int minX = max((int)min(min(sx[0], sx[1]), sx[2]), 0);
+					int maxX = min((int)max(max(sx[0], sx[1]), sx[2]), gridSize - 1);
+					int minY = max((int)min(min(sy[0], sy[1]), sy[2]), 0);
+					int maxY = min((int)max(max(sy[0], sy[1]), sy[2]), gridSize - 1);
+
+					for (int y = minY; y <= maxY; y++)
+					{
+						for (int x = minX; x <= maxX; x++)
+						{
+							// barycentrics of the pixel center
+							float px = x + 0.5f, py = y + 0.5f;
+							float w0 = ((sx[1] - px) * (sy[2] - py) - (sx[2] - px) * (sy[1] - py)) / area;
+							float w1 = ((sx[2] - px) * (sy[0] - py) - (sx[0] - px) * (sy[2] - py)) / area;
+							float w2 = 1.0f - w0 - w1;
+							if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+								continue;
+
+							float z = w0 * sz[0] + w1 * sz[1] + w2 * sz[2];
+							float& stored = depth[y * gridSize + x];
+							if (z < stored)
+							{
+								stored = z;
+								stats.pixelsShaded++;
+							}
+						}
+					}
+				}
+
+				for (float z : depth)
+					stats.pixelsCovered += z < 2.0f;
+			}
+		}
+
+		stats.overdraw = stats.pixelsCovered ? stats.pixelsShaded / (float)stats.pixelsCovered : 0.0f;
+		return stats;
+	}
+
+	// Reorder an already cache optimized index buffer to reduce overdraw,
+	// following Sander, Nehab and Barczak "Fast Triangle Reordering for
+	// Vertex Locality and Reduced Overdraw".
+	// The triangle order is cut into clusters wherever the vertex cache
+	// would start cold anyway, and further wherever the running ACMR of the
+	// cluster drops to threshold * the ACMR of its enclosing cluster.
+	// Clusters are then sorted so the ones on the outside facing outward
+	// draw first. threshold 1.0 keeps nearly all of the cache gain, larger
+	// values make more (smaller) clusters and trade cache hits for overdraw.
+	// The cluster counts are reported to log
+	template <typename T>
+	void OptimizeOverdraw(int* indices, size_t indexCount, const vector<T>& vertexList, float threshold, ostream& log = cout)
+	{
+		const unsigned cacheSize = 16;
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+			return;
+
+		// FIFO cache simulation shared by both clustering passes;
+		// bumping cacheReset flushes the cache
+		vector<size_t> cacheTime(vertexList.size(), 0);
+		size_t time = 0;
+		size_t cacheReset = 0;
+		auto triangleMisses = [&](size_t tri)
+		{
+			unsigned misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[tri * 3 + k];
+				if (cacheTime[v] <= cacheReset || time + 1 - cacheTime[v] > cacheSize)
+				{
+					time++;
+					cacheTime[v] = time;
+					misses++;
+				}
+			}
+			return misses;
+		};
+
+		// hard boundaries where every vertex of a triangle misses
+		vector<size_t> hardBoundaries;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			if (triangleMisses(t) == 3)
+				hardBoundaries.push_back(t);
+		}
+		if (hardBoundaries.empty() || hardBoundaries[0] != 0)
+			hardBoundaries.insert(hardBoundaries.begin(), 0);
+		hardBoundaries.push_back(triangleCount);
+
+		// soft boundaries inside each hard cluster
+		vector<size_t> clusters;
+		for (size_t h = 0; h + 1 < hardBoundaries.size(); h++)
+		{
+			size_t start = hardBoundaries[h], end = hardBoundaries[h + 1];
+
+			cacheReset = time;
+			size_t clusterMisses = 0;
+			for (size_t t = start; t < end; t++)
+				clusterMisses += triangleMisses(t);
+			float clusterThreshold = threshold * clusterMisses / (float)(end - start);
+
+			cacheReset = time;
+			size_t softStart = start;
+			size_t softMisses = 0;
+			clusters.push_back(start);
+			for (size_t t = start; t < end; t++)
+			{
+				softMisses += triangleMisses(t);
+				if (t + 1 < end && softMisses / (float)(t + 1 - softStart) <= clusterThreshold)
+				{
+					softStart = t + 1;
+					softMisses = 0;
+					cacheReset = time;
+					clusters.push_back(softStart);
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+		size_t clusterCount = clusters.size() - 1;
+
+		// area weighted centroid and normal of each cluster
+		vector<XMFLOAT3> centroids(clusterCount), normals(clusterCount);
+		XMFLOAT3 meshCentroid(0.0f, 0.0f, 0.0f);
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			XMFLOAT3 centroid(0.0f, 0.0f, 0.0f), normal(0.0f, 0.0f, 0.0f);
+			float clusterArea = 0.0f;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+			{
+				const XMFLOAT3& p0 = vertexList[indices[t * 3 + 0]].Pos;
+				const XMFLOAT3& p1 = vertexList[indices[t * 3 + 1]].Pos;
+				const XMFLOAT3& p2 = vertexList[indices[t * 3 + 2]].Pos;
+				XMFLOAT3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+				XMFLOAT3 e2(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+				XMFLOAT3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+				float area = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+
+				centroid.x += (p0.x + p1.x + p2.x) / 3.0f * area;
+				centroid.y += (p0.y + p1.y + p2.y) / 3.0f * area;
+				centroid.z += (p0.z + p1.z + p2.z) / 3.0f * area;
+				normal.x += n.x;
+				normal.y += n.y;
+				normal.z += n.z;
+				clusterArea += area;
+			}
+
+			meshCentroid.x += centroid.x;
+			meshCentroid.y += centroid.y;
+			meshCentroid.z += centroid.z;
+			meshArea += clusterArea;
+
+			float invArea = clusterArea > 0.0f ? 1.0f / clusterArea : 0.0f;
+			centroids[c] = XMFLOAT3(centroid.x * invArea, centroid.y * invArea, centroid.z * invArea);
+			float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+			float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+			normals[c] = XMFLOAT3(normal.x * invLength, normal.y * invLength, normal.z * invLength);
+		}
+		float invMeshArea = meshArea > 0.0f ? 1.0f / meshArea : 0.0f;
+		meshCentroid = XMFLOAT3(meshCentroid.x * invMeshArea, meshCentroid.y * invMeshArea, meshCentroid.z * invMeshArea);
+
+		// clusters further out along their own facing direction draw first
+		vector<float> sortKeys(clusterCount);
+		vector<size_t> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			sortKeys[c] = (centroids[c].x - meshCentroid.x) * normals[c].x +
+				(centroids[c].y - meshCentroid.y) * normals[c].y +
+				(centroids[c].z - meshCentroid.z) * normals[c].z;
+			order[c] = c;
+		}
+		stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		vector<int> output;
+		output.reserve(indexCount);
+		for (size_t c : order)
+			output.insert(output.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+		memcpy(indices, output.data(), output.size() * sizeof(int));
+
+		log << "overdraw clusters: " << clusterCount << " (" << hardBoundaries.size() - 1 << " hard)" << endl;
+	}
+
+	// Reduce the overdraw of a whole (cache optimized) mesh and report the trade off to log
+	template <typename T>
+	void OptimizeOverdraw(SimpleMesh<T>& simpleMesh, float threshold, ostream& log = cout)
+	{
+		int* indices = simpleMesh.indicesList.data();
+		size_t indexCount = simpleMesh.indicesList.size();
+		size_t vertexCount = simpleMesh.vertexList.size();
+
+		VertexCacheStats cacheBefore = AnalyzeVertexCache(indices, indexCount, vertexCount);
+		OverdrawStats overdrawBefore = AnalyzeOverdraw(indices, indexCount, simpleMesh.vertexList);
+		auto start = chrono::high_resolution_clock::now();
+		OptimizeOverdraw(indices, indexCount, simpleMesh.vertexList, threshold, log);
+		double optimizeTime = ElapsedMs(start);
+		VertexCacheStats cacheAfter = AnalyzeVertexCache(indices, indexCount, vertexCount);
+		OverdrawStats overdrawAfter = AnalyzeOverdraw(indices, indexCount, simpleMesh.vertexList);
+
+		log << "overdraw BEFORE/AFTER: " << overdrawBefore.overdraw << " / " << overdrawAfter.overdraw << endl;
+		log << "overdraw pass ACMR BEFORE/AFTER: " << cacheBefore.acmr << " / " << cacheAfter.acmr << endl;
+		log << "overdraw optimization time: " << optimizeTime << " ms" << endl;
+	}
+
+	// Vertex fetch statistics from AnalyzeVertexFetch
+	// fetchRatio = bytes fetched / vertex buffer size (1.0 is ideal)
+	struct VertexFetchStats
+	{
+		size_t bytesFetched = 0;
+		float fetchRatio = 0.0f;
+	};
+
+	// Simulate the memory traffic of the vertex fetch. Only post transform
+	// cache misses (16 entry FIFO) fetch, and they read whole 64 byte lines
+	// through a small FIFO cache of lines
+	VertexFetchStats AnalyzeVertexFetch(const int* indices, size_t indexCount, size_t vertexCount, size_t vertexSize)
+	{
+		const unsigned transformCacheSize = 16;
+		const size_t lineSize = 64;
+		const unsigned lineCacheSize = 64;
+
+		VertexFetchStats stats;
+		if (vertexCount == 0)
+			return stats;
+
+		vector<size_t> transformTime(vertexCount, 0);
+		vector<size_t> lineTime((vertexCount * vertexSize + lineSize - 1) / lineSize, 0);
+		size_t transformMisses = 0, lineMisses = 0;
+
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			int v = indices[i];
+			if (transformTime[v] != 0 && transformMisses + 1 - transformTime[v] <= transformCacheSize)
+				continue;
+			transformTime[v] = ++transformMisses;
+
+			// a vertex can straddle two lines
+			size_t firstLine = v * vertexSize / lineSize;
+			size_t lastLine = ((v + 1) * vertexSize - 1) / lineSize;
+			for (size_t line = firstLine; line <= lastLine; line++)
+			{
+				if (lineTime[line] == 0 || lineMisses + 1 - lineTime[line] > lineCacheSize)
+				{
+					lineTime[line] = ++lineMisses;
+					stats.bytesFetched += lineSize;
+				}
+			}
+		}
+
+		stats.fetchRatio = stats.bytesFetched / (float)(vertexCount * vertexSize);
+		return stats;
+	}
+
+	// Build a remap table that orders vertices by first reference in the
+	// index buffer. Unreferenced vertices get -1. Returns the new vertex count
+	size_t GenerateFirstUseRemap(vector<int>& remap, const int* indices, size_t indexCount, size_t vertexCount)
+	{
+		remap.assign(vertexCount, -1);
+		int nextVertex = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			if (remap[indices[i]] < 0)
+				remap[indices[i]] = nextVertex++;
+		}
+		return nextVertex;
+	}
+
+	// Rewrite the vertex and index lists through a remap table,
+	// vertices mapped to -1 are dropped
+	template <typename T>
+	void RemapVertices(SimpleMesh<T>& simpleMesh, const vector<int>& remap, size_t newVertexCount)
+	{
+		vector<T> vertexList(newVertexCount);
+		for (size_t v = 0; v < simpleMesh.vertexList.size(); v++)
+		{
+			if (remap[v] >= 0)
+				vertexList[remap[v]] = simpleMesh.vertexList[v];
+		}
+		simpleMesh.vertexList = move(vertexList);
+
+		for (int& index : simpleMesh.indicesList)
+			index = remap[index];
+	}
+
+	// Put the vertices in the order the (final) index buffer first uses them
+	// so vertex fetches walk memory mostly forward
+	template <typename T>
+	void OptimizeVertexFetch(SimpleMesh<T>& simpleMesh, bool printStats = false, ostream& log = cout)
+	{
+		size_t vertexCount = simpleMesh.vertexList.size();
+		VertexFetchStats before = AnalyzeVertexFetch(simpleMesh.indicesList.data(), simpleMesh.indicesList.size(), vertexCount, sizeof(T));
+
+		vector<int> remap;
+		size_t newVertexCount = GenerateFirstUseRemap(remap, simpleMesh.indicesList.data(), simpleMesh.indicesList.size(), vertexCount);
+		RemapVertices(simpleMesh, remap, newVertexCount);
+
+		if (printStats)
+		{
+			VertexFetchStats after = AnalyzeVertexFetch(simpleMesh.indicesList.data(), simpleMesh.indicesList.size(), newVertexCount, sizeof(T));
+			log << "vertex fetch ratio BEFORE/AFTER: " << before.fetchRatio << " / " << after.fetchRatio << endl;
+		}
+	}
+
+	// Maps packed positions back to mesh space: pos = offset + q * scale
+	struct QuantizationInfo
+	{
+		XMFLOAT3 positionScale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		XMFLOAT3 positionOffset = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	};
+
+	// Largest round trip error over every vertex of a quantized mesh
+	struct QuantizationError
+	{
+		float maxPositionError = 0.0f;
+		float maxNormalErrorDegrees = 0.0f;
+		float maxTexError = 0.0f;
+	};
+
+	// Octahedral encoding: project the unit vector onto the octahedron
+	// |x|+|y|+|z| = 1 and fold the lower half over the diagonals
+	XMFLOAT2 OctEncode(XMFLOAT3 n)
+	{
+		float invL1 = 1.0f / max(fabsf(n.x) + fabsf(n.y) + fabsf(n.z), 1e-20f);
+		float x = n.x * invL1, y = n.y * invL1;
+		if (n.z < 0.0f)
+		{
+			float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = foldedX;
+			y = foldedY;
+		}
+		return XMFLOAT2(x, y);
+	}
+
+	// Inverse of OctEncode, returns a unit vector (matches Packed_VS.hlsl)
+	XMFLOAT3 OctDecode(XMFLOAT2 e)
+	{
+		XMFLOAT3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+		float t = max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		float invLength = 1.0f / sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+		return XMFLOAT3(n.x * invLength, n.y * invLength, n.z * invLength);
+	}
+
+	uint16_t QuantizeUnorm16(float v)
+	{
+		v = min(max(v, 0.0f), 1.0f);
+		return (uint16_t)(v * 65535.0f + 0.5f);
+	}
+
+	int16_t QuantizeSnorm16(float v)
+	{
+		v = min(max(v, -1.0f), 1.0f);
+		return (int16_t)(v * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+	}
+
+	// Convert one element between two vertex formats. UNorm16x4 holds
+	// positions inside the QuantizationInfo box, SNorm16x2 octahedral
+	// encoded unit vectors
+	template <VertexElementType From, VertexElementType To>
+	void ConvertVertexElement(const uint8_t* from, uint8_t* to, const QuantizationInfo& info)
+	{
+		if constexpr (From == To)
+			memcpy(to, from, VertexElementSize(From));
+		else if constexpr (From == VertexElementType::Float3 && To == VertexElementType::UNorm16x4)
+		{
+			const XMFLOAT3& pos = *(const XMFLOAT3*)from;
+			XMUSHORTN4& packed = *(XMUSHORTN4*)to;
+			packed.x = QuantizeUnorm16((pos.x - info.positionOffset.x) / info.positionScale.x);
+			packed.y = QuantizeUnorm16((pos.y - info.positionOffset.y) / info.positionScale.y);
+			packed.z = QuantizeUnorm16((pos.z - info.positionOffset.z) / info.positionScale.z);
+			packed.w = 0;
+		}
+		else if constexpr (From == VertexElementType::UNorm16x4 && To == VertexElementType::Float3)
+		{
+			const XMUSHORTN4& packed = *(const XMUSHORTN4*)from;
+			XMFLOAT3& pos = *(XMFLOAT3*)to;
+			pos.x = info.positionOffset.x + packed.x / 65535.0f * info.positionScale.x;
+			pos.y = info.positionOffset.y + packed.y / 65535.0f * info.positionScale.y;
+			pos.z = info.positionOffset.z + packed.z / 65535.0f * info.positionScale.z;
+		}
+		else if constexpr (From == VertexElementType::Float3 && To == VertexElementType::SNorm16x2)
+		{
+			XMFLOAT2 oct = OctEncode(*(const XMFLOAT3*)from);
+			XMSHORTN2& packed = *(XMSHORTN2*)to;
+			packed.x = QuantizeSnorm16(oct.x);
+			packed.y = QuantizeSnorm16(oct.y);
+		}
+		else if constexpr (From == VertexElementType::SNorm16x2 && To == VertexElementType::Float3)
+		{
+			// snorm maps both -32768 and -32767 to -1
+			const XMSHORTN2& packed = *(const XMSHORTN2*)from;
+			*(XMFLOAT3*)to = OctDecode(XMFLOAT2(max(packed.x / 32767.0f, -1.0f), max(packed.y / 32767.0f, -1.0f)));
+		}
+		else if constexpr (From == VertexElementType::Float2 && To == VertexElementType::Half2)
+		{
+			const XMFLOAT2& tex = *(const XMFLOAT2*)from;
+			XMHALF2& packed = *(XMHALF2*)to;
+			packed.x = XMConvertFloatToHalf(tex.x);
+			packed.y = XMConvertFloatToHalf(tex.y);
+		}
+		else if constexpr (From == VertexElementType::Half2 && To == VertexElementType::Float2)
+		{
+			const XMHALF2& packed = *(const XMHALF2*)from;
+			XMFLOAT2& tex = *(XMFLOAT2*)to;
+			tex.x = XMConvertHalfToFloat(packed.x);
+			tex.y = XMConvertHalfToFloat(packed.y);
+		}
+		else
+			static_assert(From == To, "no conversion between these vertex element types");
+	}
+
+	// Packing kernel generated from the two VertexFormats: each element of
+	// To is converted from the element of From with the same semantic, and
+	// zeroed when From doesn't have it. Everything is resolved at compile time
+	template <typename To, typename From>
+	To ConvertVertex(const From& vert, const QuantizationInfo& info = QuantizationInfo())
+	{
+		To result;
+		ForEachVertexElement<To>([&](auto i)
+		{
+			constexpr VertexElement element = VertexFormat<To>::elements[decltype(i)::value];
+			constexpr int source = FindVertexElement<From>(element.semantic, element.semanticIndex);
+			uint8_t* to = (uint8_t*)&result + element.offset;
+			if constexpr (source < 0)
+				memset(to, 0, VertexElementSize(element.type));
+			else
+			{
+				constexpr VertexElement fromElement = VertexFormat<From>::elements[source];
+				ConvertVertexElement<fromElement.type, element.type>((const uint8_t*)&vert + fromElement.offset, to, info);
+			}
+		});
+		return result;
+	}
+
+	PackedVertex QuantizeVertex(const SimpleVertex& vert, const QuantizationInfo& info)
+	{
+		return ConvertVertex<PackedVertex>(vert, info);
+	}
+
+	SimpleVertex DequantizeVertex(const PackedVertex& packed, const QuantizationInfo& info)
+	{
+		return ConvertVertex<SimpleVertex>(packed, info);
+	}
+
+	// Quantize a whole mesh against its bounds and report the round trip error.
+	// Normals must be unit length, the octahedral encoding keeps only direction
+	QuantizationError QuantizeMesh(const SimpleMesh<SimpleVertex>& simpleMesh, SimpleMesh<PackedVertex>& packedMesh, QuantizationInfo& info)
+	{
+		QuantizationError error;
+		packedMesh.indicesList = simpleMesh.indicesList;
+		packedMesh.lods = simpleMesh.lods;
+		packedMesh.viewOrders = simpleMesh.viewOrders;
+		packedMesh.bounds = simpleMesh.bounds;
+		packedMesh.submeshes = simpleMesh.submeshes;
+		packedMesh.materials = simpleMesh.materials;
+		packedMesh.vertexList.resize(simpleMesh.vertexList.size());
+		if (simpleMesh.vertexList.empty())
+			return error;
+
+		XMFLOAT3 minPos = simpleMesh.vertexList[0].Pos, maxPos = simpleMesh.vertexList[0].Pos;
+		for (const SimpleVertex& vert : simpleMesh.vertexList)
+		{
+			minPos = XMFLOAT3(min(minPos.x, vert.Pos.x), min(minPos.y, vert.Pos.y), min(minPos.z, vert.Pos.z));
+			maxPos = XMFLOAT3(max(maxPos.x, vert.Pos.x), max(maxPos.y, vert.Pos.y), max(maxPos.z, vert.Pos.z));
+		}
+
+		// flat axes keep a scale of 1 so the divide stays finite
+		info.positionOffset = minPos;
+		info.positionScale = XMFLOAT3(
+			maxPos.x > minPos.x ? maxPos.x - minPos.x : 1.0f,
+			maxPos.y > minPos.y ? maxPos.y - minPos.y : 1.0f,
+			maxPos.z > minPos.z ? maxPos.z - minPos.z : 1.0f);
+
+		for (size_t i = 0; i < simpleMesh.vertexList.size(); i++)
+		{
+			const SimpleVertex& vert = simpleMesh.vertexList[i];
+			packedMesh.vertexList[i] = QuantizeVertex(vert, info);
+			SimpleVertex decoded = DequantizeVertex(packedMesh.vertexList[i], info);
+
+			float dx = decoded.Pos.x - vert.Pos.x, dy = decoded.Pos.y - vert.Pos.y, dz = decoded.Pos.z - vert.Pos.z;
+			error.maxPositionError = max(error.maxPositionError, sqrtf(dx * dx + dy * dy + dz * dz));
+
+			float length = sqrtf(vert.Normal.x * vert.Normal.x + vert.Normal.y * vert.Normal.y + vert.Normal.z * vert.Normal.z);
+			if (length > 0.0f)
+			{
+				float cosAngle = (vert.Normal.x * decoded.Normal.x + vert.Normal.y * decoded.Normal.y + vert.Normal.z * decoded.Normal.z) / length;
+				float degrees = acosf(min(max(cosAngle, -1.0f), 1.0f)) * 180.0f / XM_PI;
+				error.maxNormalErrorDegrees = max(error.maxNormalErrorDegrees, degrees);
+			}
+
+			error.maxTexError = max(error.maxTexError, max(fabsf(decoded.Tex.x - vert.Tex.x), fabsf(decoded.Tex.y - vert.Tex.y)));
+		}
+
+		cout << "quantized " << simpleMesh.vertexList.size() << " vertices, "
+			<< sizeof(SimpleVertex) * simpleMesh.vertexList.size() << " -> "
+			<< sizeof(PackedVertex) * packedMesh.vertexList.size() << " bytes" << endl;
+		cout << "  max position error: " << error.maxPositionError << endl;
+		cout << "  max normal error: " << error.maxNormalErrorDegrees << " degrees" << endl;
+		cout << "  max texcoord error: " << error.maxTexError << endl;
+		return error;
+	}
+
+	// Symmetric 4x4 error quadric (Garland and Heckbert), stored as
+	// xx xy xz xw yy yz yw zz zw ww, plus the total weight of its planes
+	struct Quadric
+	{
+		double a[10] = {};
+		double weight = 0.0;
+	};
+
+	// add weight * squared distance to the plane n.p + d = 0
+	void QuadricAddPlane(Quadric& q, double nx, double ny, double nz, double d, double weight)
+	{
+		q.a[0] += weight * nx * nx; q.a[1] += weight * nx * ny; q.a[2] += weight * nx * nz; q.a[3] += weight * nx * d;
+		q.a[4] += weight * ny * ny; q.a[5] += weight * ny * nz; q.a[6] += weight * ny * d;
+		q.a[7] += weight * nz * nz; q.a[8] += weight * nz * d;
+		q.a[9] += weight * d * d;
+		q.weight += weight;
+	}
+
+	void QuadricAdd(Quadric& q, const Quadric& other)
+	{
+		for (int i = 0; i < 10; i++)
+			q.a[i] += other.a[i];
+		q.weight += other.weight;
+	}
+
+	// weighted mean squared distance of p to the planes in q
+	double QuadricError(const Quadric& q, const XMFLOAT3& p)
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double error = q.a[0] * x * x + 2 * q.a[1] * x * y + 2 * q.a[2] * x * z + 2 * q.a[3] * x +
+			q.a[4] * y * y + 2 * q.a[5] * y * z + 2 * q.a[6] * y +
+			q.a[7] * z * z + 2 * q.a[8] * z + q.a[9];
+		return error > 0.0 && q.weight > 0.0 ? error / q.weight : 0.0;
+	}
+
+	XMFLOAT3 TriangleNormal(const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2)
+	{
+		XMFLOAT3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+		XMFLOAT3 e2(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+		return XMFLOAT3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+	}
+
+	// How a vertex may move during simplification
+	// Manifold: interior vertex, can collapse onto any neighbour
+	// Border: on an open edge, can only slide along the border
+	// Seam: one of two vertices sharing a position along a UV/normal seam,
+	//       collapses together with its partner along the seam
+	// Locked: anything else (corners, non-manifold), never moves
+	enum VertexKind { VertexManifold, VertexBorder, VertexSeam, VertexLocked };
+
+	// Simplify a triangle list towards targetIndexCount with quadric error
+	// metrics and half edge collapses. Vertices only ever collapse onto other
+	// existing vertices, so the result indexes the same vertex buffer.
+	// targetError is relative to the mesh extent; the relative error reached
+	// is returned in resultError. UV/normal seams and borders are preserved
+	// by the vertex classification above plus extra border quadrics
+	void SimplifyMesh(vector<int>& result, const int* indices, size_t indexCount,
+		const vector<SimpleVertex>& vertexList, size_t targetIndexCount, float targetError, float* resultError = nullptr)
+	{
+		size_t vertexCount = vertexList.size();
+		result.assign(indices, indices + indexCount);
+		if (resultError)
+			*resultError = 0.0f;
+		if (vertexCount == 0 || indexCount <= targetIndexCount)
+			return;
+
+		// work in positions scaled to the unit cube so errors are relative
+		XMFLOAT3 minPos = vertexList[0].Pos, maxPos = vertexList[0].Pos;
+		for (const SimpleVertex& vert : vertexList)
+		{
+			minPos = XMFLOAT3(min(minPos.x, vert.Pos.x), min(minPos.y, vert.Pos.y), min(minPos.z, vert.Pos.z));
+			maxPos = XMFLOAT3(max(maxPos.x, vert.Pos.x), max(maxPos.y, vert.Pos.y), max(maxPos.z, vert.Pos.z));
+		}
+		float extent = max(max(maxPos.x - minPos.x, maxPos.y - minPos.y), maxPos.z - minPos.z);
+		float invExtent = extent > 0.0f ? 1.0f / extent : 1.0f;
+		vector<XMFLOAT3> positions(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			const XMFLOAT3& pos = vertexList[v].Pos;
+			positions[v] = XMFLOAT3((pos.x - minPos.x) * invExtent, (pos.y - minPos.y) * invExtent, (pos.z - minPos.z) * invExtent);
+		}
+
+		// group vertices that share a position; wedge[] links each group
+		// into a circular list and positionRemap[] points at its first vertex
+		vector<int> positionRemap(vertexCount), wedge(vertexCount);
+		{
+			size_t tableSize = 16;
+			while (tableSize < vertexCount * 2)
+				tableSize <<= 1;
+			size_t mask = tableSize - 1;
+			vector<int> table(tableSize, -1);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				const XMFLOAT3& pos = vertexList[v].Pos;
+				SimpleVertex key = {};
+				key.Pos = pos;
+				size_t slot = HashVertex(key) & mask;
+				while (table[slot] != -1)
+				{
+					const XMFLOAT3& other = vertexList[table[slot]].Pos;
+					if (other.x == pos.x && other.y == pos.y && other.z == pos.z)
+						break;
+					slot = (slot + 1) & mask;
+				}
+
+				if (table[slot] == -1)
+				{
+					table[slot] = (int)v;
+					positionRemap[v] = (int)v;
+					wedge[v] = (int)v;
+				}
+				else
+				{
+					int first = table[slot];
+					positionRemap[v] = first;
+					wedge[v] = wedge[first];
+					wedge[first] = (int)v;
+				}
+			}
+		}
+
+		// outgoing edges per vertex, used to find open (unpaired) edges
+		vector<int> edgeOffsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < indexCount; i++)
+			edgeOffsets[indices[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			edgeOffsets[v + 1] += edgeOffsets[v];
+		vector<int> edgeTargets(indexCount);
+		{
+			vector<int> fill(edgeOffsets.begin(), edgeOffsets.end() - 1);
+			for (size_t i = 0; i < indexCount; i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+					edgeTargets[fill[indices[i + k]]++] = indices[i + (k + 1) % 3];
+			}
+		}
+		auto hasEdge = [&](int a, int b)
+		{
+			for (int e = edgeOffsets[a]; e < edgeOffsets[a + 1]; e++)
+			{
+				if (edgeTargets[e] == b)
+					return true;
+			}
+			return false;
+		};
+		// same test on positions, so seams (open in vertex space) are told
+		// apart from real borders (open in position space too)
+		auto hasPositionEdge = [&](int a, int b)
+		{
+			int pb = positionRemap[b];
+			int v = a;
+			do
+			{
+				for (int e = edgeOffsets[v]; e < edgeOffsets[v + 1]; e++)
+				{
+					if (positionRemap[edgeTargets[e]] == pb)
+						return true;
+				}
+				v = wedge[v];
+			} while (v != a);
+			return false;
+		};
+
+		vector<int> openOut(vertexCount, 0), openIn(vertexCount, 0);
+		vector<int> openNext(vertexCount, -1), openPrev(vertexCount, -1);
+		for (size_t a = 0; a < vertexCount; a++)
+		{
+			for (int e = edgeOffsets[a]; e < edgeOffsets[a + 1]; e++)
+			{
+				int b = edgeTargets[e];
+				if (!hasEdge(b, (int)a))
+				{
+					openOut[a]++;
+					openNext[a] = b;
+					openIn[b]++;
+					openPrev[b] = (int)a;
+				}
+			}
+		}
+
+		vector<VertexKind> kinds(vertexCount, VertexLocked);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			int partner = wedge[v];
+			bool oneOpenChain = openOut[v] == 1 && openIn[v] == 1;
+			if (partner == (int)v)
+			{
+				if (openOut[v] == 0 && openIn[v] == 0)
+					kinds[v] = VertexManifold;
+				else if (oneOpenChain)
+					kinds[v] = VertexBorder;
+			}
+			else if (wedge[partner] == (int)v && oneOpenChain && openOut[partner] == 1 && openIn[partner] == 1)
+			{
+				// both sides of the seam must run along the same positions
+				if (positionRemap[openNext[v]] == positionRemap[openPrev[partner]] &&
+					positionRemap[openPrev[v]] == positionRemap[openNext[partner]] &&
+					hasPositionEdge(openNext[partner], partner))
+					kinds[v] = VertexSeam;
+			}
+		}
+
+		// quadrics live on the first vertex of each position group
+		vector<Quadric> quadrics(vertexCount);
+		const double borderWeight = 10.0;
+		for (size_t i = 0; i < indexCount; i += 3)
+		{
+			int tri[3] = { indices[i], indices[i + 1], indices[i + 2] };
+			XMFLOAT3 n = TriangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+			double length = sqrt((double)n.x * n.x + (double)n.y * n.y + (double)n.z * n.z);
+			if (length == 0.0)
+				continue;
+			double nx = n.x / length, ny = n.y / length, nz = n.z / length;
+			double d = -(nx * positions[tri[0]].x + ny * positions[tri[0]].y + nz * positions[tri[0]].z);
+			for (int k = 0; k < 3; k++)
+				QuadricAddPlane(quadrics[positionRemap[tri[k]]], nx, ny, nz, d, length * 0.5);
+
+			// open edges also get a plane perpendicular to the triangle so
+			// the outline of borders and seams is kept
+			for (int k = 0; k < 3; k++)
+			{
+				int a = tri[k], b = tri[(k + 1) % 3];
+				if (hasEdge(b, a))
+					continue;
+				double ex = positions[b].x - positions[a].x, ey = positions[b].y - positions[a].y, ez = positions[b].z - positions[a].z;
+				double edgeLength = sqrt(ex * ex + ey * ey + ez * ez);
+				double px = ey * nz - ez * ny, py = ez * nx - ex * nz, pz = ex * ny - ey * nx;
+				double pLength = sqrt(px * px + py * py + pz * pz);
+				if (pLength == 0.0)
+					continue;
+				px /= pLength; py /= pLength; pz /= pLength;
+				double pd = -(px * positions[a].x + py * positions[a].y + pz * positions[a].z);
+				QuadricAddPlane(quadrics[positionRemap[a]], px, py, pz, pd, edgeLength * edgeLength * borderWeight);
+				QuadricAddPlane(quadrics[positionRemap[b]], px, py, pz, pd, edgeLength * edgeLength * borderWeight);
+			}
+		}
+
+		struct Collapse
+		{
+			int from;
+			int to;
+			double error;
+		};
+
+		double limit = (double)targetError * targetError;
+		double maxError = 0.0;
+		vector<int> remap(vertexCount);
+		vector<char> locked(vertexCount);
+		vector<int> triangleOffsets(vertexCount + 1);
+		vector<int> triangles;
+
+		for (int pass = 0; pass < 100 && result.size() > targetIndexCount; pass++)
+		{
+			size_t resultCount = result.size();
+
+			// vertex -> triangle adjacency of the current result
+			fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (size_t i = 0; i < resultCount; i++)
+				triangleOffsets[result[i] + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			triangles.resize(resultCount);
+			{
+				vector<int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (size_t i = 0; i < resultCount; i++)
+					triangles[fill[result[i]]++] = (int)(i / 3);
+			}
+
+			// the seam partner of from collapses onto the vertex at to's
+			// position that it shares an edge with
+			auto seamPartnerTarget = [&](int from, int to)
+			{
+				int partner = wedge[from];
+				int v = to;
+				do
+				{
+					if (v != to || wedge[to] == to)
+					{
+						if (openNext[partner] == v || openPrev[partner] == v)
+							return v;
+					}
+					v = wedge[v];
+				} while (v != to);
+				return -1;
+			};
+
+			auto canCollapse = [&](int from, int to)
+			{
+				if (positionRemap[from] == positionRemap[to])
+					return false;
+				switch (kinds[from])
+				{
+				case VertexManifold:
+					return true;
+				case VertexBorder:
+					return (openNext[from] == to || openPrev[from] == to) && kinds[to] != VertexManifold;
+				case VertexSeam:
+					return (openNext[from] == to || openPrev[from] == to) &&
+						(kinds[to] == VertexSeam || kinds[to] == VertexLocked) && seamPartnerTarget(from, to) >= 0;
+				default:
+					return false;
+				}
+			};
+
+			vector<Collapse> collapses;
+			for (size_t i = 0; i < resultCount; i += 3)
+			{
+				for (int k = 0; k < 6; k++)
+				{
+					// both directions, since border edges only appear once
+					int from = result[i + k % 3], to = result[i + (k + (k < 3 ? 1 : 2)) % 3];
+					if (!canCollapse(from, to))
+						continue;
+					double error = QuadricError(quadrics[positionRemap[from]], positions[to]);
+					collapses.push_back({ from, to, error });
+				}
+			}
+			sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+			// moving from onto to must not flip any surviving triangle
+			auto flips = [&](int from, int to)
+			{
+				for (int t = triangleOffsets[from]; t < triangleOffsets[from + 1]; t++)
+				{
+					const int* tri = &result[triangles[t] * 3];
+					if (tri[0] == to || tri[1] == to || tri[2] == to)
+						continue;
+					XMFLOAT3 p[3], q[3];
+					for (int k = 0; k < 3; k++)
+					{
+						p[k] = positions[tri[k]];
+						q[k] = tri[k] == from ? positions[to] : p[k];
+					}
+					XMFLOAT3 before = TriangleNormal(p[0], p[1], p[2]);
+					XMFLOAT3 after = TriangleNormal(q[0], q[1], q[2]);
+					if (before.x * after.x + before.y * after.y + before.z * after.z <= 0.0f)
+						return true;
+				}
+				return false;
+			};
+
+			auto lockRing = [&](int v)
+			{
+				for (int t = triangleOffsets[v]; t < triangleOffsets[v + 1]; t++)
+				{
+					const int* tri = &result[triangles[t] * 3];
+					locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = 1;
+				}
+				locked[v] = 1;
+			};
+
+			for (size_t v = 0; v < vertexCount; v++)
+				remap[v] = (int)v;
+			fill(locked.begin(), locked.end(), 0);
+
+			size_t triangleGoal = (resultCount - targetIndexCount) / 3;
+			size_t trianglesRemoved = 0;
+			int collapseCount = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapse.error > limit || trianglesRemoved >= triangleGoal)
+					break;
+
+				int from = collapse.from, to = collapse.to;
+				int partnerFrom = -1, partnerTo = -1;
+				if (kinds[from] == VertexSeam)
+				{
+					partnerFrom = wedge[from];
+					partnerTo = seamPartnerTarget(from, to);
+				}
+
+				if (locked[from] || locked[to] || (partnerFrom >= 0 && (locked[partnerFrom] || locked[partnerTo])))
+					continue;
+				if (flips(from, to) || (partnerFrom >= 0 && flips(partnerFrom, partnerTo)))
+					continue;
+
+				lockRing(from);
+				locked[to] = 1;
+				remap[from] = to;
+				if (partnerFrom >= 0)
+				{
+					lockRing(partnerFrom);
+					locked[partnerTo] = 1;
+					remap[partnerFrom] = partnerTo;
+				}
+				QuadricAdd(quadrics[positionRemap[to]], quadrics[positionRemap[from]]);
+
+				// keep the open edge chains walkable past the removed vertex
+				int chain[2][2] = { { from, to }, { partnerFrom, partnerTo } };
+				for (auto& pair : chain)
+				{
+					int f = pair[0], t = pair[1];
+					if (f < 0 || kinds[f] == VertexManifold)
+						continue;
+					if (openNext[f] == t)
+					{
+						openPrev[t] = openPrev[f];
+						if (openPrev[f] >= 0)
+							openNext[openPrev[f]] = t;
+					}
+					else
+					{
+						openNext[t] = openNext[f];
+						if (openNext[f] >= 0)
+							openPrev[openNext[f]] = t;
+					}
+				}
+
+				trianglesRemoved += kinds[from] == VertexBorder ? 1 : 2;
+				maxError = max(maxError, collapse.error);
+				collapseCount++;
+			}
+
+			if (collapseCount == 0)
+				break;
+
+			// apply the collapses and drop the triangles that became degenerate
+			size_t writeIndex = 0;
+			for (size_t i = 0; i < resultCount; i += 3)
+			{
+				int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+				if (a == b || b == c || c == a)
+					continue;
+				result[writeIndex++] = a;
+				result[writeIndex++] = b;
+				result[writeIndex++] = c;
+			}
+			result.resize(writeIndex);
+		}
+
+		if (resultError)
+			*resultError = (float)sqrt(maxError);
+	}
+
+	// Submesh owning each vertex, empty for meshes with at most one submesh
+	template <typename T>
+	vector<int> VertexSubmeshes(const SimpleMesh<T>& simpleMesh)
+	{
+		vector<int> vertexSubmesh;
+		if (simpleMesh.submeshes.size() <= 1)
+			return vertexSubmesh;
+		vertexSubmesh.assign(simpleMesh.vertexList.size(), 0);
+		for (size_t s = 0; s < simpleMesh.submeshes.size(); s++)
+		{
+			const MeshSubmesh& submesh = simpleMesh.submeshes[s];
+			fill(vertexSubmesh.begin() + submesh.baseVertex, vertexSubmesh.begin() + submesh.baseVertex + submesh.vertexCount, (int)s);
+		}
+		return vertexSubmesh;
+	}
+
+	// Append simplified levels of detail to the mesh, one per ratio of the full
+	// triangle count (e.g. 0.5, 0.25, 0.125). All levels index the same vertex
+	// list; mesh.lods describes the index range and error of each level.
+	// Collapses never join separate parts, and each level keeps the
+	// triangles of a submesh together so it draws with one range per part.
+	// Run this after the other passes, since they treat indicesList as one mesh
+	void GenerateLODChain(SimpleMesh<SimpleVertex>& simpleMesh, const vector<float>& ratios, float targetError = 0.1f)
+	{
+		int fullCount = simpleMesh.lods.empty() ? (int)simpleMesh.indicesList.size() : simpleMesh.lods[0].indexCount;
+		simpleMesh.indicesList.resize(fullCount);
+		simpleMesh.lods.clear();
+		simpleMesh.viewOrders.clear();
+		simpleMesh.lods.push_back({ 0, fullCount, 0.0f });
+
+		XMFLOAT3 minPos(0.0f, 0.0f, 0.0f), maxPos(0.0f, 0.0f, 0.0f);
+		if (!simpleMesh.vertexList.empty())
+			minPos = maxPos = simpleMesh.vertexList[0].Pos;
+		for (const SimpleVertex& vert : simpleMesh.vertexList)
+		{
+			minPos = XMFLOAT3(min(minPos.x, vert.Pos.x), min(minPos.y, vert.Pos.y), min(minPos.z, vert.Pos.z));
+			maxPos = XMFLOAT3(max(maxPos.x, vert.Pos.x), max(maxPos.y, vert.Pos.y), max(maxPos.z, vert.Pos.z));
+		}
+		float extent = max(max(maxPos.x - minPos.x, maxPos.y - minPos.y), maxPos.z - minPos.z);
+
+		vector<int> full(simpleMesh.indicesList.begin(), simpleMesh.indicesList.end());
+		vector<int> vertexSubmesh = VertexSubmeshes(simpleMesh);
+		cout << "LOD 0: " << fullCount / 3 << " triangles" << endl;
+		for (float ratio : ratios)
+		{
+			vector<int> lod;
+			float error = 0.0f;
+			size_t target = (size_t)(fullCount / 3 * ratio) * 3;
+			SimplifyMesh(lod, full.data(), full.size(), simpleMesh.vertexList, target, targetError, &error);
+			OptimizeVertexCache(lod.data(), lod.size(), simpleMesh.vertexList.size());
+
+			// group the triangles by submesh, keeping the cache order within each
+			if (!vertexSubmesh.empty())
+			{
+				vector<int> grouped;
+				grouped.reserve(lod.size());
+				for (size_t s = 0; s < simpleMesh.submeshes.size(); s++)
+				{
+					for (size_t i = 0; i < lod.size(); i += 3)
+					{
+						if (vertexSubmesh[lod[i]] == (int)s)
+							grouped.insert(grouped.end(), lod.begin() + i, lod.begin() + i + 3);
+					}
+				}
+				lod.swap(grouped);
+			}
+
+			MeshLOD meshLOD;
+			meshLOD.indexStart = (int)simpleMesh.indicesList.size();
+			meshLOD.indexCount = (int)lod.size();
+			meshLOD.error = error * extent;
+			simpleMesh.lods.push_back(meshLOD);
+			simpleMesh.indicesList.insert(simpleMesh.indicesList.end(), lod.begin(), lod.end());
+
+			cout << "LOD " << simpleMesh.lods.size() - 1 << ": " << lod.size() / 3 << " triangles ("
+				<< ratio * 100.0f << "% requested), error " << meshLOD.error
+				<< " (" << error * 100.0f << "% of extent)" << endl;
+		}
+	}
+
+	// Directions of the view order buckets: the 8 cube corners for
+	// bucketCount 8, otherwise the 26 corners, edges and faces of the cube
+	vector<XMFLOAT3> ViewOrderDirections(int bucketCount)
+	{
+		vector<XMFLOAT3> directions;
+		for (int x = -1; x <= 1; x++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				for (int z = -1; z <= 1; z++)
+				{
+					int axes = (x != 0) + (y != 0) + (z != 0);
+					if (axes == 0 || (bucketCount == 8 && axes != 3))
+						continue;
+					XMFLOAT3 direction;
+					XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSet((float)x, (float)y, (float)z, 0.0f)));
+					directions.push_back(direction);
+				}
+			}
+		}
+		return directions;
+	}
+
+	// Append the full detail triangles sorted back to front once per view
+	// direction bucket (8 or 26), so blended meshes can be drawn in a nearly
+	// correct order by picking the bucket closest to the view direction
+	// instead of sorting every frame. Triangles are sorted by their centroid
+	// along the direction, which is exact for an orthographic view. Meshes
+	// with several submeshes sort whole parts by their centroid first, so
+	// each part stays one range with its own material.
+	// Run this last, the LOD chain truncates indicesList
+	void GenerateViewOrders(SimpleMesh<SimpleVertex>& simpleMesh, int bucketCount = 26)
+	{
+		auto start = chrono::high_resolution_clock::now();
+
+		// orders go after the full detail indices and the LODs
+		int fullCount = simpleMesh.lods.empty() ? (int)simpleMesh.indicesList.size() : simpleMesh.lods[0].indexCount;
+		int end = fullCount;
+		for (const MeshLOD& lod : simpleMesh.lods)
+			end = max(end, lod.indexStart + lod.indexCount);
+		simpleMesh.indicesList.resize(end);
+		simpleMesh.viewOrders.clear();
+		// a single full detail level, so the usual lods[0] lookups skip the orders
+		if (simpleMesh.lods.empty())
+			simpleMesh.lods.push_back({ 0, fullCount, 0.0f });
+
+		vector<int> full(simpleMesh.indicesList.begin(), simpleMesh.indicesList.begin() + fullCount);
+		size_t triangleCount = fullCount / 3;
+		vector<XMFLOAT3> centroids(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const int* tri = &full[t * 3];
+			XMVECTOR sum = XMVectorAdd(XMVectorAdd(XMLoadFloat3(&simpleMesh.vertexList[tri[0]].Pos),
+				XMLoadFloat3(&simpleMesh.vertexList[tri[1]].Pos)), XMLoadFloat3(&simpleMesh.vertexList[tri[2]].Pos));
+			XMStoreFloat3(&centroids[t], XMVectorScale(sum, 1.0f / 3.0f));
+		}
+
+		// part of each triangle and centroid of each part, one part for
+		// single part meshes
+		vector<int> vertexSubmesh = VertexSubmeshes(simpleMesh);
+		size_t partCount = max<size_t>(simpleMesh.submeshes.size(), 1);
+		vector<int> triangleParts(triangleCount, 0);
+		vector<XMFLOAT3> partCentroids(partCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+		vector<int> partTriangles(partCount, 0);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int part = vertexSubmesh.empty() ? 0 : vertexSubmesh[full[t * 3]];
+			triangleParts[t] = part;
+			partCentroids[part].x += centroids[t].x;
+			partCentroids[part].y += centroids[t].y;
+			partCentroids[part].z += centroids[t].z;
+			partTriangles[part]++;
+		}
+		for (size_t p = 0; p < partCount; p++)
+		{
+			float scale = partTriangles[p] > 0 ? 1.0f / partTriangles[p] : 0.0f;
+			partCentroids[p] = XMFLOAT3(partCentroids[p].x * scale, partCentroids[p].y * scale, partCentroids[p].z * scale);
+		}
+
+		vector<float> depth(triangleCount);
+		vector<float> partDepth(partCount);
+		vector<int> order(triangleCount);
+		for (XMFLOAT3 direction : ViewOrderDirections(bucketCount))
+		{
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				depth[t] = centroids[t].x * direction.x + centroids[t].y * direction.y + centroids[t].z * direction.z;
+				order[t] = (int)t;
+			}
+			for (size_t p = 0; p < partCount; p++)
+				partDepth[p] = partCentroids[p].x * direction.x + partCentroids[p].y * direction.y + partCentroids[p].z * direction.z;
+			// furthest along the view direction first, ties keep the cache order
+			stable_sort(order.begin(), order.end(), [&](int a, int b)
+			{
+				int partA = triangleParts[a], partB = triangleParts[b];
+				if (partA != partB)
+					return partDepth[partA] != partDepth[partB] ? partDepth[partA] > partDepth[partB] : partA < partB;
+				return depth[a] > depth[b];
+			});
+
+			ViewOrder viewOrder;
+			viewOrder.indexStart = (int)simpleMesh.indicesList.size();
+			viewOrder.indexCount = fullCount;
+			viewOrder.direction = direction;
+			simpleMesh.viewOrders.push_back(viewOrder);
+			for (int t : order)
+			{
+				simpleMesh.indicesList.insert(simpleMesh.indicesList.end(), full.begin() + t * 3, full.begin() + t * 3 + 3);
+			}
+		}
+
+		cout << "View orders: " << simpleMesh.viewOrders.size() << " sorted copies of " << triangleCount << " triangles, "
+			<< simpleMesh.viewOrders.size() * fullCount * sizeof(uint16_t) / 1024.0f << " KB of 16-bit indices, "
+			<< ElapsedMs(start) << " ms" << endl;
+	}
+
+	// A cluster of at most maxMeshletVertices vertices and maxMeshletTriangles
+	// triangles with the bounds needed to cull it on the CPU
+	struct Meshlet
+	{
+		// ranges in MeshletData::vertices and MeshletData::triangles
+		int vertexOffset = 0;
+		int vertexCount = 0;
+		int triangleOffset = 0;
+		int triangleCount = 0;
+
+		// bounding sphere in mesh space
+		XMFLOAT3 center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float radius = 0.0f;
+		// normal cone: all triangle normals are within acos of the cone axis
+		// by less than 90 - asin(coneCutoff) degrees; coneCutoff of 1 never culls
+		XMFLOAT3 coneAxis = XMFLOAT3(0.0f, 0.0f, 1.0f);
+		float coneCutoff = 1.0f;
+	};
+
+	const int maxMeshletVertices = 64;
+	const int maxMeshletTriangles = 124;
+
+	// vertices holds mesh vertex indices for each meshlet, triangles holds
+	// 3 local (per meshlet) vertex indices per triangle
+	struct MeshletData
+	{
+		vector<Meshlet> meshlets;
+		vector<int> vertices;
+		vector<uint8_t> triangles;
+	};
+
+	// Bounding sphere (centered on the vertex AABB, then grown to fit) and
+	// normal cone of one meshlet
+	void ComputeMeshletBounds(Meshlet& meshlet, const MeshletData& data, const vector<SimpleVertex>& vertexList)
+	{
+		const int* vertices = &data.vertices[meshlet.vertexOffset];
+		const uint8_t* triangles = &data.triangles[meshlet.triangleOffset * 3];
+
+		XMFLOAT3 minPos = vertexList[vertices[0]].Pos, maxPos = minPos;
+		for (int i = 1; i < meshlet.vertexCount; i++)
+		{
+			const XMFLOAT3& pos = vertexList[vertices[i]].Pos;
+			minPos = XMFLOAT3(min(minPos.x, pos.x), min(minPos.y, pos.y), min(minPos.z, pos.z));
+			maxPos = XMFLOAT3(max(maxPos.x, pos.x), max(maxPos.y, pos.y), max(maxPos.z, pos.z));
+		}
+		XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&minPos), XMLoadFloat3(&maxPos)), 0.5f);
+		float radius = 0.0f;
+		for (int i = 0; i < meshlet.vertexCount; i++)
+		{
+			XMVECTOR pos = XMLoadFloat3(&vertexList[vertices[i]].Pos);
+			radius = max(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(pos, center))));
+		}
+		XMStoreFloat3(&meshlet.center, center);
+		meshlet.radius = radius;
+
+		// the cone axis is the average of the unit triangle normals
+		vector<XMFLOAT3> normals;
+		normals.reserve(meshlet.triangleCount);
+		XMVECTOR axis = XMVectorZero();
+		for (int t = 0; t < meshlet.triangleCount; t++)
+		{
+			XMFLOAT3 n = TriangleNormal(vertexList[vertices[triangles[t * 3 + 0]]].Pos,
+				vertexList[vertices[triangles[t * 3 + 1]]].Pos, vertexList[vertices[triangles[t * 3 + 2]]].Pos);
+			XMVECTOR normal = XMLoadFloat3(&n);
+			if (XMVectorGetX(XMVector3LengthSq(normal)) == 0.0f)
+				continue;
+			normal = XMVector3Normalize(normal);
+			XMStoreFloat3(&n, normal);
+			normals.push_back(n);
+			axis = XMVectorAdd(axis, normal);
+		}
+
+		meshlet.coneAxis = XMFLOAT3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		if (normals.empty() || XMVectorGetX(XMVector3LengthSq(axis)) == 0.0f)
+			return;
+		axis = XMVector3Normalize(axis);
+		XMStoreFloat3(&meshlet.coneAxis, axis);
+
+		float minDot = 1.0f;
+		for (const XMFLOAT3& n : normals)
+			minDot = min(minDot, XMVectorGetX(XMVector3Dot(XMLoadFloat3(&n), axis)));
+
+		// a cone wider than a hemisphere can always be seen from somewhere
+		if (minDot <= 0.0f)
+			return;
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+
+	// Split a triangle list into meshlets. Each meshlet grows from a seed
+	// triangle by adding the neighbouring triangle that adds the fewest new
+	// vertices (ties go to the triangle closest to the meshlet center), so
+	// clusters stay compact and their normal cones stay narrow.
+	// Local vertex numbers are bytes with 0xff marking a vertex outside the
+	// meshlet, so maxVertices is clamped to 255
+	void BuildMeshlets(MeshletData& data, const int* indices, size_t indexCount, const vector<SimpleVertex>& vertexList,
+		int maxVertices = maxMeshletVertices, int maxTriangles = maxMeshletTriangles)
+	{
+		maxVertices = min(maxVertices, 255);
+		size_t vertexCount = vertexList.size();
+		size_t triangleCount = indexCount / 3;
+
+		data.meshlets.clear();
+		data.vertices.clear();
+		data.triangles.clear();
+		data.vertices.reserve(indexCount);
+		data.triangles.reserve(indexCount);
+
+		// vertex -> triangle adjacency
+		vector<int> offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < indexCount; i++)
+			offsets[indices[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		vector<int> adjacency(indexCount);
+		{
+			vector<int> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indexCount; i++)
+				adjacency[fill[indices[i]]++] = (int)(i / 3);
+		}
+
+		vector<char> emitted(triangleCount, 0);
+		// local index of each vertex in the current meshlet, 0xff when absent
+		vector<uint8_t> localIndex(vertexCount, 0xff);
+		size_t seed = 0;
+
+		while (true)
+		{
+			while (seed < triangleCount && emitted[seed])
+				seed++;
+			if (seed == triangleCount)
+				break;
+
+			Meshlet meshlet;
+			meshlet.vertexOffset = (int)data.vertices.size();
+			meshlet.triangleOffset = (int)(data.triangles.size() / 3);
+			XMVECTOR centroidSum = XMVectorZero();
+
+			int next = (int)seed;
+			while (next >= 0)
+			{
+				const int* tri = &indices[next * 3];
+				for (int k = 0; k < 3; k++)
+				{
+					int v = tri[k];
+					if (localIndex[v] == 0xff)
+					{
+						localIndex[v] = (uint8_t)meshlet.vertexCount++;
+						data.vertices.push_back(v);
+						centroidSum = XMVectorAdd(centroidSum, XMLoadFloat3(&vertexList[v].Pos));
+					}
+					data.triangles.push_back(localIndex[v]);
+				}
+				emitted[next] = 1;
+				meshlet.triangleCount++;
+
+				if (meshlet.triangleCount == maxTriangles)
+					break;
+
+				// best unemitted triangle touching the meshlet
+				XMVECTOR centroid = XMVectorScale(centroidSum, 1.0f / meshlet.vertexCount);
+				int bestNewVertices = 4;
+				float bestDistance = FLT_MAX;
+				next = -1;
+				for (int i = meshlet.vertexOffset; i < (int)data.vertices.size(); i++)
+				{
+					int v = data.vertices[i];
+					for (int a = offsets[v]; a < offsets[v + 1]; a++)
+					{
+						int t = adjacency[a];
+						if (emitted[t])
+							continue;
+						const int* candidate = &indices[t * 3];
+						int newVertices = 0;
+						for (int k = 0; k < 3; k++)
+						{
+							bool repeated = (k > 0 && candidate[k] == candidate[0]) || (k > 1 && candidate[k] == candidate[1]);
+							newVertices += localIndex[candidate[k]] == 0xff && !repeated;
+						}
+						if (meshlet.vertexCount + newVertices > maxVertices || newVertices > bestNewVertices)
+							continue;
+
+						XMVECTOR triCenter = XMVectorScale(XMVectorAdd(XMVectorAdd(XMLoadFloat3(&vertexList[candidate[0]].Pos),
+							XMLoadFloat3(&vertexList[candidate[1]].Pos)), XMLoadFloat3(&vertexList[candidate[2]].Pos)), 1.0f / 3.0f);
+						float distance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(triCenter, centroid)));
+						if (newVertices < bestNewVertices || distance < bestDistance)
+						{
+							bestNewVertices = newVertices;
+							bestDistance = distance;
+							next = t;
+						}
+					}
+				}
+			}
+
+			for (int i = meshlet.vertexOffset; i < (int)data.vertices.size(); i++)
+				localIndex[data.vertices[i]] = 0xff;
+
+			ComputeMeshletBounds(meshlet, data, vertexList);
+			data.meshlets.push_back(meshlet);
+		}
+	}
+
+	// Rebuild a triangle list in meshlet order; meshlet m then covers
+	// triangleCount * 3 indices starting at triangleOffset * 3
+	void GetMeshletIndices(const MeshletData& data, vector<int>& indices)
+	{
+		indices.resize(data.triangles.size());
+		for (const Meshlet& meshlet : data.meshlets)
+		{
+			for (int i = 0; i < meshlet.triangleCount * 3; i++)
+			{
+				size_t index = (size_t)meshlet.triangleOffset * 3 + i;
+				indices[index] = data.vertices[meshlet.vertexOffset + data.triangles[index]];
+			}
+		}
+	}
+
+	// Frustum planes (left, right, bottom, top, near, far) of a row vector
+	// view * projection matrix with D3D clip space, pointing inwards
+	void GetFrustumPlanes(CXMMATRIX viewProjection, XMVECTOR planes[6])
+	{
+		XMMATRIX m = XMMatrixTranspose(viewProjection);
+		planes[0] = XMVectorAdd(m.r[3], m.r[0]);
+		planes[1] = XMVectorSubtract(m.r[3], m.r[0]);
+		planes[2] = XMVectorAdd(m.r[3], m.r[1]);
+		planes[3] = XMVectorSubtract(m.r[3], m.r[1]);
+		planes[4] = m.r[2];
+		planes[5] = XMVectorSubtract(m.r[3], m.r[2]);
+		for (int i = 0; i < 6; i++)
+			planes[i] = XMPlaneNormalize(planes[i]);
+	}
+
+	bool SphereOutsideFrustum(const XMVECTOR planes[6], FXMVECTOR center, float radius)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (XMVectorGetX(XMPlaneDotCoord(planes[i], center)) < -radius)
+				return true;
+		}
+		return false;
+	}
+
+	// Cull meshlets against the view frustum and by their normal cones.
+	// world and viewProjection are the row vector matrices used for
+	// rendering, eye is the camera position in world space. Appends the
+	// indices of the surviving meshlets to visible and returns their triangle count
+	size_t CullMeshlets(const MeshletData& data, FXMMATRIX world, CXMMATRIX viewProjection, XMVECTOR eye, vector<int>& visible)
+	{
+		XMVECTOR planes[6];
+		GetFrustumPlanes(viewProjection, planes);
+
+		float worldScale = max(max(XMVectorGetX(XMVector3Length(world.r[0])),
+			XMVectorGetX(XMVector3Length(world.r[1]))), XMVectorGetX(XMVector3Length(world.r[2])));
+
+		size_t triangles = 0;
+		for (size_t i = 0; i < data.meshlets.size(); i++)
+		{
+			const Meshlet& meshlet = data.meshlets[i];
+			XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&meshlet.center), world);
+			float radius = meshlet.radius * worldScale;
+
+			if (SphereOutsideFrustum(planes, center, radius))
+				continue;
+
+			// back facing when the eye lies inside the cone opposite the axis,
+			// widened by the bounding sphere
+			if (meshlet.coneCutoff < 1.0f)
+			{
+				XMVECTOR axis = XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&meshlet.coneAxis), world));
+				XMVECTOR toCenter = XMVectorSubtract(center, eye);
+				float distance = XMVectorGetX(XMVector3Length(toCenter));
+				if (XMVectorGetX(XMVector3Dot(toCenter, axis)) >= meshlet.coneCutoff * distance + radius)
+					continue;
+			}
+
+			visible.push_back((int)i);
+			triangles += meshlet.triangleCount;
+		}
+		return triangles;
+	}
+
+	// Build meshlets for the full detail triangles and report their size
+	// and how many survive culling from cameras around the mesh
+	void BenchmarkMeshlets(const SimpleMesh<SimpleVertex>& simpleMesh)
+	{
+		size_t indexCount = simpleMesh.lods.empty() ? simpleMesh.indicesList.size() : simpleMesh.lods[0].indexCount;
+		if (indexCount == 0)
+			return;
+
+		MeshletData data;
+		auto start = chrono::high_resolution_clock::now();
+		BuildMeshlets(data, simpleMesh.indicesList.data(), indexCount, simpleMesh.vertexList);
+		double buildTime = ElapsedMs(start);
+
+		// the meshlets must reproduce the input triangles
+		vector<int> meshletIndices;
+		GetMeshletIndices(data, meshletIndices);
+		vector<int> sortedInput(simpleMesh.indicesList.begin(), simpleMesh.indicesList.begin() + indexCount);
+		auto sortTriangles = [](vector<int>& indices)
+		{
+			vector<array<int, 3>> triangles(indices.size() / 3);
+			for (size_t t = 0; t < triangles.size(); t++)
+			{
+				array<int, 3> tri = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+				// rotate the smallest index first, keeping the winding
+				rotate(tri.begin(), min_element(tri.begin(), tri.end()), tri.end());
+				triangles[t] = tri;
+			}
+			sort(triangles.begin(), triangles.end());
+			return triangles;
+		};
+		bool matches = sortTriangles(sortedInput) == sortTriangles(meshletIndices);
+
+		float coneCount = 0.0f;
+		for (const Meshlet& meshlet : data.meshlets)
+			coneCount += meshlet.coneCutoff < 1.0f;
+
+		cout << "meshlets: " << data.meshlets.size() << " (" << (float)data.vertices.size() / data.meshlets.size()
+			<< " vertices, " << (float)(indexCount / 3) / data.meshlets.size() << " triangles on average)" << endl;
+		cout << "meshlets with a usable normal cone: " << coneCount / data.meshlets.size() * 100.0f << "%" << endl;
+		cout << "meshlet triangles match input: " << (matches ? "yes" : "NO") << endl;
+		cout << "meshlet build time: " << buildTime << " ms" << endl;
+
+		// cameras on the 6 axes, looking at the mesh center from 2 radii away
+		XMFLOAT3 minPos = simpleMesh.vertexList[0].Pos, maxPos = minPos;
+		for (const SimpleVertex& vert : simpleMesh.vertexList)
+		{
+			minPos = XMFLOAT3(min(minPos.x, vert.Pos.x), min(minPos.y, vert.Pos.y), min(minPos.z, vert.Pos.z));
+			maxPos = XMFLOAT3(max(maxPos.x, vert.Pos.x), max(maxPos.y, vert.Pos.y), max(maxPos.z, vert.Pos.z));
+		}
+		XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&minPos), XMLoadFloat3(&maxPos)), 0.5f);
+		float radius = max(XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&maxPos), center))), 0.001f);
+		XMMATRIX projection = XMMatrixPerspectiveFovLH(XM_PIDIV4, 1.0f, radius * 0.01f, radius * 10.0f);
+
+		XMVECTOR directions[6] =
+		{
+			XMVectorSet(1, 0, 0, 0), XMVectorSet(-1, 0, 0, 0), XMVectorSet(0, 1, 0, 0),
+			XMVectorSet(0, -1, 0, 0), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 0, -1, 0),
+		};
+		size_t visibleTriangles = 0;
+		size_t visibleMeshlets = 0;
+		double cullTime = 0.0;
+		for (XMVECTOR direction : directions)
+		{
+			XMVECTOR eye = XMVectorAdd(center, XMVectorScale(direction, radius * 2.0f));
+			XMVECTOR up = fabsf(XMVectorGetY(direction)) > 0.5f ? XMVectorSet(0, 0, 1, 0) : XMVectorSet(0, 1, 0, 0);
+			XMMATRIX viewProjection = XMMatrixMultiply(XMMatrixLookAtLH(eye, center, up), projection);
+
+			vector<int> visible;
+			start = chrono::high_resolution_clock::now();
+			visibleTriangles += CullMeshlets(data, XMMatrixIdentity(), viewProjection, eye, visible);
+			cullTime += ElapsedMs(start);
+			visibleMeshlets += visible.size();
+		}
+
+		cout << "meshlets culled from axis views: " << 100.0f - 100.0f * visibleMeshlets / (6.0f * data.meshlets.size())
+			<< "% (" << 100.0f - 100.0f * visibleTriangles / (6.0f * (indexCount / 3)) << "% of triangles)" << endl;
+		cout << "meshlet cull time: " << cullTime / 6.0 << " ms per view" << endl;
+	}
+
+	// Byte group coding (Stream VByte): values go in groups of 4, each group
+	// has one control byte with the 2 bit byte length (minus one) of every
+	// value, and the control bytes come before the packed value bytes.
+	// Decoders read 16 bytes at a time, so encoded streams end with
+	// codecPadding spare bytes
+	const size_t codecPadding = 16;
+
+	void EncodeByteGroups(vector<uint8_t>& out, const uint32_t* values, size_t count)
+	{
+		size_t controlStart = out.size();
+		out.resize(controlStart + (count + 3) / 4, 0);
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t value = values[i];
+			int length = value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+			out[controlStart + i / 4] |= (uint8_t)((length - 1) << ((i % 4) * 2));
+			for (int b = 0; b < length; b++)
+				out.push_back((uint8_t)(value >> (b * 8)));
+		}
+	}
+
+	uint32_t ZigZagEncode(int32_t value)
+	{
+		return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	}
+
+	int32_t ZigZagDecode(uint32_t value)
+	{
+		return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+	}
+
+	// Bytes a byte group stream of count values takes (control bytes plus the
+	// value bytes they announce), checked against the bytes available from
+	// in. Returns SIZE_MAX when it doesn't fit
+	size_t ByteGroupStreamSize(const uint8_t* in, size_t count, size_t available)
+	{
+		size_t controlSize = (count + 3) / 4;
+		if (controlSize > available)
+			return SIZE_MAX;
+
+		// each 2 bit length field stores length - 1
+		size_t dataSize = count;
+		for (size_t g = 0; g < count / 4; g++)
+		{
+			uint8_t c = in[g];
+			dataSize += (c & 3) + ((c >> 2) & 3) + ((c >> 4) & 3) + (c >> 6);
+		}
+		for (size_t i = count / 4 * 4; i < count; i++)
+			dataSize += (in[i / 4] >> ((i % 4) * 2)) & 3;
+
+		if (dataSize > available - controlSize)
+			return SIZE_MAX;
+		return controlSize + dataSize;
+	}
+
+	// Position in a byte group stream while decoding it in chunks
+	struct ByteGroupReader
+	{
+		const uint8_t* control;
+		const uint8_t* data;
+
+		ByteGroupReader(const uint8_t* in, size_t count) : control(in), data(in + (count + 3) / 4) {}
+	};
+
+#if defined(_M_X64) || defined(__SSSE3__)
+	// x64 only guarantees SSE2, so the pshufb decoder is only used when
+	// CPUID reports SSSE3 (leaf 1, ECX bit 9). Checked once
+	bool HasSSSE3()
+	{
+		static const bool supported = []()
+		{
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 9)) != 0;
+#else
+			unsigned eax, ebx, ecx, edx;
+			return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 9)) != 0;
+#endif
+		}();
+		return supported;
+	}
+
+	// pshufb masks that spread the packed bytes of a group into 4 words
+	struct ByteGroupShuffles
+	{
+		uint8_t masks[256][16];
+		uint8_t lengths[256];
+
+		ByteGroupShuffles()
+		{
+			for (int c = 0; c < 256; c++)
+			{
+				int offset = 0;
+				for (int k = 0; k < 4; k++)
+				{
+					int length = ((c >> (k * 2)) & 3) + 1;
+					for (int b = 0; b < 4; b++)
+						masks[c][k * 4 + b] = b < length ? (uint8_t)(offset + b) : 0x80;
+					offset += length;
+				}
+				lengths[c] = (uint8_t)offset;
+			}
+		}
+	};
+#endif
+
+	// Decode the next count values (a multiple of 4 unless it ends the stream)
+	// and undo the zigzag delta coding; last carries the running value
+	void DecodeByteGroupDeltas(ByteGroupReader& reader, uint32_t* values, size_t count, uint32_t& last)
+	{
+		static const uint32_t masks[4] = { 0xff, 0xffff, 0xffffff, 0xffffffff };
+
+		size_t fullGroups = count / 4;
+		size_t g = 0;
+#if defined(_M_X64) || defined(__SSSE3__)
+		if (HasSSSE3())
+		{
+			static const ByteGroupShuffles shuffles;
+			__m128i one = _mm_set1_epi32(1);
+			__m128i previous = _mm_set1_epi32((int)last);
+			for (; g < fullGroups; g++)
+			{
+				uint8_t c = reader.control[g];
+				__m128i data = _mm_loadu_si128((const __m128i*)reader.data);
+				__m128i mask = _mm_loadu_si128((const __m128i*)shuffles.masks[c]);
+				__m128i zigzag = _mm_shuffle_epi8(data, mask);
+				reader.data += shuffles.lengths[c];
+
+				// zigzag decode, then a prefix sum across the 4 lanes
+				__m128i delta = _mm_xor_si128(_mm_srli_epi32(zigzag, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(zigzag, one)));
+				delta = _mm_add_epi32(delta, _mm_slli_si128(delta, 4));
+				delta = _mm_add_epi32(delta, _mm_slli_si128(delta, 8));
+				__m128i result = _mm_add_epi32(delta, previous);
+				_mm_storeu_si128((__m128i*)(values + g * 4), result);
+				previous = _mm_shuffle_epi32(result, _MM_SHUFFLE(3, 3, 3, 3));
+			}
+			last = (uint32_t)_mm_cvtsi128_si32(previous);
+		}
+#endif
+		for (; g < fullGroups; g++)
+		{
+			uint32_t c = reader.control[g];
+			for (int k = 0; k < 4; k++)
+			{
+				uint32_t value;
+				memcpy(&value, reader.data, 4);
+				last += (uint32_t)ZigZagDecode(value & masks[c & 3]);
+				values[g * 4 + k] = last;
+				reader.data += (c & 3) + 1;
+				c >>= 2;
+			}
+		}
+		reader.control += fullGroups;
+
+		if (fullGroups * 4 < count)
+		{
+			uint32_t c = *reader.control++;
+			for (size_t i = fullGroups * 4; i < count; i++)
+			{
+				uint32_t value;
+				memcpy(&value, reader.data, 4);
+				last += (uint32_t)ZigZagDecode(value & masks[c & 3]);
+				values[i] = last;
+				reader.data += (c & 3) + 1;
+				c >>= 2;
+			}
+		}
+	}
+
+	// Indices are stored as zigzagged deltas to the previous index, which
+	// stay small for cache optimized triangle lists
+	void EncodeIndexBuffer(vector<uint8_t>& out, const int* indices, size_t indexCount)
+	{
+		vector<uint32_t> deltas(indexCount);
+		int last = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			deltas[i] = ZigZagEncode(indices[i] - last);
+			last = indices[i];
+		}
+		EncodeByteGroups(out, deltas.data(), indexCount);
+		out.insert(out.end(), codecPadding, 0);
+	}
+
+	// Returns the first byte after the encoded indices, or nullptr when the
+	// stream and its padding don't fit before end
+	const uint8_t* DecodeIndexBuffer(int* indices, size_t indexCount, const uint8_t* in, const uint8_t* end)
+	{
+		size_t available = end - in;
+		size_t streamSize = ByteGroupStreamSize(in, indexCount, available);
+		if (streamSize == SIZE_MAX || available - streamSize < codecPadding)
+			return nullptr;
+
+		ByteGroupReader reader(in, indexCount);
+		uint32_t last = 0;
+		DecodeByteGroupDeltas(reader, (uint32_t*)indices, indexCount, last);
+		return reader.data + codecPadding;
+	}
+
+	// Vertices are split into 32 bit attribute components (x of every vertex,
+	// then y, and so on) and each component is stored as zigzagged deltas of
+	// its bit pattern to the previous vertex, which is lossless for float and
+	// packed vertices alike. Each stream starts with its size in bytes so the
+	// decoder can read all of them side by side. vertexSize must be a multiple of 4
+	void EncodeVertexBuffer(vector<uint8_t>& out, const void* vertices, size_t vertexCount, size_t vertexSize)
+	{
+		size_t components = vertexSize / 4;
+		const uint8_t* bytes = (const uint8_t*)vertices;
+		vector<uint32_t> deltas(vertexCount);
+		for (size_t c = 0; c < components; c++)
+		{
+			uint32_t last = 0;
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				uint32_t value;
+				memcpy(&value, bytes + v * vertexSize + c * 4, 4);
+				deltas[v] = ZigZagEncode((int32_t)(value - last));
+				last = value;
+			}
+			size_t sizeOffset = out.size();
+			out.resize(sizeOffset + sizeof(uint32_t));
+			EncodeByteGroups(out, deltas.data(), vertexCount);
+			uint32_t streamSize = (uint32_t)(out.size() - sizeOffset - sizeof(uint32_t));
+			memcpy(&out[sizeOffset], &streamSize, sizeof(streamSize));
+		}
+		out.insert(out.end(), codecPadding, 0);
+	}
+
+	// values are decoded this many vertices at a time, then interleaved
+	const size_t codecChunkSize = 256;
+
+	// Returns the first byte after the encoded vertices, or nullptr when a
+	// stream's size doesn't match its control bytes or the streams and
+	// their padding don't fit before end
+	const uint8_t* DecodeVertexBuffer(void* vertices, size_t vertexCount, size_t vertexSize, const uint8_t* in, const uint8_t* end)
+	{
+		size_t components = vertexSize / 4;
+		uint32_t* words = (uint32_t*)vertices;
+
+		// one reader per component stream, the streams follow each other
+		vector<ByteGroupReader> readers;
+		vector<uint32_t> last(components, 0);
+		for (size_t c = 0; c < components; c++)
+		{
+			uint32_t streamSize;
+			if ((size_t)(end - in) < sizeof(streamSize))
+				return nullptr;
+			memcpy(&streamSize, in, sizeof(streamSize));
+			in += sizeof(streamSize);
+			if (ByteGroupStreamSize(in, vertexCount, end - in) != streamSize)
+				return nullptr;
+			readers.push_back(ByteGroupReader(in, vertexCount));
+			in += streamSize;
+		}
+		// the decoder reads up to 16 bytes past the last value
+		if ((size_t)(end - in) < codecPadding)
+			return nullptr;
+
+		vector<uint32_t> chunk(components * codecChunkSize);
+		for (size_t v = 0; v < vertexCount; v += codecChunkSize)
+		{
+			size_t count = min(codecChunkSize, vertexCount - v);
+			for (size_t c = 0; c < components; c++)
+				DecodeByteGroupDeltas(readers[c], &chunk[c * codecChunkSize], count, last[c]);
+
+			uint32_t* out = words + v * components;
+			for (size_t k = 0; k < count; k++)
+			{
+				for (size_t c = 0; c < components; c++)
+					out[k * components + c] = chunk[c * codecChunkSize + k];
+			}
+		}
+		return in + codecPadding;
+	}
+
+	// Whole mesh as one blob: counts, LOD table, index stream, vertex stream
+	struct EncodedMeshHeader
+	{
+		uint32_t magic = 0x4853454d; // "MESH"
+		uint32_t vertexCount = 0;
+		uint32_t vertexSize = 0;
+		uint32_t indexCount = 0;
+		uint32_t lodCount = 0;
+	};
+
+	template <typename T>
+	void EncodeMesh(vector<uint8_t>& out, const SimpleMesh<T>& simpleMesh)
+	{
+		static_assert(sizeof(T) % 4 == 0, "vertex size must be a multiple of 4 bytes");
+
+		EncodedMeshHeader header;
+		header.vertexCount = (uint32_t)simpleMesh.vertexList.size();
+		header.vertexSize = sizeof(T);
+		header.indexCount = (uint32_t)simpleMesh.indicesList.size();
+		header.lodCount = (uint32_t)simpleMesh.lods.size();
+
+		out.clear();
+		out.insert(out.end(), (const uint8_t*)&header, (const uint8_t*)(&header + 1));
+		out.insert(out.end(), (const uint8_t*)simpleMesh.lods.data(), (const uint8_t*)(simpleMesh.lods.data() + simpleMesh.lods.size()));
+		EncodeIndexBuffer(out, simpleMesh.indicesList.data(), simpleMesh.indicesList.size());
+		EncodeVertexBuffer(out, simpleMesh.vertexList.data(), simpleMesh.vertexList.size(), sizeof(T));
+	}
+
+	// Returns false when the blob is not an encoded mesh of this vertex type,
+	// is truncated, or holds indices or LODs outside the mesh
+	template <typename T>
+	bool DecodeMesh(SimpleMesh<T>& simpleMesh, const uint8_t* in, size_t size)
+	{
+		const uint8_t* end = in + size;
+		EncodedMeshHeader header;
+		if (size < sizeof(header))
+			return false;
+		memcpy(&header, in, sizeof(header));
+		if (header.magic != EncodedMeshHeader().magic || header.vertexSize != sizeof(T))
+			return false;
+		in += sizeof(header);
+
+		if (header.lodCount > (size_t)(end - in) / sizeof(MeshLOD))
+			return false;
+		simpleMesh.lods.resize(header.lodCount);
+		memcpy(simpleMesh.lods.data(), in, header.lodCount * sizeof(MeshLOD));
+		in += header.lodCount * sizeof(MeshLOD);
+
+		// every value takes at least a quarter control byte, so counts the
+		// blob can't hold are rejected before allocating for them
+		size_t available = end - in;
+		if (header.indexCount / 4 > available || header.vertexCount / 4 > available)
+			return false;
+
+		simpleMesh.indicesList.resize(header.indexCount);
+		in = DecodeIndexBuffer(simpleMesh.indicesList.data(), header.indexCount, in, end);
+		if (in == nullptr)
+			return false;
+		simpleMesh.vertexList.resize(header.vertexCount);
+		if (DecodeVertexBuffer(simpleMesh.vertexList.data(), header.vertexCount, sizeof(T), in, end) == nullptr)
+			return false;
+
+		for (int index : simpleMesh.indicesList)
+		{
+			if ((uint32_t)index >= header.vertexCount)
+				return false;
+		}
+		for (const MeshLOD& lod : simpleMesh.lods)
+		{
+			if (lod.indexStart < 0 || lod.indexCount < 0 || (uint32_t)lod.indexStart + (uint32_t)lod.indexCount > header.indexCount)
+				return false;
+		}
+		return true;
+	}
+
+	// Encode the mesh, check that it decodes to the same bytes and report
+	// the compression ratio and decode throughput (in decoded bytes)
+	template <typename T>
+	void BenchmarkMeshCodec(const SimpleMesh<T>& simpleMesh, const char* name)
+	{
+		size_t indexBytes = simpleMesh.indicesList.size() * sizeof(int);
+		size_t vertexBytes = simpleMesh.vertexList.size() * sizeof(T);
+
+		auto start = chrono::high_resolution_clock::now();
+		vector<uint8_t> encoded;
+		EncodeMesh(encoded, simpleMesh);
+		double encodeTime = ElapsedMs(start);
+
+		vector<uint8_t> encodedIndices, encodedVertices;
+		EncodeIndexBuffer(encodedIndices, simpleMesh.indicesList.data(), simpleMesh.indicesList.size());
+		EncodeVertexBuffer(encodedVertices, simpleMesh.vertexList.data(), simpleMesh.vertexList.size(), sizeof(T));
+
+		// repeat the decode so small meshes still give a stable time
+		const int repeats = 20;
+		SimpleMesh<T> decoded;
+		decoded.indicesList.resize(simpleMesh.indicesList.size());
+		decoded.vertexList.resize(simpleMesh.vertexList.size());
+
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			DecodeIndexBuffer(decoded.indicesList.data(), decoded.indicesList.size(), encodedIndices.data(),
+				encodedIndices.data() + encodedIndices.size());
+		double indexTime = ElapsedMs(start) / repeats;
+
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			DecodeVertexBuffer(decoded.vertexList.data(), decoded.vertexList.size(), sizeof(T), encodedVertices.data(),
+				encodedVertices.data() + encodedVertices.size());
+		double vertexTime = ElapsedMs(start) / repeats;
+
+		SimpleMesh<T> roundTrip;
+		bool matches = DecodeMesh(roundTrip, encoded.data(), encoded.size()) &&
+			roundTrip.indicesList == simpleMesh.indicesList && roundTrip.lods.size() == simpleMesh.lods.size() &&
+			memcmp(roundTrip.vertexList.data(), simpleMesh.vertexList.data(), vertexBytes) == 0 &&
+			decoded.indicesList == simpleMesh.indicesList &&
+			memcmp(decoded.vertexList.data(), simpleMesh.vertexList.data(), vertexBytes) == 0;
+
+		cout << name << " codec: " << indexBytes + vertexBytes << " -> " << encoded.size() << " bytes ("
+			<< (float)encoded.size() / max(indexBytes + vertexBytes, (size_t)1) * 100.0f << "%), round trip "
+			<< (matches ? "matches" : "DIFFERS") << endl;
+		cout << "  indices: " << (float)encodedIndices.size() / max(indexBytes, (size_t)1) * 100.0f << "%, decode "
+			<< indexBytes / (indexTime * 1e6) << " GB/s" << endl;
+		cout << "  vertices: " << (float)encodedVertices.size() / max(vertexBytes, (size_t)1) * 100.0f << "%, decode "
+			<< vertexBytes / (vertexTime * 1e6) << " GB/s" << endl;
+		cout << "  encode time: " << encodeTime << " ms" << endl;
+	}
+
+	// Scalar reference for ConvertDouble4ToFloat3
+	void ConvertDouble4ToFloat3Scalar(const double* source, size_t count, float scale, XMFLOAT3* dest)
+	{
+		for (size_t i = 0; i < count; i++, source += 4)
+			dest[i] = XMFLOAT3((float)source[0] * scale, (float)source[1] * scale, (float)source[2] * scale);
+	}
+
+	// Narrow count 4 double vectors (the FbxVector4 layout, w ignored) to
+	// float3 times scale. Four vectors at a time are converted and packed
+	// into three 16 byte stores. Same results as the scalar version
+	void ConvertDouble4ToFloat3(const double* source, size_t count, float scale, XMFLOAT3* dest)
+	{
+		size_t i = 0;
+#if defined(_M_X64) || defined(__SSSE3__)
+		__m128 scale4 = _mm_set1_ps(scale);
+		auto load = [&](const double* v)
+		{
+			__m128 xy = _mm_cvtpd_ps(_mm_loadu_pd(v));
+			__m128 zw = _mm_cvtpd_ps(_mm_loadu_pd(v + 2));
+			return _mm_mul_ps(_mm_movelh_ps(xy, zw), scale4);
+		};
+		for (; i + 4 <= count; i += 4, source += 16)
+		{
+			__m128 p0 = load(source), p1 = load(source + 4), p2 = load(source + 8), p3 = load(source + 12);
+			// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+			__m128 t0 = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(0, 0, 2, 2));
+			__m128 t2 = _mm_shuffle_ps(p2, p3, _MM_SHUFFLE(0, 0, 2, 2));
+			float* out = &dest[i].x;
+			_mm_storeu_ps(out, _mm_shuffle_ps(p0, t0, _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(out + 4, _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(1, 0, 2, 1)));
+			_mm_storeu_ps(out + 8, _mm_shuffle_ps(t2, p3, _MM_SHUFFLE(2, 1, 2, 0)));
+		}
+#endif
+		ConvertDouble4ToFloat3Scalar(source, count - i, scale, dest + i);
+	}
+
+	// Scalar reference for ConvertDouble2ToFlippedFloat2
+	void ConvertDouble2ToFlippedFloat2Scalar(const double* source, size_t count, XMFLOAT2* dest)
+	{
+		for (size_t i = 0; i < count; i++, source += 2)
+			dest[i] = XMFLOAT2((float)source[0], 1.0f - (float)source[1]);
+	}
+
+	// Narrow count 2 double vectors (FbxVector2 uvs) to float2 with v
+	// flipped to 1 - v for D3D, two at a time
+	void ConvertDouble2ToFlippedFloat2(const double* source, size_t count, XMFLOAT2* dest)
+	{
+		size_t i = 0;
+#if defined(_M_X64) || defined(__SSSE3__)
+		// 1 - v computed as -v + 1, which rounds the same; u gets -0.0
+		// added so a -0.0 u stays -0.0
+		__m128 flip = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+		__m128 one = _mm_set_ps(1.0f, -0.0f, 1.0f, -0.0f);
+		for (; i + 2 <= count; i += 2, source += 4)
+		{
+			__m128 uv = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(source)), _mm_cvtpd_ps(_mm_loadu_pd(source + 2)));
+			_mm_storeu_ps(&dest[i].x, _mm_add_ps(_mm_xor_ps(uv, flip), one));
+		}
+#endif
+		ConvertDouble2ToFlippedFloat2Scalar(source, count - i, dest + i);
+	}
+
+	// Scalar reference for ComputeAABB
+	void ComputeAABBScalar(const SimpleVertex* vertices, size_t count, XMFLOAT3& minPos, XMFLOAT3& maxPos)
+	{
+		minPos = maxPos = count ? vertices[0].Pos : XMFLOAT3(0.0f, 0.0f, 0.0f);
+		for (size_t v = 1; v < count; v++)
+		{
+			const XMFLOAT3& pos = vertices[v].Pos;
+			minPos.x = min(minPos.x, pos.x); minPos.y = min(minPos.y, pos.y); minPos.z = min(minPos.z, pos.z);
+			maxPos.x = max(maxPos.x, pos.x); maxPos.y = max(maxPos.y, pos.y); maxPos.z = max(maxPos.z, pos.z);
+		}
+	}
+
+	// Position as a vector, reading 16 bytes straight from the vertex
+	// (Pos plus Normal.x, which fits inside SimpleVertex); w is ignored
+	XMVECTOR LoadVertexPosition(const SimpleVertex& vertex)
+	{
+		return XMLoadFloat4((const XMFLOAT4*)&vertex.Pos);
+	}
+
+	// SIMD AABB, with two sets of accumulators to hide the min/max latency
+	void ComputeAABB(const SimpleVertex* vertices, size_t count, XMFLOAT3& minPos, XMFLOAT3& maxPos)
+	{
+		if (count == 0)
+		{
+			minPos = maxPos = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			return;
+		}
+
+		XMVECTOR min0 = LoadVertexPosition(vertices[0]), max0 = min0;
+		XMVECTOR min1 = min0, max1 = min0;
+		size_t v = 1;
+		for (; v + 1 < count; v += 2)
+		{
+			XMVECTOR p0 = LoadVertexPosition(vertices[v]);
+			XMVECTOR p1 = LoadVertexPosition(vertices[v + 1]);
+			min0 = XMVectorMin(min0, p0); max0 = XMVectorMax(max0, p0);
+			min1 = XMVectorMin(min1, p1); max1 = XMVectorMax(max1, p1);
+		}
+		if (v < count)
+		{
+			XMVECTOR p = LoadVertexPosition(vertices[v]);
+			min0 = XMVectorMin(min0, p); max0 = XMVectorMax(max0, p);
+		}
+		XMStoreFloat3(&minPos, XMVectorMin(min0, min1));
+		XMStoreFloat3(&maxPos, XMVectorMax(max0, max1));
+	}
+
+	// Scalar reference for ComputeBoundingSphere
+	void ComputeBoundingSphereScalar(const SimpleVertex* vertices, size_t count, XMFLOAT3& center, float& radius)
+	{
+		center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		radius = 0.0f;
+		if (count == 0)
+			return;
+
+		// extreme vertices along x, y and z
+		size_t minIndex[3] = { 0, 0, 0 }, maxIndex[3] = { 0, 0, 0 };
+		for (size_t v = 1; v < count; v++)
+		{
+			const float* pos = &vertices[v].Pos.x;
+			for (int a = 0; a < 3; a++)
+			{
+				if (pos[a] < (&vertices[minIndex[a]].Pos.x)[a])
+					minIndex[a] = v;
+				if (pos[a] > (&vertices[maxIndex[a]].Pos.x)[a])
+					maxIndex[a] = v;
+			}
+		}
+
+		// start from the most distant pair
+		float bestDistance = -1.0f;
+		for (int a = 0; a < 3; a++)
+		{
+			const XMFLOAT3& p0 = vertices[minIndex[a]].Pos;
+			const XMFLOAT3& p1 = vertices[maxIndex[a]].Pos;
+			float dx = p1.x - p0.x, dy = p1.y - p0.y, dz = p1.z - p0.z;
+			float distance = dx * dx + dy * dy + dz * dz;
+			if (distance > bestDistance)
+			{
+				bestDistance = distance;
+				center = XMFLOAT3((p0.x + p1.x) * 0.5f, (p0.y + p1.y) * 0.5f, (p0.z + p1.z) * 0.5f);
+				radius = sqrtf(distance) * 0.5f;
+			}
+		}
+
+		// Ritter: grow the sphere just enough to take in each outside vertex
+		for (size_t v = 0; v < count; v++)
+		{
+			const XMFLOAT3& pos = vertices[v].Pos;
+			float dx = pos.x - center.x, dy = pos.y - center.y, dz = pos.z - center.z;
+			float distance2 = dx * dx + dy * dy + dz * dz;
+			if (distance2 > radius * radius)
+			{
+				float distance = sqrtf(distance2);
+				float newRadius = (radius + distance) * 0.5f;
+				float k = (newRadius - radius) / distance;
+				center = XMFLOAT3(center.x + dx * k, center.y + dy * k, center.z + dz * k);
+				radius = newRadius;
+			}
+		}
+
+		// make sure rounding in the updates left nothing outside
+		float maxDistance2 = 0.0f;
+		for (size_t v = 0; v < count; v++)
+		{
+			const XMFLOAT3& pos = vertices[v].Pos;
+			float dx = pos.x - center.x, dy = pos.y - center.y, dz = pos.z - center.z;
+			maxDistance2 = max(maxDistance2, dx * dx + dy * dy + dz * dz);
+		}
+		radius = max(radius, sqrtf(maxDistance2));
+	}
+
+	// SIMD Ritter sphere: the extreme vertex search keeps the per axis
+	// minimum/maximum and their vertex indices in vector lanes
+	void ComputeBoundingSphere(const SimpleVertex* vertices, size_t count, XMFLOAT3& center, float& radius)
+	{
+		center = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		radius = 0.0f;
+		if (count == 0)
+			return;
+
+		XMVECTOR minPos = LoadVertexPosition(vertices[0]), maxPos = minPos;
+		XMVECTOR minIndex = XMVectorReplicateInt(0), maxIndex = minIndex;
+		for (size_t v = 1; v < count; v++)
+		{
+			XMVECTOR p = LoadVertexPosition(vertices[v]);
+			XMVECTOR index = XMVectorReplicateInt((uint32_t)v);
+			XMVECTOR less = XMVectorLess(p, minPos);
+			XMVECTOR greater = XMVectorGreater(p, maxPos);
+			minPos = XMVectorSelect(minPos, p, less);
+			minIndex = XMVectorSelect(minIndex, index, less);
+			maxPos = XMVectorSelect(maxPos, p, greater);
+			maxIndex = XMVectorSelect(maxIndex, index, greater);
+		}
+
+		uint32_t minIndices[3] = { XMVectorGetIntX(minIndex), XMVectorGetIntY(minIndex), XMVectorGetIntZ(minIndex) };
+		uint32_t maxIndices[3] = { XMVectorGetIntX(maxIndex), XMVectorGetIntY(maxIndex), XMVectorGetIntZ(maxIndex) };
+		XMVECTOR c = XMVectorZero();
+		float r = 0.0f, bestDistance = -1.0f;
+		for (int a = 0; a < 3; a++)
+		{
+			XMVECTOR p0 = LoadVertexPosition(vertices[minIndices[a]]);
+			XMVECTOR p1 = LoadVertexPosition(vertices[maxIndices[a]]);
+			float distance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(p1, p0)));
+			if (distance > bestDistance)
+			{
+				bestDistance = distance;
+				c = XMVectorScale(XMVectorAdd(p0, p1), 0.5f);
+				r = sqrtf(distance) * 0.5f;
+			}
+		}
+
+		float r2 = r * r;
+		for (size_t v = 0; v < count; v++)
+		{
+			XMVECTOR offset = XMVectorSubtract(LoadVertexPosition(vertices[v]), c);
+			float distance2 = XMVectorGetX(XMVector3LengthSq(offset));
+			if (distance2 > r2)
+			{
+				float distance = sqrtf(distance2);
+				float newRadius = (r + distance) * 0.5f;
+				c = XMVectorAdd(c, XMVectorScale(offset, (newRadius - r) / distance));
+				r = newRadius;
+				r2 = r * r;
+			}
+		}
+
+		XMVECTOR maxDistance2 = XMVectorZero();
+		for (size_t v = 0; v < count; v++)
+		{
+			XMVECTOR offset = XMVectorSubtract(LoadVertexPosition(vertices[v]), c);
+			maxDistance2 = XMVectorMax(maxDistance2, XMVector3LengthSq(offset));
+		}
+
+		XMStoreFloat3(&center, c);
+		radius = max(r, sqrtf(XMVectorGetX(maxDistance2)));
+	}
+
+	// Eigenvectors of a symmetric 3x3 matrix (cyclic Jacobi), as the rows of axes
+	void SymmetricEigenvectors(double m[3][3], double axes[3][3])
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				axes[i][j] = i == j ? 1.0 : 0.0;
+
+		for (int sweep = 0; sweep < 16; sweep++)
+		{
+			double offDiagonal = fabs(m[0][1]) + fabs(m[0][2]) + fabs(m[1][2]);
+			if (offDiagonal < 1e-12)
+				break;
+
+			for (int p = 0; p < 2; p++)
+			{
+				for (int q = p + 1; q < 3; q++)
+				{
+					if (fabs(m[p][q]) < 1e-30)
+						continue;
+					double theta = (m[q][q] - m[p][p]) / (2.0 * m[p][q]);
+					double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+					double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+
+					// m = R^T m R with R rotating the p/q plane
+					for (int k = 0; k < 3; k++)
+					{
+						double mkp = m[k][p], mkq = m[k][q];
+						m[k][p] = c * mkp - s * mkq;
+						m[k][q] = s * mkp + c * mkq;
+					}
+					for (int k = 0; k < 3; k++)
+					{
+						double mpk = m[p][k], mqk = m[q][k];
+						m[p][k] = c * mpk - s * mqk;
+						m[q][k] = s * mpk + c * mqk;
+					}
+					for (int k = 0; k < 3; k++)
+					{
+						double apk = axes[p][k], aqk = axes[q][k];
+						axes[p][k] = c * apk - s * aqk;
+						axes[q][k] = s * apk + c * aqk;
+					}
+				}
+			}
+		}
+	}
+
+	// OBB along the principal axes of the vertex positions. Falls back to the
+	// AABB whenever that is the smaller box
+	void ComputeOBB(const SimpleVertex* vertices, size_t count, MeshBounds& bounds)
+	{
+		bounds.hasOBB = true;
+		XMVECTOR aabbMin = XMLoadFloat3(&bounds.aabbMin), aabbMax = XMLoadFloat3(&bounds.aabbMax);
+		XMStoreFloat3(&bounds.obbCenter, XMVectorScale(XMVectorAdd(aabbMin, aabbMax), 0.5f));
+		XMStoreFloat3(&bounds.obbExtents, XMVectorScale(XMVectorSubtract(aabbMax, aabbMin), 0.5f));
+		bounds.obbAxes[0] = XMFLOAT3(1.0f, 0.0f, 0.0f);
+		bounds.obbAxes[1] = XMFLOAT3(0.0f, 1.0f, 0.0f);
+		bounds.obbAxes[2] = XMFLOAT3(0.0f, 0.0f, 1.0f);
+		if (count < 3)
+			return;
+
+		// covariance, relative to the AABB center to keep floats precise;
+		// squares and cross terms (xy, yz, zx) each in one vector
+		XMVECTOR origin = XMLoadFloat3(&bounds.obbCenter);
+		XMVECTOR sum = XMVectorZero(), sumSquares = XMVectorZero(), sumCross = XMVectorZero();
+		for (size_t v = 0; v < count; v++)
+		{
+			XMVECTOR p = XMVectorSubtract(LoadVertexPosition(vertices[v]), origin);
+			sum = XMVectorAdd(sum, p);
+			sumSquares = XMVectorMultiplyAdd(p, p, sumSquares);
+			sumCross = XMVectorMultiplyAdd(p, XMVectorSwizzle<1, 2, 0, 3>(p), sumCross);
+		}
+		XMFLOAT3 s, s2, sc;
+		XMStoreFloat3(&s, sum);
+		XMStoreFloat3(&s2, sumSquares);
+		XMStoreFloat3(&sc, sumCross);
+		double n = (double)count;
+		double mean[3] = { s.x / n, s.y / n, s.z / n };
+		double covariance[3][3];
+		covariance[0][0] = s2.x / n - mean[0] * mean[0];
+		covariance[1][1] = s2.y / n - mean[1] * mean[1];
+		covariance[2][2] = s2.z / n - mean[2] * mean[2];
+		covariance[0][1] = covariance[1][0] = sc.x / n - mean[0] * mean[1];
+		covariance[1][2] = covariance[2][1] = sc.y / n - mean[1] * mean[2];
+		covariance[2][0] = covariance[0][2] = sc.z / n - mean[2] * mean[0];
+
+		double eigenvectors[3][3];
+		SymmetricEigenvectors(covariance, eigenvectors);
+
+		// project on the axes: the columns of this matrix are the axes
+		XMMATRIX project = XMMatrixIdentity();
+		XMVECTOR axes[3];
+		for (int a = 0; a < 3; a++)
+			axes[a] = XMVector3Normalize(XMVectorSet((float)eigenvectors[a][0], (float)eigenvectors[a][1], (float)eigenvectors[a][2], 0.0f));
+		// keep the basis right handed
+		axes[2] = XMVector3Cross(axes[0], axes[1]);
+		for (int a = 0; a < 3; a++)
+			project.r[a] = axes[a];
+		project = XMMatrixTranspose(project);
+
+		XMVECTOR minProjection = XMVector3TransformNormal(XMVectorSubtract(LoadVertexPosition(vertices[0]), origin), project);
+		XMVECTOR maxProjection = minProjection;
+		for (size_t v = 1; v < count; v++)
+		{
+			XMVECTOR projection = XMVector3TransformNormal(XMVectorSubtract(LoadVertexPosition(vertices[v]), origin), project);
+			minProjection = XMVectorMin(minProjection, projection);
+			maxProjection = XMVectorMax(maxProjection, projection);
+		}
+
+		XMFLOAT3 extents, middle;
+		XMStoreFloat3(&extents, XMVectorScale(XMVectorSubtract(maxProjection, minProjection), 0.5f));
+		XMStoreFloat3(&middle, XMVectorScale(XMVectorAdd(maxProjection, minProjection), 0.5f));
+		float volume = extents.x * extents.y * extents.z;
+		float aabbVolume = bounds.obbExtents.x * bounds.obbExtents.y * bounds.obbExtents.z;
+		if (!(volume < aabbVolume))
+			return;
+
+		XMVECTOR center = XMVectorAdd(origin, XMVectorAdd(XMVectorAdd(XMVectorScale(axes[0], middle.x),
+			XMVectorScale(axes[1], middle.y)), XMVectorScale(axes[2], middle.z)));
+		XMStoreFloat3(&bounds.obbCenter, center);
+		bounds.obbExtents = extents;
+		for (int a = 0; a < 3; a++)
+			XMStoreFloat3(&bounds.obbAxes[a], axes[a]);
+	}
+
+	// AABB and bounding sphere, plus the PCA box when computeOBB is set
+	void ComputeMeshBounds(SimpleMesh<SimpleVertex>& simpleMesh, bool computeOBB = false)
+	{
+		MeshBounds& bounds = simpleMesh.bounds;
+		bounds = MeshBounds();
+		const SimpleVertex* vertices = simpleMesh.vertexList.data();
+		size_t count = simpleMesh.vertexList.size();
+		if (count == 0)
+			return;
+
+		ComputeAABB(vertices, count, bounds.aabbMin, bounds.aabbMax);
+		ComputeBoundingSphere(vertices, count, bounds.sphereCenter, bounds.sphereRadius);
+		if (computeOBB)
+			ComputeOBB(vertices, count, bounds);
+		bounds.valid = true;
+	}
+
+	// Bounds after transforming the mesh by world (row vector convention).
+	// The AABB encloses the transformed box, the sphere radius and box
+	// extents scale with the world matrix
+	MeshBounds TransformBounds(const MeshBounds& bounds, CXMMATRIX world)
+	{
+		MeshBounds result = bounds;
+		if (!bounds.valid)
+			return result;
+
+		XMVECTOR aabbMin = XMLoadFloat3(&bounds.aabbMin), aabbMax = XMLoadFloat3(&bounds.aabbMax);
+		XMVECTOR center = XMVector3TransformCoord(XMVectorScale(XMVectorAdd(aabbMin, aabbMax), 0.5f), world);
+		XMVECTOR extents = XMVectorScale(XMVectorSubtract(aabbMax, aabbMin), 0.5f);
+		XMVECTOR worldExtents = XMVectorAdd(XMVectorAdd(
+			XMVectorMultiply(XMVectorSplatX(extents), XMVectorAbs(world.r[0])),
+			XMVectorMultiply(XMVectorSplatY(extents), XMVectorAbs(world.r[1]))),
+			XMVectorMultiply(XMVectorSplatZ(extents), XMVectorAbs(world.r[2])));
+		XMStoreFloat3(&result.aabbMin, XMVectorSubtract(center, worldExtents));
+		XMStoreFloat3(&result.aabbMax, XMVectorAdd(center, worldExtents));
+
+		float scale = max(max(XMVectorGetX(XMVector3Length(world.r[0])),
+			XMVectorGetX(XMVector3Length(world.r[1]))), XMVectorGetX(XMVector3Length(world.r[2])));
+		XMStoreFloat3(&result.sphereCenter, XMVector3TransformCoord(XMLoadFloat3(&bounds.sphereCenter), world));
+		result.sphereRadius = bounds.sphereRadius * scale;
+
+		if (bounds.hasOBB)
+		{
+			XMStoreFloat3(&result.obbCenter, XMVector3TransformCoord(XMLoadFloat3(&bounds.obbCenter), world));
+			float* extent = &result.obbExtents.x;
+			for (int a = 0; a < 3; a++)
+			{
+				XMVECTOR axis = XMVector3TransformNormal(XMLoadFloat3(&bounds.obbAxes[a]), world);
+				float length = XMVectorGetX(XMVector3Length(axis));
+				extent[a] = (&bounds.obbExtents.x)[a] * length;
+				XMStoreFloat3(&result.obbAxes[a], length > 0.0f ? XMVectorScale(axis, 1.0f / length) : axis);
+			}
+		}
+		return result;
+	}
+
+	// Time the scalar and SIMD AABB/sphere code and the OBB fit, and check
+	// that both versions agree
+	void BenchmarkBounds(const SimpleMesh<SimpleVertex>& simpleMesh)
+	{
+		const SimpleVertex* vertices = simpleMesh.vertexList.data();
+		size_t count = simpleMesh.vertexList.size();
+		if (count == 0)
+			return;
+
+		const int repeats = 20;
+		XMFLOAT3 scalarMin, scalarMax, simdMin, simdMax, scalarCenter, simdCenter;
+		float scalarRadius, simdRadius;
+
+		auto start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			ComputeAABBScalar(vertices, count, scalarMin, scalarMax);
+		double aabbScalarTime = ElapsedMs(start) / repeats;
+
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			ComputeAABB(vertices, count, simdMin, simdMax);
+		double aabbTime = ElapsedMs(start) / repeats;
+
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			ComputeBoundingSphereScalar(vertices, count, scalarCenter, scalarRadius);
+		double sphereScalarTime = ElapsedMs(start) / repeats;
+
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			ComputeBoundingSphere(vertices, count, simdCenter, simdRadius);
+		double sphereTime = ElapsedMs(start) / repeats;
+
+		MeshBounds bounds;
+		bounds.aabbMin = simdMin;
+		bounds.aabbMax = simdMax;
+		start = chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; r++)
+			ComputeOBB(vertices, count, bounds);
+		double obbTime = ElapsedMs(start) / repeats;
+
+		bool aabbMatches = memcmp(&scalarMin, &simdMin, sizeof(XMFLOAT3)) == 0 && memcmp(&scalarMax, &simdMax, sizeof(XMFLOAT3)) == 0;
+		XMFLOAT3 size(simdMax.x - simdMin.x, simdMax.y - simdMin.y, simdMax.z - simdMin.z);
+		float aabbVolume = size.x * size.y * size.z;
+		float obbVolume = 8.0f * bounds.obbExtents.x * bounds.obbExtents.y * bounds.obbExtents.z;
+
+		cout << "AABB scalar/SIMD: " << aabbScalarTime << " / " << aabbTime << " ms, results "
+			<< (aabbMatches ? "match" : "DIFFER") << endl;
+		cout << "sphere scalar/SIMD: " << sphereScalarTime << " / " << sphereTime << " ms, radius "
+			<< scalarRadius << " / " << simdRadius << endl;
+		cout << "OBB fit: " << obbTime << " ms, volume " << obbVolume / max(aabbVolume, FLT_MIN) * 100.0f << "% of the AABB" << endl;
+	}
+
+	// Fill positionList from the vertices, so depth or shadow passes can fetch
+	// 12 bytes per vertex instead of a whole SimpleVertex. Run it after any
+	// pass that reorders the vertex list
+	void ExtractPositionStream(SimpleMesh<SimpleVertex>& simpleMesh)
 	{
-		// Using vectors because we don't know what size we are
-		// going to need until the end
-		vector<SimpleVertex> compactedVertexList;
-		vector<int> indicesList;
+		simpleMesh.positionList.resize(simpleMesh.vertexList.size());
+		for (size_t v = 0; v < simpleMesh.vertexList.size(); v++)
+			simpleMesh.positionList[v] = simpleMesh.vertexList[v].Pos;
+	}
 
-		// initialize running index
-		int compactedIndex = 0;
+	// Progressive stream: a header, then one level per LOD from the coarsest
+	// to the full mesh. Each level carries only the vertices its LOD adds on
+	// top of the coarser levels, plus that LOD's whole index list, so a reader
+	// can draw as soon as the first level has arrived and refine from there.
+	// Multi-part meshes follow the header with the material of each submesh
+	// and the material names, and start each level with the number of new
+	// vertices of each submesh, which are stored grouped by submesh
+	struct ProgressiveMeshHeader
+	{
+		uint32_t magic = 0x474f5250; // "PROG"
+		uint32_t levelCount = 0;
+		uint32_t vertexCount = 0;
+		// 0 for single part meshes
+		uint32_t submeshCount = 0;
+		uint32_t materialCount = 0;
+		uint32_t materialsSize = 0; // bytes of the submesh and material table
+		MeshBounds bounds;
+	};
 
-		// for each vertex in the expanded array
-		// compare to the compacted array for a matching
-		// vertex, if found, skip adding and set the index
-		for (SimpleVertex vertSimpleMesh : simpleMesh.vertexList)
+	struct ProgressiveLevelHeader
+	{
+		uint32_t vertexCount = 0; // new vertices in this level
+		uint32_t indexCount = 0;
+		uint32_t encodedSize = 0; // bytes following this header
+		float error = 0.0f;
+	};
+
+	// Reorders the vertices so each LOD references a prefix of the vertex list.
+	// Vertices no LOD uses go at the end of the last level
+	void EncodeProgressiveMesh(vector<uint8_t>& out, const SimpleMesh<SimpleVertex>& simpleMesh)
+	{
+		vector<MeshLOD> levels(simpleMesh.lods.rbegin(), simpleMesh.lods.rend());
+		if (levels.empty())
+			levels.push_back({ 0, (int)simpleMesh.indicesList.size(), 0.0f });
+
+		vector<int> vertexSubmesh = VertexSubmeshes(simpleMesh);
+		uint32_t submeshCount = vertexSubmesh.empty() ? 0 : (uint32_t)simpleMesh.submeshes.size();
+		vector<uint8_t> materials;
+		if (submeshCount > 0)
 		{
-			bool found = false;
-			int foundIndex = 0;
-			// search for match with the rest in the array
-			for (SimpleVertex vertCompactedList : compactedVertexList)
-			{
-				if (vertSimpleMesh.Pos.x == vertCompactedList.Pos.x &&
-					vertSimpleMesh.Pos.y == vertCompactedList.Pos.y &&
-					vertSimpleMesh.Pos.z == vertCompactedList.Pos.z &&
-					vertSimpleMesh.Normal.x == vertCompactedList.Normal.x &&
-					vertSimpleMesh.Normal.y == vertCompactedList.Normal.y &&
-					vertSimpleMesh.Normal.z == vertCompactedList.Normal.z &&
-					vertSimpleMesh.Tex.x == vertCompactedList.Tex.x &&
-					vertSimpleMesh.Tex.y == vertCompactedList.Tex.y
-					)
-				{
-					//cout << "Match at " << i << "-";
-					indicesList.push_back(foundIndex);
-					found = true;
-					break;
+			for (const MeshSubmesh& submesh : simpleMesh.submeshes)
+			{
+				int32_t material = submesh.material;
+				materials.insert(materials.end(), (const uint8_t*)&material, (const uint8_t*)(&material + 1));
+			}
+			for (const string& name : simpleMesh.materials)
+			{
+				uint32_t length = (uint32_t)name.size();
+				materials.insert(materials.end(), (const uint8_t*)&length, (const uint8_t*)(&length + 1));
+				materials.insert(materials.end(), name.begin(), name.end());
+			}
+		}
+
+		ProgressiveMeshHeader header;
+		header.levelCount = (uint32_t)levels.size();
+		header.vertexCount = (uint32_t)simpleMesh.vertexList.size();
+		header.submeshCount = submeshCount;
+		header.materialCount = submeshCount > 0 ? (uint32_t)simpleMesh.materials.size() : 0;
+		header.materialsSize = (uint32_t)materials.size();
+		header.bounds = simpleMesh.bounds;
+
+		out.clear();
+		out.insert(out.end(), (const uint8_t*)&header, (const uint8_t*)(&header + 1));
+		out.insert(out.end(), materials.begin(), materials.end());
+
+		vector<int> remap(simpleMesh.vertexList.size(), -1);
+		vector<int> order;
+		order.reserve(simpleMesh.vertexList.size());
+		vector<int> levelIndices;
+		vector<SimpleVertex> newVertices;
+		vector<uint32_t> submeshVertexCounts(submeshCount);
+		vector<uint8_t> payload;
+
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			size_t firstNew = order.size();
+			const int* lodIndices = simpleMesh.indicesList.data() + levels[l].indexStart;
+			for (int i = 0; i < levels[l].indexCount; i++)
+			{
+				int v = lodIndices[i];
+				if (remap[v] < 0)
+				{
+					remap[v] = (int)order.size();
+					order.push_back(v);
 				}
-				foundIndex++;
 			}
-			// didn't find a duplicate so keep (push back) the current vertex
-			// and increment the index count and push back that index as well
-			if (!found)
+			if (l + 1 == levels.size())
+			{
+				for (size_t v = 0; v < remap.size(); v++)
+				{
+					if (remap[v] < 0)
+					{
+						remap[v] = (int)order.size();
+						order.push_back((int)v);
+					}
+				}
+			}
+
+			// group the new vertices by submesh, first use order within each
+			fill(submeshVertexCounts.begin(), submeshVertexCounts.end(), 0);
+			if (submeshCount > 0)
 			{
-				compactedVertexList.push_back(vertSimpleMesh);
-				indicesList.push_back(compactedIndex);
-				compactedIndex++;
+				stable_sort(order.begin() + firstNew, order.end(), [&](int a, int b) { return vertexSubmesh[a] < vertexSubmesh[b]; });
+				for (size_t v = firstNew; v < order.size(); v++)
+				{
+					remap[order[v]] = (int)v;
+					submeshVertexCounts[vertexSubmesh[order[v]]]++;
+				}
 			}
+
+			levelIndices.resize(levels[l].indexCount);
+			for (int i = 0; i < levels[l].indexCount; i++)
+				levelIndices[i] = remap[lodIndices[i]];
+
+			newVertices.resize(order.size() - firstNew);
+			for (size_t v = 0; v < newVertices.size(); v++)
+				newVertices[v] = simpleMesh.vertexList[order[firstNew + v]];
+
+			payload.assign((const uint8_t*)submeshVertexCounts.data(), (const uint8_t*)(submeshVertexCounts.data() + submeshCount));
+			EncodeVertexBuffer(payload, newVertices.data(), newVertices.size(), sizeof(SimpleVertex));
+			EncodeIndexBuffer(payload, levelIndices.data(), levelIndices.size());
+
+			ProgressiveLevelHeader level;
+			level.vertexCount = (uint32_t)newVertices.size();
+			level.indexCount = (uint32_t)levelIndices.size();
+			level.encodedSize = (uint32_t)payload.size();
+			level.error = levels[l].error;
+			out.insert(out.end(), (const uint8_t*)&level, (const uint8_t*)(&level + 1));
+			out.insert(out.end(), payload.begin(), payload.end());
 		}
+	}
 
-		int numIndices = (int)simpleMesh.indicesList.size();
-		int numVertices = (int)simpleMesh.vertexList.size();
+	// Consumes a progressive stream in whatever pieces it arrives in. After
+	// ReadLevel returns true, mesh holds every vertex received so far and the
+	// index list of the newest level, ready for Renderable::CreateBuffers.
+	// Multi-part meshes keep their vertices grouped by submesh, so the
+	// submeshes and materials of mesh are valid after every level
+	struct ProgressiveMeshReader
+	{
+		SimpleMesh<SimpleVertex> mesh;
+		ProgressiveMeshHeader header;
+		float error = 0.0f;
+		int levelsRead = 0;
+		bool headerRead = false;
+		bool failed = false;
+		vector<uint8_t> pending;
+		// multi-part meshes: where each vertex of the stream is in mesh
+		vector<int> streamVertices;
 
-		// print out some stats
-		cout << "index count BEFORE/AFTER compaction " << numIndices << endl;
-		cout << "vertex count UNOPTIMIZED (SimpleMesh In): " << numVertices << endl;
-		cout << "vertex count AFTER compaction (SimpleMesh Out): " << compactedVertexList.size() << endl;
-		cout << "Size reduction: " << ((numVertices - compactedVertexList.size()) / (float)numVertices) * 100.00f << "%" << endl;
-		cout << "or " << (compactedVertexList.size() / (float)numVertices) << " of the expanded size" << endl;
+		void Append(const uint8_t* data, size_t size)
+		{
+			pending.insert(pending.end(), data, data + size);
+		}
+
+		bool Finished() const
+		{
+			return failed || (headerRead && levelsRead == (int)header.levelCount);
+		}
+
+		// Decodes the next level if all of its bytes are pending
+		bool ReadLevel()
+		{
+			if (Finished())
+				return false;
+
+			size_t offset = 0;
+			if (!headerRead)
+			{
+				if (pending.size() < sizeof(header))
+					return false;
+				memcpy(&header, pending.data(), sizeof(header));
+				if (header.magic != ProgressiveMeshHeader().magic)
+				{
+					failed = true;
+					return false;
+				}
+				if (pending.size() - sizeof(header) < header.materialsSize)
+					return false;
+				if (!ReadMaterials(pending.data() + sizeof(header), header.materialsSize))
+				{
+					failed = true;
+					return false;
+				}
+				mesh.bounds = header.bounds;
+				headerRead = true;
+				offset = sizeof(header) + header.materialsSize;
+			}
+
+			ProgressiveLevelHeader level;
+			bool complete = pending.size() - offset >= sizeof(level);
+			if (complete)
+			{
+				memcpy(&level, pending.data() + offset, sizeof(level));
+				complete = pending.size() - offset - sizeof(level) >= level.encodedSize;
+			}
+			if (!complete)
+			{
+				pending.erase(pending.begin(), pending.begin() + offset);
+				return false;
+			}
+
+			// the level's counts have to fit its payload and the vertex total
+			// announced in the header, checked before allocating for them
+			size_t firstNew = mesh.vertexList.size();
+			size_t countsSize = header.submeshCount * sizeof(uint32_t);
+			if (level.vertexCount > header.vertexCount - firstNew || level.encodedSize < countsSize || level.indexCount % 3 != 0 ||
+				level.vertexCount / 4 > level.encodedSize || level.indexCount / 4 > level.encodedSize)
+			{
+				failed = true;
+				return false;
+			}
+
+			// a level that fails to decode leaves mesh at the previous level
+			const uint8_t* in = pending.data() + offset + sizeof(level);
+			const uint8_t* end = in + level.encodedSize;
+			vector<uint32_t> submeshVertexCounts(header.submeshCount);
+			if (countsSize > 0)
+				memcpy(submeshVertexCounts.data(), in, countsSize);
+			in += countsSize;
+			uint64_t countedVertices = 0;
+			for (uint32_t count : submeshVertexCounts)
+				countedVertices += count;
+
+			mesh.vertexList.resize(firstNew + level.vertexCount);
+			in = DecodeVertexBuffer(mesh.vertexList.data() + firstNew, level.vertexCount, sizeof(SimpleVertex), in, end);
+			vector<int> indices(level.indexCount);
+			if (in != nullptr)
+				in = DecodeIndexBuffer(indices.data(), level.indexCount, in, end);
+			// the two streams fill the payload exactly
+			bool valid = in == end && (header.submeshCount == 0 || countedVertices == level.vertexCount);
+			for (size_t i = 0; valid && i < indices.size(); i++)
+				valid = (size_t)(uint32_t)indices[i] < mesh.vertexList.size();
+			if (!valid)
+			{
+				mesh.vertexList.resize(firstNew);
+				failed = true;
+				return false;
+			}
+			if (header.submeshCount > 0)
+				PlaceSubmeshVertices(firstNew, submeshVertexCounts, indices);
+			mesh.indicesList.swap(indices);
+			error = level.error;
+			levelsRead++;
+			// the last level brings in every remaining vertex
+			if (levelsRead == (int)header.levelCount && mesh.vertexList.size() != header.vertexCount)
+				failed = true;
+
+			pending.erase(pending.begin(), pending.begin() + offset + sizeof(level) + level.encodedSize);
+			return true;
+		}
+
+		// The material of each submesh, then each material name with its length
+		bool ReadMaterials(const uint8_t* in, size_t size)
+		{
+			const uint8_t* end = in + size;
+			if (header.submeshCount > size / sizeof(int32_t))
+				return false;
+			mesh.submeshes.resize(header.submeshCount);
+			for (MeshSubmesh& submesh : mesh.submeshes)
+			{
+				int32_t material;
+				memcpy(&material, in, sizeof(material));
+				in += sizeof(material);
+				if (material < -1 || material >= (int64_t)header.materialCount)
+					return false;
+				submesh.material = material;
+			}
+			for (uint32_t m = 0; m < header.materialCount; m++)
+			{
+				uint32_t length;
+				if ((size_t)(end - in) < sizeof(length))
+					return false;
+				memcpy(&length, in, sizeof(length));
+				in += sizeof(length);
+				if (length > (size_t)(end - in))
+					return false;
+				mesh.materials.push_back(string((const char*)in, length));
+				in += length;
+			}
+			return in == end;
+		}
+
+		// Move the level's new vertices (decoded after firstNew) to the end of
+		// their submesh's vertex range, point the stream indices at the new
+		// places and group the triangles by submesh
+		void PlaceSubmeshVertices(size_t firstNew, const vector<uint32_t>& submeshVertexCounts, vector<int>& indices)
+		{
+			vector<SimpleVertex> vertices;
+			vertices.reserve(mesh.vertexList.size());
+			vector<int> moved(firstNew);
+			vector<int> added;
+			added.reserve(mesh.vertexList.size() - firstNew);
+			size_t next = firstNew;
+			for (size_t s = 0; s < mesh.submeshes.size(); s++)
+			{
+				MeshSubmesh& submesh = mesh.submeshes[s];
+				int baseVertex = (int)vertices.size();
+				for (int v = submesh.baseVertex; v < submesh.baseVertex + submesh.vertexCount; v++)
+				{
+					moved[v] = (int)vertices.size();
+					vertices.push_back(mesh.vertexList[v]);
+				}
+				for (uint32_t v = 0; v < submeshVertexCounts[s]; v++)
+				{
+					added.push_back((int)vertices.size());
+					vertices.push_back(mesh.vertexList[next++]);
+				}
+				submesh.baseVertex = baseVertex;
+				submesh.vertexCount = (int)vertices.size() - baseVertex;
+			}
+			mesh.vertexList.swap(vertices);
+			for (int& place : streamVertices)
+				place = moved[place];
+			streamVertices.insert(streamVertices.end(), added.begin(), added.end());
+
+			vector<int> vertexSubmesh = VertexSubmeshes(mesh);
+			vector<int> grouped;
+			grouped.reserve(indices.size());
+			for (size_t s = 0; s < mesh.submeshes.size(); s++)
+			{
+				mesh.submeshes[s].indexStart = (int)grouped.size();
+				for (size_t i = 0; i < indices.size(); i += 3)
+				{
+					if (vertexSubmesh[streamVertices[indices[i]]] != (int)s)
+						continue;
+					for (size_t k = i; k < i + 3; k++)
+						grouped.push_back(streamVertices[indices[k]]);
+				}
+				mesh.submeshes[s].indexCount = (int)grouped.size() - mesh.submeshes[s].indexStart;
+			}
+			indices.swap(grouped);
+		}
+	};
+
+	// Stream the encoded mesh through a reader in small pieces and report how
+	// many bytes each level needs before it can be drawn
+	void BenchmarkProgressiveMesh(const SimpleMesh<SimpleVertex>& simpleMesh, size_t pieceSize = 4096)
+	{
+		auto start = chrono::high_resolution_clock::now();
+		vector<uint8_t> encoded;
+		EncodeProgressiveMesh(encoded, simpleMesh);
+		double encodeTime = ElapsedMs(start);
+
+		start = chrono::high_resolution_clock::now();
+		ProgressiveMeshReader reader;
+		for (size_t offset = 0; offset < encoded.size(); offset += pieceSize)
+		{
+			reader.Append(encoded.data() + offset, min(pieceSize, encoded.size() - offset));
+			while (reader.ReadLevel())
+			{
+				cout << "  level " << reader.levelsRead - 1 << ": " << reader.mesh.indicesList.size() / 3 << " triangles, "
+					<< reader.mesh.vertexList.size() << " vertices after " << (min(offset + pieceSize, encoded.size()) + 1023) / 1024
+					<< " KB (error " << reader.error << ")" << endl;
+			}
+		}
+		double streamTime = ElapsedMs(start);
+
+		// the last level is the full mesh with the vertices renumbered
+		const SimpleMesh<SimpleVertex>& result = reader.mesh;
+		size_t fullCount = simpleMesh.lods.empty() ? simpleMesh.indicesList.size() : simpleMesh.lods[0].indexCount;
+		bool matches = reader.Finished() && !reader.failed && result.indicesList.size() == fullCount &&
+			result.vertexList.size() == simpleMesh.vertexList.size();
+		for (size_t i = 0; matches && i < fullCount; i++)
+		{
+			matches = memcmp(&result.vertexList[result.indicesList[i]], &simpleMesh.vertexList[simpleMesh.indicesList[i]],
+				sizeof(SimpleVertex)) == 0;
+		}
+
+		cout << "progressive stream: " << encoded.size() << " bytes in " << reader.levelsRead << " levels, full mesh "
+			<< (matches ? "matches" : "DIFFERS") << endl;
+		cout << "  encode " << encodeTime << " ms, stream and decode " << streamTime << " ms" << endl;
+	}
+
+	// One source mesh of a static batch, with its bounds after transforming
+	struct BatchSubmesh
+	{
+		int indexStart = 0;
+		int indexCount = 0;
+		int vertexStart = 0;
+		int vertexCount = 0;
+		MeshBounds bounds;
+		// caller defined id of the source, e.g. its renderable index
+		int source = -1;
+	};
+
+	// Transform the vertices of a mesh without LODs or bounds yet by world in
+	// place, normals by its inverse transpose, flipping the triangles of
+	// mirroring transforms
+	void TransformMesh(SimpleMesh<SimpleVertex>& simpleMesh, CXMMATRIX world)
+	{
+		XMVECTOR determinant;
+		XMMATRIX normalMatrix = XMMatrixTranspose(XMMatrixInverse(&determinant, world));
+		for (SimpleVertex& vert : simpleMesh.vertexList)
+		{
+			XMStoreFloat3(&vert.Pos, XMVector3TransformCoord(XMLoadFloat3(&vert.Pos), world));
+			XMStoreFloat3(&vert.Normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vert.Normal), normalMatrix)));
+		}
+
+		if (XMVectorGetX(XMVector3Dot(XMVector3Cross(world.r[0], world.r[1]), world.r[2])) < 0.0f)
+			for (size_t i = 0; i + 2 < simpleMesh.indicesList.size(); i += 3)
+				swap(simpleMesh.indicesList[i + 1], simpleMesh.indicesList[i + 2]);
+	}
+
+	// Append the mesh transformed by world to batch, so several static meshes
+	// can be drawn with one call and an identity world matrix. Only the full
+	// detail level is copied. Normals use the inverse transpose of world and
+	// mirroring transforms get their triangles flipped to keep the winding
+	void AppendTransformedMesh(SimpleMesh<SimpleVertex>& batch, vector<BatchSubmesh>& submeshes,
+		const SimpleMesh<SimpleVertex>& simpleMesh, CXMMATRIX world, int source = -1)
+	{
+		BatchSubmesh submesh;
+		submesh.indexStart = (int)batch.indicesList.size();
+		submesh.indexCount = simpleMesh.lods.empty() ? (int)simpleMesh.indicesList.size() : simpleMesh.lods[0].indexCount;
+		submesh.vertexStart = (int)batch.vertexList.size();
+		submesh.vertexCount = (int)simpleMesh.vertexList.size();
+		submesh.source = source;
+
+		XMVECTOR determinant;
+		XMMATRIX normalMatrix = XMMatrixTranspose(XMMatrixInverse(&determinant, world));
+		batch.vertexList.reserve(batch.vertexList.size() + simpleMesh.vertexList.size());
+		for (const SimpleVertex& vert : simpleMesh.vertexList)
+		{
+			SimpleVertex transformed = vert;
+			XMStoreFloat3(&transformed.Pos, XMVector3TransformCoord(XMLoadFloat3(&vert.Pos), world));
+			XMStoreFloat3(&transformed.Normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vert.Normal), normalMatrix)));
+			batch.vertexList.push_back(transformed);
+		}
+
+		bool mirrored = XMVectorGetX(XMVector3Dot(XMVector3Cross(world.r[0], world.r[1]), world.r[2])) < 0.0f;
+		batch.indicesList.reserve(batch.indicesList.size() + submesh.indexCount);
+		for (int i = 0; i + 2 < submesh.indexCount; i += 3)
+		{
+			int a = simpleMesh.indicesList[i], b = simpleMesh.indicesList[i + 1], c = simpleMesh.indicesList[i + 2];
+			if (mirrored)
+				swap(b, c);
+			batch.indicesList.push_back(submesh.vertexStart + a);
+			batch.indicesList.push_back(submesh.vertexStart + b);
+			batch.indicesList.push_back(submesh.vertexStart + c);
+		}
+
+		if (simpleMesh.bounds.valid)
+		{
+			submesh.bounds = TransformBounds(simpleMesh.bounds, world);
+		}
+		else if (submesh.vertexCount > 0)
+		{
+			const SimpleVertex* vertices = batch.vertexList.data() + submesh.vertexStart;
+			ComputeAABB(vertices, submesh.vertexCount, submesh.bounds.aabbMin, submesh.bounds.aabbMax);
+			ComputeBoundingSphere(vertices, submesh.vertexCount, submesh.bounds.sphereCenter, submesh.bounds.sphereRadius);
+			submesh.bounds.valid = true;
+		}
+		submeshes.push_back(submesh);
+	}
+
+	// Signed area of a polygon, positive when the inside is left of its edges
+	float PolygonArea(const vector<XMFLOAT2>& polygon)
+	{
+		float area = 0.0f;
+		for (size_t i = 0; i < polygon.size(); i++)
+		{
+			XMFLOAT2 a = polygon[i], b = polygon[(i + 1) % polygon.size()];
+			area += a.x * b.y - a.y * b.x;
+		}
+		return area * 0.5f;
+	}
+
+	float Cross2D(XMFLOAT2 o, XMFLOAT2 a, XMFLOAT2 b)
+	{
+		return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+	}
+
+	// Strictly inside, points on the edges don't count
+	bool PointInTriangle(XMFLOAT2 p, XMFLOAT2 a, XMFLOAT2 b, XMFLOAT2 c)
+	{
+		float d0 = Cross2D(a, b, p), d1 = Cross2D(b, c, p), d2 = Cross2D(c, a, p);
+		const float epsilon = 1e-5f;
+		return (d0 > epsilon && d1 > epsilon && d2 > epsilon) || (d0 < -epsilon && d1 < -epsilon && d2 < -epsilon);
+	}
+
+	bool SegmentsCross(XMFLOAT2 a, XMFLOAT2 b, XMFLOAT2 c, XMFLOAT2 d)
+	{
+		float d0 = Cross2D(a, b, c), d1 = Cross2D(a, b, d), d2 = Cross2D(c, d, a), d3 = Cross2D(c, d, b);
+		return ((d0 > 0.0f) != (d1 > 0.0f)) && ((d2 > 0.0f) != (d3 > 0.0f)) && d0 != 0.0f && d1 != 0.0f && d2 != 0.0f && d3 != 0.0f;
+	}
+
+	// Shrink a convex polygon to targetCount vertices without losing any of
+	// its area: repeatedly drop the edge whose neighbours, extended until they
+	// meet, add the least area. Points stay inside the width x height box.
+	// Returns false when no edge can be dropped before reaching targetCount
+	bool ReduceConvexPolygon(vector<XMFLOAT2>& polygon, size_t targetCount, float width, float height)
+	{
+		while (polygon.size() > targetCount)
+		{
+			size_t n = polygon.size();
+			size_t best = n;
+			float bestArea = FLT_MAX;
+			XMFLOAT2 bestPoint;
+			for (size_t i = 0; i < n; i++)
+			{
+				XMFLOAT2 p0 = polygon[(i + n - 1) % n], p1 = polygon[i], p2 = polygon[(i + 1) % n], p3 = polygon[(i + 2) % n];
+				XMFLOAT2 d1(p1.x - p0.x, p1.y - p0.y), d2(p2.x - p3.x, p2.y - p3.y);
+				float denominator = d1.x * d2.y - d1.y * d2.x;
+				if (fabsf(denominator) < 1e-12f)
+					continue;
+				float t = ((p3.x - p0.x) * d2.y - (p3.y - p0.y) * d2.x) / denominator;
+				float u = ((p3.x - p0.x) * d1.y - (p3.y - p0.y) * d1.x) / denominator;
+				// the lines have to meet past p1 and p2
+				if (t < 1.0f || u < 1.0f)
+					continue;
+				XMFLOAT2 meet(p0.x + d1.x * t, p0.y + d1.y * t);
+				if (meet.x < 0.0f || meet.y < 0.0f || meet.x > width || meet.y > height)
+					continue;
+				float area = fabsf(Cross2D(p1, p2, meet)) * 0.5f;
+				if (area < bestArea)
+				{
+					bestArea = area;
+					best = i;
+					bestPoint = meet;
+				}
+			}
+			if (best == n)
+				return false;
+			polygon[best] = bestPoint;
+			polygon.erase(polygon.begin() + (best + 1) % n);
+		}
+		return true;
+	}
+
+	// Add up to notchCount vertices that pull edges in towards the inside,
+	// each time taking the notch that removes the most area without touching
+	// a blocker point, a covered texel (covered[y * width + x]) or another edge
+	void CarvePolygon(vector<XMFLOAT2>& polygon, int notchCount, const vector<XMFLOAT2>& blockers,
+		const vector<bool>& covered, int width, int height)
+	{
+		for (int notch = 0; notch < notchCount; notch++)
+		{
+			size_t n = polygon.size();
+			float orientation = PolygonArea(polygon) > 0.0f ? 1.0f : -1.0f;
+			float diameter = sqrtf((float)width * width + (float)height * height);
+
+			auto valid = [&](size_t edge, XMFLOAT2 m)
+			{
+				XMFLOAT2 a = polygon[edge], b = polygon[(edge + 1) % n];
+				int x = (int)floorf(m.x), y = (int)floorf(m.y);
+				if (x < 0 || y < 0 || x >= width || y >= height || covered[(size_t)y * width + x])
+					return false;
+				for (XMFLOAT2 p : blockers)
+				{
+					if (PointInTriangle(p, a, m, b))
+						return false;
+				}
+				for (size_t i = 0; i < n; i++)
+				{
+					if (i != edge && i != (edge + 1) % n && PointInTriangle(polygon[i], a, m, b))
+						return false;
+					XMFLOAT2 c = polygon[i], d = polygon[(i + 1) % n];
+					if (i != edge && (SegmentsCross(a, m, c, d) || SegmentsCross(m, b, c, d)))
+						return false;
+				}
+				return true;
+			};
+
+			size_t bestEdge = n;
+			float bestArea = 0.0f;
+			XMFLOAT2 bestPoint;
+			for (size_t edge = 0; edge < n; edge++)
+			{
+				XMFLOAT2 a = polygon[edge], b = polygon[(edge + 1) % n];
+				XMFLOAT2 direction(b.x - a.x, b.y - a.y);
+				float length = sqrtf(direction.x * direction.x + direction.y * direction.y);
+				if (length < 1.0f)
+					continue;
+				// the inside is left of the edges for a positive area
+				XMFLOAT2 inward(-direction.y / length * orientation, direction.x / length * orientation);
+
+				for (int step = 1; step < 10; step++)
+				{
+					float t = step / 10.0f;
+					XMFLOAT2 base(a.x + direction.x * t, a.y + direction.y * t);
+					// the notch triangles for growing depths are nested, so the
+					// deepest valid one can be found by bisection
+					float low = 0.0f, high = diameter;
+					for (int i = 0; i < 16; i++)
+					{
+						float depth = (low + high) * 0.5f;
+						if (valid(edge, XMFLOAT2(base.x + inward.x * depth, base.y + inward.y * depth)))
+							low = depth;
+						else
+							high = depth;
+					}
+					float area = 0.5f * length * low;
+					if (area > bestArea)
+					{
+						bestArea = area;
+						bestEdge = edge;
+						bestPoint = XMFLOAT2(base.x + inward.x * low, base.y + inward.y * low);
+					}
+				}
+			}
+
+			// not worth a vertex for less than a texel
+			if (bestEdge == n || bestArea < 1.0f)
+				return;
+			polygon.insert(polygon.begin() + bestEdge + 1, bestPoint);
+		}
+	}
+
+	// Polygon of at most maxVertices vertices (uv, 0..1, v down) around every
+	// texel whose alpha is above alphaThreshold, grown by a texel so bilinear
+	// filtering at the edge is not cut off. The convex hull is shrunk to fewer
+	// vertices and the rest are spent on notches, so shapes like a star or a
+	// cross get a concave outline. Accurate to about a texel. alpha points at
+	// the first texel's alpha byte, stride is the distance between texels in
+	// bytes. Falls back to the whole texture when nothing tighter fits
+	void ComputeCutoutPolygon(vector<XMFLOAT2>& polygon, const uint8_t* alpha, int width, int height, int stride,
+		int maxVertices = 8, uint8_t alphaThreshold = 0)
+	{
+		// texels the polygon has to cover: the opaque ones and their neighbours
+		vector<bool> opaque((size_t)width * height), covered((size_t)width * height);
+		for (size_t t = 0; t < opaque.size(); t++)
+			opaque[t] = alpha[t * stride] > alphaThreshold;
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				bool cover = false;
+				for (int ny = max(y - 1, 0); ny <= min(y + 1, height - 1) && !cover; ny++)
+				{
+					for (int nx = max(x - 1, 0); nx <= min(x + 1, width - 1) && !cover; nx++)
+						cover = opaque[(size_t)ny * width + nx];
+				}
+				covered[(size_t)y * width + x] = cover;
+			}
+		}
+
+		// corners and centres of the covered texels on the edge of the covered area; the
+		// row extremes among them are enough for the convex hull
+		vector<XMFLOAT2> blockers, points;
+		for (int y = 0; y < height; y++)
+		{
+			int minX = width, maxX = -1;
+			for (int x = 0; x < width; x++)
+			{
+				if (!covered[(size_t)y * width + x])
+					continue;
+				minX = min(minX, x);
+				maxX = x;
+				bool edge = x == 0 || y == 0 || x == width - 1 || y == height - 1 ||
+					!covered[(size_t)y * width + x - 1] || !covered[(size_t)y * width + x + 1] ||
+					!covered[(size_t)(y - 1) * width + x] || !covered[(size_t)(y + 1) * width + x];
+				if (edge)
+				{
+					blockers.insert(blockers.end(), { XMFLOAT2((float)x, (float)y), XMFLOAT2(x + 1.0f, (float)y),
+						XMFLOAT2((float)x, y + 1.0f), XMFLOAT2(x + 1.0f, y + 1.0f), XMFLOAT2(x + 0.5f, y + 0.5f) });
+				}
+			}
+			if (maxX < 0)
+				continue;
+			points.insert(points.end(), { XMFLOAT2((float)minX, (float)y), XMFLOAT2((float)minX, y + 1.0f),
+				XMFLOAT2(maxX + 1.0f, (float)y), XMFLOAT2(maxX + 1.0f, y + 1.0f) });
+		}
+		sort(blockers.begin(), blockers.end(), [](XMFLOAT2 a, XMFLOAT2 b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+		blockers.erase(unique(blockers.begin(), blockers.end(), [](XMFLOAT2 a, XMFLOAT2 b) { return a.x == b.x && a.y == b.y; }), blockers.end());
+
+		// monotone chain convex hull
+		vector<XMFLOAT2> hull;
+		if (!points.empty())
+		{
+			sort(points.begin(), points.end(), [](XMFLOAT2 a, XMFLOAT2 b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+			hull.resize(points.size() * 2);
+			size_t k = 0;
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				while (k >= 2 && Cross2D(hull[k - 2], hull[k - 1], points[i]) <= 0.0f)
+					k--;
+				hull[k++] = points[i];
+			}
+			for (size_t i = points.size() - 1, lower = k + 1; i > 0; i--)
+			{
+				while (k >= lower && Cross2D(hull[k - 2], hull[k - 1], points[i - 1]) <= 0.0f)
+					k--;
+				hull[k++] = points[i - 1];
+			}
+			hull.resize(k - 1);
+		}
+
+		// try each split of the vertex budget between hull and notches
+		vector<XMFLOAT2> best = { { 0.0f, 0.0f }, { 0.0f, (float)height }, { (float)width, (float)height }, { (float)width, 0.0f } };
+		float bestArea = (float)width * height;
+		for (int hullCount = 3; hull.size() >= 3 && hullCount <= maxVertices; hullCount++)
+		{
+			vector<XMFLOAT2> candidate = hull;
+			if (!ReduceConvexPolygon(candidate, hullCount, (float)width, (float)height))
+				continue;
+			CarvePolygon(candidate, maxVertices - (int)candidate.size(), blockers, covered, width, height);
+			float area = fabsf(PolygonArea(candidate));
+			if (area < bestArea)
+			{
+				bestArea = area;
+				best = candidate;
+			}
+		}
+
+		polygon.clear();
+		for (XMFLOAT2 p : best)
+			polygon.push_back(XMFLOAT2(p.x / width, p.y / height));
+	}
+
+	// Ear clipping for small simple polygons, either winding. Appends index
+	// triples into polygon to triangles, wound like the polygon. remaining is
+	// scratch space, pass the same vector to avoid allocating on every call
+	void TriangulatePolygon(const XMFLOAT2* polygon, int count, vector<int>& triangles, vector<int>& remaining)
+	{
+		remaining.resize(count);
+		float area = 0.0f;
+		for (int i = 0; i < count; i++)
+		{
+			remaining[i] = i;
+			XMFLOAT2 a = polygon[i], b = polygon[(i + 1) % count];
+			area += a.x * b.y - a.y * b.x;
+		}
+		float orientation = area > 0.0f ? 1.0f : -1.0f;
+
+		while (remaining.size() > 3)
+		{
+			size_t n = remaining.size();
+			size_t ear = n;
+			for (size_t i = 0; i < n && ear == n; i++)
+			{
+				XMFLOAT2 a = polygon[remaining[(i + n - 1) % n]], b = polygon[remaining[i]], c = polygon[remaining[(i + 1) % n]];
+				if (Cross2D(a, b, c) * orientation <= 0.0f)
+					continue;
+				bool empty = true;
+				for (size_t j = 0; j < n && empty; j++)
+				{
+					if (j != i && j != (i + 1) % n && j != (i + n - 1) % n)
+						empty = !PointInTriangle(polygon[remaining[j]], a, b, c);
+				}
+				if (empty)
+					ear = i;
+			}
+			// degenerate input, clip anything to finish
+			if (ear == n)
+				ear = 0;
+			triangles.insert(triangles.end(), { remaining[(ear + n - 1) % n], remaining[ear], remaining[(ear + 1) % n] });
+			remaining.erase(remaining.begin() + ear);
+		}
+		triangles.insert(triangles.end(), remaining.begin(), remaining.end());
+	}
+
+	void TriangulatePolygon(const vector<XMFLOAT2>& polygon, vector<int>& triangles)
+	{
+		vector<int> remaining;
+		TriangulatePolygon(polygon.data(), (int)polygon.size(), triangles, remaining);
+	}
+
+	// Split a planar(ish) polygon of count corners into triangles, appended to
+	// triangles as corner numbers and wound like the polygon: a fan when it is
+	// convex, ear clipping in the polygon's plane otherwise. projected and
+	// remaining are scratch space reused between calls. Returns true for a fan
+	bool TriangulateFace(const XMFLOAT3* corners, int count, vector<int>& triangles,
+		vector<XMFLOAT2>& projected, vector<int>& remaining)
+	{
+		// Newell normal, robust for non-planar and concave polygons
+		XMFLOAT3 normal(0.0f, 0.0f, 0.0f);
+		for (int i = 0; i < count; i++)
+		{
+			XMFLOAT3 a = corners[i], b = corners[(i + 1) % count];
+			normal.x += (a.y - b.y) * (a.z + b.z);
+			normal.y += (a.z - b.z) * (a.x + b.x);
+			normal.z += (a.x - b.x) * (a.y + b.y);
+		}
 
-		// copy working data to the global SimpleMesh
-		simpleMesh.indicesList = indicesList;
-		simpleMesh.vertexList = compactedVertexList;
+		// convex when every corner turns the same way around the normal
+		bool convex = true;
+		for (int i = 0; i < count && convex; i++)
+		{
+			XMFLOAT3 a = corners[(i + count - 1) % count], b = corners[i], c = corners[(i + 1) % count];
+			XMFLOAT3 u(b.x - a.x, b.y - a.y, b.z - a.z), v(c.x - b.x, c.y - b.y, c.z - b.z);
+			float turn = (u.y * v.z - u.z * v.y) * normal.x + (u.z * v.x - u.x * v.z) * normal.y + (u.x * v.y - u.y * v.x) * normal.z;
+			convex = turn >= 0.0f;
+		}
+		if (convex)
+		{
+			for (int i = 1; i + 1 < count; i++)
+				triangles.insert(triangles.end(), { 0, i, i + 1 });
+			return true;
+		}
+
+		// drop the normal's largest axis, ear clipping handles either winding
+		float ax = fabsf(normal.x), ay = fabsf(normal.y), az = fabsf(normal.z);
+		projected.resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			XMFLOAT3 c = corners[i];
+			projected[i] = ax >= ay && ax >= az ? XMFLOAT2(c.y, c.z) : (ay >= az ? XMFLOAT2(c.z, c.x) : XMFLOAT2(c.x, c.y));
+		}
+		TriangulatePolygon(projected.data(), count, triangles, remaining);
+		return false;
+	}
+
+	// Replace each quad of the mesh (two triangles over four vertices whose uvs
+	// span one copy of the texture, like makeCrossHatchPNT's) with the cutout
+	// polygon from ComputeCutoutPolygon, triangulated by ear clipping.
+	// Polygon points are placed with the quad's own uv to position mapping,
+	// so the texture stays where it was.
+	// Returns false and leaves the mesh alone if it isn't made of such quads
+	bool CutoutQuads(SimpleMesh<SimpleVertex>& simpleMesh, const vector<XMFLOAT2>& polygon)
+	{
+		if (polygon.size() < 3 || simpleMesh.indicesList.size() % 6 != 0)
+			return false;
+
+		vector<SimpleVertex> vertices;
+		vector<int> indices;
+		float polygonArea = PolygonArea(polygon);
+		vector<int> triangles;
+		TriangulatePolygon(polygon, triangles);
+		for (size_t q = 0; q < simpleMesh.indicesList.size(); q += 6)
+		{
+			vector<int> corners;
+			for (size_t i = q; i < q + 6; i++)
+			{
+				if (find(corners.begin(), corners.end(), simpleMesh.indicesList[i]) == corners.end())
+					corners.push_back(simpleMesh.indicesList[i]);
+			}
+			if (corners.size() != 4)
+				return false;
+
+			float uMin = FLT_MAX, uMax = -FLT_MAX, vMin = FLT_MAX, vMax = -FLT_MAX;
+			for (int c : corners)
+			{
+				XMFLOAT2 uv = simpleMesh.vertexList[c].Tex;
+				uMin = min(uMin, uv.x), uMax = max(uMax, uv.x);
+				vMin = min(vMin, uv.y), vMax = max(vMax, uv.y);
+			}
+			if (fabsf(uMax - uMin - 1.0f) > 1e-4f || fabsf(vMax - vMin - 1.0f) > 1e-4f)
+				return false;
+
+			// corner at (s, t) in the quad's unit uv square, s and t in 0..1
+			const SimpleVertex* quad[2][2] = {};
+			for (int c : corners)
+			{
+				const SimpleVertex& vert = simpleMesh.vertexList[c];
+				quad[vert.Tex.y - vMin > 0.5f][vert.Tex.x - uMin > 0.5f] = &vert;
+			}
+			if (!quad[0][0] || !quad[0][1] || !quad[1][0] || !quad[1][1])
+				return false;
+
+			int first = (int)vertices.size();
+			for (XMFLOAT2 p : polygon)
+			{
+				auto bilerp = [&](XMFLOAT3 SimpleVertex::* member)
+				{
+					XMVECTOR top = XMVectorLerp(XMLoadFloat3(&(quad[0][0]->*member)), XMLoadFloat3(&(quad[0][1]->*member)), p.x);
+					XMVECTOR bottom = XMVectorLerp(XMLoadFloat3(&(quad[1][0]->*member)), XMLoadFloat3(&(quad[1][1]->*member)), p.x);
+					XMFLOAT3 result;
+					XMStoreFloat3(&result, XMVectorLerp(top, bottom, p.y));
+					return result;
+				};
+				// normals are interpolated as the rasterizer would, not renormalized
+				SimpleVertex vert;
+				vert.Pos = bilerp(&SimpleVertex::Pos);
+				vert.Normal = bilerp(&SimpleVertex::Normal);
+				vert.Tex = XMFLOAT2(uMin + p.x, vMin + p.y);
+				vertices.push_back(vert);
+			}
+
+			// keep the winding of the quad's first triangle, compared in uv space
+			const SimpleVertex* tri[3] = { &simpleMesh.vertexList[simpleMesh.indicesList[q]],
+				&simpleMesh.vertexList[simpleMesh.indicesList[q + 1]], &simpleMesh.vertexList[simpleMesh.indicesList[q + 2]] };
+			float quadArea = PolygonArea({ tri[0]->Tex, tri[1]->Tex, tri[2]->Tex });
+			bool reverse = (quadArea > 0.0f) != (polygonArea > 0.0f);
+			for (size_t t = 0; t < triangles.size(); t += 3)
+			{
+				indices.push_back(first + triangles[t]);
+				indices.push_back(first + triangles[t + (reverse ? 2 : 1)]);
+				indices.push_back(first + triangles[t + (reverse ? 1 : 2)]);
+			}
+		}
+
+		simpleMesh.vertexList = vertices;
+		simpleMesh.indicesList = indices;
+		simpleMesh.lods.clear();
+		simpleMesh.positionList.clear();
+		OptimizeVertexFetch(simpleMesh);
+		ComputeMeshBounds(simpleMesh);
+		return true;
 	}
 
 	// create a simple cube with normals and texture coordinates
@@ -141,6 +4171,10 @@ namespace MeshUtils
 			22,20,21,
 			23,20,22
 		};
+
+		// keep vertices in first use order for fetch locality
+		OptimizeVertexFetch(mesh);
+		ComputeMeshBounds(mesh);
 	}
 
 	// create a simple cube with normals and texture coordinates
@@ -162,6 +4196,10 @@ namespace MeshUtils
 			3,1,0,
 			2,1,3
 		};
+
+		// keep vertices in first use order for fetch locality
+		OptimizeVertexFetch(mesh);
+		ComputeMeshBounds(mesh);
 	}
 
 	// create a simple cube with normals and texture coordinates
@@ -191,6 +4229,10 @@ namespace MeshUtils
 			6,4,5,
 			7,4,6
 		};
+
+		// keep vertices in first use order for fetch locality
+		OptimizeVertexFetch(mesh);
+		ComputeMeshBounds(mesh);
 	}
 
 	// create a simple cube with normals and texture coordinates
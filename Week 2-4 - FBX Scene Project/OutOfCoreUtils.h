@@ -0,0 +1,518 @@
+#pragma once
+#include <directxmath.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include "MeshUtils.h"
+
+using namespace std;
+using namespace DirectX;
+
+// Welding for meshes whose expanded vertex array doesn't fit in memory.
+// The expanded vertices (3 per triangle, as ProcessFBXMesh builds them) are
+// read from a raw file and the welded vertices and 32-bit indices are written
+// to raw files, with every buffer sized from a memory budget. Duplicates are
+// found by external sorting instead of a hash table, and the output matches
+// MeshUtils::WeldVertices: vertices in order of first use.
+
+// Bytes held by the large buffers of an out-of-core pass
+struct MemoryTracker
+{
+	size_t used = 0;
+	size_t peak = 0;
+
+	void Add(size_t bytes)
+	{
+		used += bytes;
+		peak = max(peak, used);
+	}
+
+	void Remove(size_t bytes)
+	{
+		used -= bytes;
+	}
+};
+
+struct OutOfCoreStats
+{
+	size_t vertexCount = 0;
+	size_t uniqueCount = 0;
+	// sorted runs written, and records read/written by all the passes
+	size_t runCount = 0;
+	size_t diskBytes = 0;
+	size_t peakBytes = 0;
+	double sortMs[4] = {};
+	double totalMs = 0.0;
+};
+
+namespace OutOfCoreUtils
+{
+	// Buffered sequential reader of a raw file of Records
+	template <typename Record>
+	struct RecordReader
+	{
+		ifstream file;
+		vector<Record> buffer;
+		size_t position = 0;
+		size_t count = 0;
+		MemoryTracker* tracker = nullptr;
+		size_t* diskBytes = nullptr;
+
+		RecordReader(const string& filename, size_t bufferBytes, MemoryTracker* tracker, size_t* diskBytes = nullptr)
+			: file(filename, ios_base::binary), buffer(max(bufferBytes / sizeof(Record), (size_t)1)),
+			tracker(tracker), diskBytes(diskBytes)
+		{
+			tracker->Add(buffer.size() * sizeof(Record));
+		}
+
+		~RecordReader()
+		{
+			tracker->Remove(buffer.size() * sizeof(Record));
+		}
+
+		bool Next(Record& record)
+		{
+			if (position == count)
+			{
+				file.read((char*)buffer.data(), buffer.size() * sizeof(Record));
+				count = (size_t)file.gcount() / sizeof(Record);
+				position = 0;
+				if (diskBytes)
+					*diskBytes += count * sizeof(Record);
+				if (count == 0)
+					return false;
+			}
+			record = buffer[position++];
+			return true;
+		}
+	};
+
+	// Buffered sequential writer of a raw file of Records
+	template <typename Record>
+	struct RecordWriter
+	{
+		ofstream file;
+		vector<Record> buffer;
+		size_t count = 0;
+		size_t written = 0;
+		MemoryTracker* tracker = nullptr;
+		size_t* diskBytes = nullptr;
+
+		RecordWriter(const string& filename, size_t bufferBytes, MemoryTracker* tracker, size_t* diskBytes = nullptr)
+			: file(filename, ios_base::binary), buffer(max(bufferBytes / sizeof(Record), (size_t)1)),
+			tracker(tracker), diskBytes(diskBytes)
+		{
+			tracker->Add(buffer.size() * sizeof(Record));
+		}
+
+		~RecordWriter()
+		{
+			Flush();
+			tracker->Remove(buffer.size() * sizeof(Record));
+		}
+
+		void Write(const Record& record)
+		{
+			buffer[count++] = record;
+			written++;
+			if (count == buffer.size())
+				Flush();
+		}
+
+		void Flush()
+		{
+			file.write((const char*)buffer.data(), count * sizeof(Record));
+			if (diskBytes)
+				*diskBytes += count * sizeof(Record);
+			count = 0;
+		}
+
+		bool Good() const
+		{
+			return (bool)file;
+		}
+	};
+
+	// Temporary files, all removed when this goes out of scope so no return
+	// path leaves any behind
+	struct TempFiles
+	{
+		vector<string> paths;
+
+		~TempFiles()
+		{
+			for (const string& path : paths)
+				remove(path.c_str());
+		}
+	};
+
+	// Sort the records next() produces with about memoryBudget bytes and pass
+	// them to sink(record) in order. Sorted runs the size of the buffer go to
+	// temporary files next to tempPrefix and are merged at most fanIn at a
+	// time, the last merge feeds the sink directly (and a single run never
+	// touches the disk). Returns false when a temporary file can't be written
+	template <typename Record, typename Less>
+	bool ExternalSort(function<bool(Record&)> next, function<void(const Record&)> sink, Less less,
+		size_t memoryBudget, const string& tempPrefix, MemoryTracker& tracker, OutOfCoreStats& stats)
+	{
+		static int tempCounter = 0;
+		auto tempFilename = [&]() { return tempPrefix + "." + to_string(tempCounter++) + ".tmp"; };
+
+		// sorted runs
+		TempFiles runs;
+		bool ok = true;
+		{
+			vector<Record> buffer(max(memoryBudget / sizeof(Record), (size_t)1));
+			tracker.Add(buffer.size() * sizeof(Record));
+			bool more = true;
+			while (ok && more)
+			{
+				size_t count = 0;
+				while (count < buffer.size() && (more = next(buffer[count])))
+					count++;
+				sort(buffer.begin(), buffer.begin() + count, less);
+
+				// everything fit, no need for the disk
+				if (runs.paths.empty() && !more)
+				{
+					for (size_t i = 0; i < count; i++)
+						sink(buffer[i]);
+					tracker.Remove(buffer.size() * sizeof(Record));
+					return true;
+				}
+				if (count == 0)
+					break;
+
+				runs.paths.push_back(tempFilename());
+				ofstream file(runs.paths.back(), ios_base::binary);
+				file.write((const char*)buffer.data(), count * sizeof(Record));
+				stats.diskBytes += count * sizeof(Record);
+				ok = (bool)file;
+			}
+			stats.runCount += runs.paths.size();
+			tracker.Remove(buffer.size() * sizeof(Record));
+		}
+
+		// k-way merges, with 1MB or more of buffer per input
+		size_t fanIn = min(max(memoryBudget / 2 / (1 << 20), (size_t)2), (size_t)64);
+		while (ok && !runs.paths.empty())
+		{
+			bool last = runs.paths.size() <= fanIn;
+			size_t inputCount = min(runs.paths.size(), fanIn);
+			size_t readerBytes = memoryBudget / 2 / inputCount;
+
+			vector<unique_ptr<RecordReader<Record>>> readers;
+			for (size_t i = 0; i < inputCount; i++)
+				readers.push_back(make_unique<RecordReader<Record>>(runs.paths[i], readerBytes, &tracker, &stats.diskBytes));
+
+			string merged = last ? "" : tempFilename();
+			unique_ptr<RecordWriter<Record>> writer;
+			if (!last)
+				writer = make_unique<RecordWriter<Record>>(merged, memoryBudget / 4, &tracker, &stats.diskBytes);
+
+			// heap of the head record of each input
+			typedef pair<Record, size_t> Head;
+			auto greater = [&](const Head& a, const Head& b) { return less(b.first, a.first); };
+			priority_queue<Head, vector<Head>, decltype(greater)> heads(greater);
+			for (size_t i = 0; i < inputCount; i++)
+			{
+				Record record;
+				if (readers[i]->Next(record))
+					heads.push({ record, i });
+			}
+			while (!heads.empty())
+			{
+				Head head = heads.top();
+				heads.pop();
+				if (last)
+					sink(head.first);
+				else
+					writer->Write(head.first);
+				Record record;
+				if (readers[head.second]->Next(record))
+					heads.push({ record, head.second });
+			}
+
+			if (writer)
+			{
+				writer->Flush();
+				ok = writer->Good();
+			}
+			readers.clear();
+			writer.reset();
+			for (size_t i = 0; i < inputCount; i++)
+				remove(runs.paths[i].c_str());
+			runs.paths.erase(runs.paths.begin(), runs.paths.begin() + inputCount);
+			if (!last)
+			{
+				runs.paths.push_back(merged);
+				stats.runCount++;
+			}
+		}
+		return ok;
+	}
+
+	// An expanded vertex and where it was in the input
+	struct WeldRecord
+	{
+		SimpleVertex vertex;
+		uint32_t index;
+	};
+
+	// Pair of input positions/vertex numbers, meaning depends on the pass
+	struct IndexPair
+	{
+		uint32_t key;
+		uint32_t value;
+	};
+
+	// A distinct vertex and the first input position that used it
+	struct FirstUseRecord
+	{
+		uint32_t first;
+		SimpleVertex vertex;
+	};
+
+	// Weld the raw SimpleVertex array in expandedFile into the vertices written
+	// to vertexFile and one uint32_t index per input vertex written to
+	// indexFile, using about memoryBudget bytes of buffers. Four sorts:
+	// by vertex to find the duplicates and their first use, distinct vertices
+	// by first use to number them, and the duplicate -> first use pairs by
+	// first use then by input position to write the indices in input order
+	bool WeldOutOfCore(const string& expandedFile, const string& vertexFile, const string& indexFile,
+		size_t memoryBudget, OutOfCoreStats& stats)
+	{
+		auto totalStart = chrono::high_resolution_clock::now();
+		stats = OutOfCoreStats();
+		MemoryTracker tracker;
+		string tempPrefix = indexFile;
+		string firstUseFile = tempPrefix + ".first.tmp", duplicateFile = tempPrefix + ".duplicates.tmp";
+		string numberFile = tempPrefix + ".numbers.tmp", remapFile = tempPrefix + ".remap.tmp";
+
+		// a sixteenth of the budget for each file streamed alongside a sort
+		size_t streamBytes = memoryBudget / 16;
+		// and half of it for the sort buffer
+		size_t sortBytes = memoryBudget / 2;
+		bool ok = true;
+
+		// 1. sort by vertex; the first record of each run of equal vertices
+		// has the lowest input position, that is the vertex's first use
+		{
+			auto start = chrono::high_resolution_clock::now();
+			RecordReader<SimpleVertex> input(expandedFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordWriter<FirstUseRecord> firstUses(firstUseFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordWriter<IndexPair> duplicates(duplicateFile, streamBytes, &tracker, &stats.diskBytes);
+
+			function<bool(WeldRecord&)> next = [&](WeldRecord& record)
+			{
+				if (!input.Next(record.vertex))
+					return false;
+				// fold -0.0f into 0.0f so equal vertices have equal bits, like HashVertex
+				float* fields = (float*)&record.vertex;
+				for (size_t i = 0; i < sizeof(SimpleVertex) / sizeof(float); i++)
+					fields[i] = fields[i] == 0.0f ? 0.0f : fields[i];
+				record.index = (uint32_t)stats.vertexCount++;
+				return stats.vertexCount <= UINT32_MAX;
+			};
+			bool first = true;
+			FirstUseRecord current;
+			function<void(const WeldRecord&)> sink = [&](const WeldRecord& record)
+			{
+				if (first || memcmp(&record.vertex, &current.vertex, sizeof(SimpleVertex)) != 0)
+				{
+					current.first = record.index;
+					current.vertex = record.vertex;
+					firstUses.Write(current);
+					first = false;
+				}
+				duplicates.Write({ current.first, record.index });
+			};
+			auto less = [](const WeldRecord& a, const WeldRecord& b)
+			{
+				int order = memcmp(&a.vertex, &b.vertex, sizeof(SimpleVertex));
+				return order < 0 || (order == 0 && a.index < b.index);
+			};
+			ok = ExternalSort<WeldRecord>(next, sink, less, sortBytes, tempPrefix, tracker, stats);
+			firstUses.Flush();
+			duplicates.Flush();
+			ok = ok && firstUses.Good() && duplicates.Good();
+			stats.uniqueCount = firstUses.written;
+			stats.sortMs[0] = MeshUtils::ElapsedMs(start);
+		}
+
+		// 2. number the distinct vertices in order of first use
+		if (ok)
+		{
+			auto start = chrono::high_resolution_clock::now();
+			RecordReader<FirstUseRecord> firstUses(firstUseFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordWriter<SimpleVertex> vertices(vertexFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordWriter<IndexPair> numbers(numberFile, streamBytes, &tracker, &stats.diskBytes);
+
+			function<bool(FirstUseRecord&)> next = [&](FirstUseRecord& record) { return firstUses.Next(record); };
+			function<void(const FirstUseRecord&)> sink = [&](const FirstUseRecord& record)
+			{
+				numbers.Write({ record.first, (uint32_t)vertices.written });
+				vertices.Write(record.vertex);
+			};
+			auto less = [](const FirstUseRecord& a, const FirstUseRecord& b) { return a.first < b.first; };
+			ok = ExternalSort<FirstUseRecord>(next, sink, less, sortBytes, tempPrefix, tracker, stats) && vertices.Good();
+			stats.sortMs[1] = MeshUtils::ElapsedMs(start);
+		}
+		remove(firstUseFile.c_str());
+
+		// 3. sort the (first use, input position) pairs by first use and join
+		// them with the vertex numbers, which are in first use order already
+		if (ok)
+		{
+			auto start = chrono::high_resolution_clock::now();
+			RecordReader<IndexPair> duplicates(duplicateFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordReader<IndexPair> numbers(numberFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordWriter<IndexPair> remap(remapFile, streamBytes, &tracker, &stats.diskBytes);
+
+			IndexPair number = { 0, 0 };
+			bool haveNumber = numbers.Next(number);
+			function<bool(IndexPair&)> next = [&](IndexPair& record) { return duplicates.Next(record); };
+			function<void(const IndexPair&)> sink = [&](const IndexPair& record)
+			{
+				while (haveNumber && number.key < record.key)
+					haveNumber = numbers.Next(number);
+				remap.Write({ record.value, number.value });
+			};
+			auto less = [](const IndexPair& a, const IndexPair& b) { return a.key < b.key || (a.key == b.key && a.value < b.value); };
+			ok = ExternalSort<IndexPair>(next, sink, less, sortBytes, tempPrefix, tracker, stats) && remap.Good();
+			stats.sortMs[2] = MeshUtils::ElapsedMs(start);
+		}
+		remove(duplicateFile.c_str());
+		remove(numberFile.c_str());
+
+		// 4. back to input order, written out as the index buffer
+		if (ok)
+		{
+			auto start = chrono::high_resolution_clock::now();
+			RecordReader<IndexPair> remap(remapFile, streamBytes, &tracker, &stats.diskBytes);
+			RecordWriter<uint32_t> indices(indexFile, streamBytes, &tracker, &stats.diskBytes);
+
+			function<bool(IndexPair&)> next = [&](IndexPair& record) { return remap.Next(record); };
+			function<void(const IndexPair&)> sink = [&](const IndexPair& record) { indices.Write(record.value); };
+			auto less = [](const IndexPair& a, const IndexPair& b) { return a.key < b.key; };
+			ok = ExternalSort<IndexPair>(next, sink, less, sortBytes, tempPrefix, tracker, stats) && indices.Good();
+			stats.sortMs[3] = MeshUtils::ElapsedMs(start);
+		}
+		remove(remapFile.c_str());
+
+		stats.peakBytes = tracker.peak;
+		stats.totalMs = MeshUtils::ElapsedMs(totalStart);
+		return ok && stats.vertexCount <= UINT32_MAX;
+	}
+
+	// Write a gridSize x gridSize quad height field as an expanded vertex
+	// file (6 vertices per quad), streamed one row of quads at a time.
+	// Neighbouring quads compute their shared corners identically, so the
+	// weld gets it back to (gridSize + 1)^2 vertices
+	bool WriteSyntheticMesh(const string& filename, int gridSize)
+	{
+		MemoryTracker tracker;
+		RecordWriter<SimpleVertex> output(filename, 1 << 20, &tracker);
+		auto corner = [&](int x, int z)
+		{
+			float fx = (float)x / gridSize, fz = (float)z / gridSize;
+			float frequency = 40.0f, amplitude = 0.02f;
+			SimpleVertex vert;
+			vert.Pos = XMFLOAT3(fx, amplitude * sinf(fx * frequency) * cosf(fz * frequency), fz);
+			// normal of the height field: (-dh/dx, 1, -dh/dz)
+			float dx = amplitude * frequency * cosf(fx * frequency) * cosf(fz * frequency);
+			float dz = -amplitude * frequency * sinf(fx * frequency) * sinf(fz * frequency);
+			float length = sqrtf(dx * dx + 1.0f + dz * dz);
+			vert.Normal = XMFLOAT3(-dx / length, 1.0f / length, -dz / length);
+			vert.Tex = XMFLOAT2(fx, 1.0f - fz);
+			return vert;
+		};
+		for (int z = 0; z < gridSize; z++)
+		{
+			for (int x = 0; x < gridSize; x++)
+			{
+				SimpleVertex a = corner(x, z), b = corner(x + 1, z), c = corner(x, z + 1), d = corner(x + 1, z + 1);
+				output.Write(a);
+				output.Write(c);
+				output.Write(b);
+				output.Write(b);
+				output.Write(c);
+				output.Write(d);
+			}
+		}
+		output.Flush();
+		return output.Good();
+	}
+
+	// Weld a synthetic height field of about triangleCount triangles through
+	// files in directory with the given memory budget, report the time and
+	// disk traffic of each pass and spot check the result against the input
+	void BenchmarkOutOfCore(const string& directory, size_t triangleCount = 50000000, size_t memoryBudget = 256 << 20)
+	{
+		int gridSize = (int)sqrt(triangleCount / 2.0);
+		string expandedFile = directory + "synthetic_expanded.bin";
+		string vertexFile = directory + "synthetic_vertices.bin";
+		string indexFile = directory + "synthetic_indices.bin";
+
+		cout << "\n\n==== out-of-core weld, " << (size_t)gridSize * gridSize * 2 << " triangles, "
+			<< (memoryBudget >> 20) << " MB budget ====" << endl;
+
+		auto start = chrono::high_resolution_clock::now();
+		if (!WriteSyntheticMesh(expandedFile, gridSize))
+		{
+			cout << "could not write " << expandedFile << endl;
+			return;
+		}
+		size_t expandedBytes = (size_t)gridSize * gridSize * 6 * sizeof(SimpleVertex);
+		cout << "  generated " << (expandedBytes >> 20) << " MB in " << MeshUtils::ElapsedMs(start) << " ms" << endl;
+
+		OutOfCoreStats stats;
+		bool ok = WeldOutOfCore(expandedFile, vertexFile, indexFile, memoryBudget, stats);
+		cout << "  " << stats.vertexCount << " -> " << stats.uniqueCount << " vertices (expected "
+			<< (size_t)(gridSize + 1) * (gridSize + 1) << ")" << endl;
+		cout << "  sort by vertex: " << stats.sortMs[0] << " ms, number: " << stats.sortMs[1] << " ms, join: "
+			<< stats.sortMs[2] << " ms, reorder: " << stats.sortMs[3] << " ms" << endl;
+		cout << "  total " << stats.totalMs << " ms (" << expandedBytes / 1048576.0 / (stats.totalMs / 1000.0) << " MB/s of input), "
+			<< stats.runCount << " runs, " << (stats.diskBytes >> 20) << " MB of disk traffic" << endl;
+		cout << "  peak buffer memory " << stats.peakBytes / 1048576.0 << " MB, in memory weld would need at least "
+			<< stats.vertexCount * (sizeof(SimpleVertex) + 2 * sizeof(int)) / 1048576.0 << " MB" << endl;
+
+		// spot check: the welded vertex of sampled input positions must equal the input vertex
+		size_t samples = 0, mismatches = 0;
+		if (ok)
+		{
+			ifstream expanded(expandedFile, ios_base::binary), vertices(vertexFile, ios_base::binary), indices(indexFile, ios_base::binary);
+			size_t step = max(stats.vertexCount / 100000, (size_t)1);
+			for (size_t i = 0; i < stats.vertexCount; i += step, samples++)
+			{
+				SimpleVertex input, welded;
+				uint32_t index = 0;
+				expanded.seekg(i * sizeof(SimpleVertex));
+				expanded.read((char*)&input, sizeof(input));
+				indices.seekg(i * sizeof(uint32_t));
+				indices.read((char*)&index, sizeof(index));
+				vertices.seekg((size_t)index * sizeof(SimpleVertex));
+				vertices.read((char*)&welded, sizeof(welded));
+				bool equal = input.Pos.x == welded.Pos.x && input.Pos.y == welded.Pos.y && input.Pos.z == welded.Pos.z &&
+					input.Normal.x == welded.Normal.x && input.Normal.y == welded.Normal.y && input.Normal.z == welded.Normal.z &&
+					input.Tex.x == welded.Tex.x && input.Tex.y == welded.Tex.y;
+				mismatches += !equal || index >= stats.uniqueCount;
+			}
+		}
+		cout << "  output " << (ok && mismatches == 0 ? "matches" : "MISMATCH") << " the input at " << samples << " sampled vertices" << endl;
+
+		remove(expandedFile.c_str());
+		remove(vertexFile.c_str());
+		remove(indexFile.c_str());
+	}
+}
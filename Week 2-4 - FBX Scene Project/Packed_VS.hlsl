@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------------
+// File: Packed_VS.hlsl
+//
+// Tutorial06_VS for quantized (PackedVertex) meshes
+//--------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffer Variables
+//--------------------------------------------------------------------------------------
+
+cbuffer ConstantBufferTransforms : register(b0)
+{
+    matrix World;
+    matrix View;
+    matrix Projection;
+    float4 PositionScale;
+    float4 PositionOffset;
+}
+
+//--------------------------------------------------------------------------------------
+struct VS_INPUT
+{
+    float4 Pos : POSITION;  // unorm16 inside the mesh bounds
+    float2 Norm : NORMAL;   // octahedral snorm16
+    float2 Tex : TEXCOORD0; // half float
+};
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float3 Norm : NORMAL;
+    float2 Tex : TEXCOORD1;
+};
+
+// Inverse of MeshUtils::OctEncode
+float3 OctDecode(float2 e)
+{
+    float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex Shader
+//--------------------------------------------------------------------------------------
+PS_INPUT VS(VS_INPUT input)
+{
+    PS_INPUT output = (PS_INPUT) 0;
+    float4 pos = float4(PositionOffset.xyz + input.Pos.xyz * PositionScale.xyz, 1.0f);
+    output.Pos = mul(pos, World);
+    output.Pos = mul(output.Pos, View);
+    output.Pos = mul(output.Pos, Projection);
+    output.Norm = mul(OctDecode(input.Norm), (float3x3) World);
+    output.Tex = input.Tex;
+    return output;
+}
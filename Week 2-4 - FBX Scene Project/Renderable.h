@@ -5,7 +5,9 @@
 #include <wrl/client.h>
 #include <fstream>
 #include <vector>
+#include <array>
 #include "DDSTextureLoader.h"
+#include "MeshUtils.h"
 
 using namespace DirectX;
 using namespace std;
@@ -24,6 +26,19 @@ struct TransformsConstantBuffer
 	XMMATRIX mWorld;
 	XMMATRIX mView;
 	XMMATRIX mProjection;
+	// dequantization of packed positions (see Packed_VS.hlsl)
+	XMFLOAT4 vPositionScale = { 1.0f, 1.0f, 1.0f, 0.0f };
+	XMFLOAT4 vPositionOffset = { 0.0f, 0.0f, 0.0f, 0.0f };
+};
+
+// Impostor_VS.hlsl constants
+struct ImpostorConstantBuffer
+{
+	XMMATRIX mWorld;
+	XMMATRIX mView;
+	XMMATRIX mProjection;
+	// uv offset (xy) and scale (zw) of the atlas frame to draw
+	XMFLOAT4 vAtlasFrame;
 };
 
 std::vector<uint8_t> load_binary_blob(const char* path)
@@ -46,6 +61,45 @@ std::vector<uint8_t> load_binary_blob(const char* path)
 	return blob;
 }
 
+constexpr DXGI_FORMAT VertexElementFormat(VertexElementType type)
+{
+	return type == VertexElementType::Float2 ? DXGI_FORMAT_R32G32_FLOAT :
+		type == VertexElementType::Float3 ? DXGI_FORMAT_R32G32B32_FLOAT :
+		type == VertexElementType::Float4 ? DXGI_FORMAT_R32G32B32A32_FLOAT :
+		type == VertexElementType::UNorm16x4 ? DXGI_FORMAT_R16G16B16A16_UNORM :
+		type == VertexElementType::SNorm16x2 ? DXGI_FORMAT_R16G16_SNORM :
+		DXGI_FORMAT_R16G16_FLOAT;
+}
+
+// D3D11 input layout of vertex type T read from the given input slot,
+// built from its VertexFormat
+template <typename T>
+constexpr std::array<D3D11_INPUT_ELEMENT_DESC, VertexElementCount<T>> InputLayout(UINT slot = 0)
+{
+	std::array<D3D11_INPUT_ELEMENT_DESC, VertexElementCount<T>> layout = {};
+	for (size_t i = 0; i < VertexElementCount<T>; i++)
+	{
+		const VertexElement& element = VertexFormat<T>::elements[i];
+		layout[i] = { element.semantic, element.semanticIndex, VertexElementFormat(element.type),
+			slot, element.offset, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+	}
+	return layout;
+}
+
+// One DrawIndexed call into a Renderable's index/vertex buffers
+struct DrawRange
+{
+	UINT indexStart = 0;
+	UINT indexCount = 0;
+	INT baseVertex = 0;
+	// texture of the submesh drawn, index into materialResourceViews,
+	// -1 for the renderable's own resourceView
+	int material = -1;
+};
+
+// Largest vertex count addressable with 16-bit indices
+const int maxVertices16 = 65535;
+
 class Renderable
 {
 public:
@@ -57,8 +111,30 @@ public:
 	UINT vertexSize = 0;
 	ComPtr<ID3D11Buffer> indexBuffer = nullptr;
 	int indexCount = 0;
+	DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
+	// the index buffer is drawn as one or more ranges
+	vector<DrawRange> drawRanges;
+	// draw ranges and error of each level of detail, empty without LODs.
+	// SelectLOD copies one of them into drawRanges
+	vector<vector<DrawRange>> lodDrawRanges;
+	vector<float> lodErrors;
+	// back to front orders of the full detail triangles and the (mesh space)
+	// view direction each was sorted for, empty without view orders.
+	// SelectViewOrder copies one of them into drawRanges
+	vector<vector<DrawRange>> viewOrderDrawRanges;
+	vector<XMFLOAT3> viewOrderDirections;
 	D3D11_PRIMITIVE_TOPOLOGY primitiveTopology =
 		D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	// optional tightly packed position stream, bound to slot 1 next to the
+	// vertex buffer in slot 0, and what position only passes draw with
+	ComPtr<ID3D11Buffer> positionBuffer = nullptr;
+	ComPtr<ID3D11InputLayout> positionInputLayout = nullptr;
+	ComPtr<ID3D11VertexShader> positionVertexShader = nullptr;
+	// mesh space bounds, see GetWorldBounds
+	MeshBounds bounds;
+	// maps quantized positions back to mesh space, identity for float vertices
+	XMFLOAT4 positionScale = { 1.0f, 1.0f, 1.0f, 0.0f };
+	XMFLOAT4 positionOffset = { 0.0f, 0.0f, 0.0f, 0.0f };
 
 	// Shader obejcts
 	ComPtr<ID3D11InputLayout> inputLayout = nullptr;
@@ -69,8 +145,23 @@ public:
 
 	// Shader Resources (Texture)
 	ComPtr<ID3D11ShaderResourceView> resourceView = nullptr;
+	// optional second texture in t1, e.g. the normal atlas of an impostor
+	ComPtr<ID3D11ShaderResourceView> normalResourceView = nullptr;
+	// multi-material meshes: the texture of each material, bound in t0
+	// between the draw ranges of different submeshes
+	vector<ComPtr<ID3D11ShaderResourceView>> materialResourceViews;
 	ComPtr<ID3D11SamplerState> samplerState = nullptr;
 
+	// set per frame when the mesh is far enough to draw its impostor instead
+	bool replacedByImpostor = false;
+
+	// never moves after creation, so it may be merged into a static batch
+	bool isStatic = false;
+	// merged into a static batch, which draws it instead
+	bool batched = false;
+	// for static batches: the merged meshes, bounds in world space
+	vector<MeshUtils::BatchSubmesh> batchSubmeshes;
+
 	void setPosition(XMVECTOR posIn)
 	{
 		world.r[3] = posIn;
@@ -93,37 +184,428 @@ public:
 		world = tmpWorld;
 	}
 
+	// Creates 16-bit indices whenever possible. Meshes with more than
+	// maxVertices16 vertices are split into 16-bit addressable submeshes,
+	// each drawn as its own range with a base vertex, and the levels share
+	// one split and so one vertex buffer.
+	// lods optionally describes the levels of detail stored in indices.
+	// sourceVertices, when given, receives the original vertex of each
+	// buffer vertex if the mesh had to be split (and is left empty otherwise)
 	HRESULT CreateBuffers(ID3D11Device* device, vector<int>& indices,
-		float* vertices, int vSize, int vCount)
+		float* vertices, int vSize, int vCount, const vector<MeshLOD>& lods = vector<MeshLOD>(),
+		vector<int>* sourceVertices = nullptr)
 	{
 		HRESULT hr = S_OK;
 
+		lodDrawRanges.clear();
+		lodErrors.clear();
+		if (sourceVertices)
+			sourceVertices->clear();
+
+		if (vCount > maxVertices16)
+		{
+			vector<MeshLOD> levels = lods;
+			if (levels.empty())
+				levels.push_back({ 0, (int)indices.size(), 0.0f });
+
+			vector<uint16_t> splitIndices;
+			vector<uint8_t> splitVertices;
+			vector<vector<DrawRange>> levelRanges;
+			SplitFor16BitIndices(indices.data(), levels, (const uint8_t*)vertices, vSize, vCount,
+				splitIndices, splitVertices, levelRanges, sourceVertices);
+			for (size_t l = 0; l < lods.size(); l++)
+			{
+				lodDrawRanges.push_back(levelRanges[l]);
+				lodErrors.push_back(lods[l].error);
+			}
+
+			hr = CreateIndexBuffer(device, splitIndices);
+			if (FAILED(hr))
+				return hr;
+			drawRanges = levelRanges[0];
+
+			return CreateVertexBuffer(device, (float*)splitVertices.data(), vSize,
+				(int)(splitVertices.size() / vSize));
+		}
+
 		hr = CreateIndexBuffer(device, indices);
 		if (FAILED(hr))
 			return hr;
 
+		for (const MeshLOD& lod : lods)
+		{
+			lodDrawRanges.push_back({ { (UINT)lod.indexStart, (UINT)lod.indexCount, 0 } });
+			lodErrors.push_back(lod.error);
+		}
+		if (!lods.empty())
+			drawRanges = lodDrawRanges[0];
+
 		hr = CreateVertexBuffer(device, vertices, vSize, vCount);
 		return hr;
 	}
 
+	// Create the buffers for a whole mesh, including its position stream
+	// when the mesh has one, and keep its bounds
+	template <typename T>
+	HRESULT CreateBuffers(ID3D11Device* device, SimpleMesh<T>& mesh)
+	{
+		bounds = mesh.bounds;
+
+		// every level (the LODs, then the view orders) goes in as one range
+		// per run of triangles with the same material, so each part is drawn
+		// with its own texture. The ranges are split for 16-bit indices like
+		// extra levels, then joined back into their level below
+		vector<MeshLOD> levels = mesh.lods;
+		if (levels.empty() && (!mesh.viewOrders.empty() || mesh.submeshes.size() > 1))
+		{
+			int fullCount = mesh.viewOrders.empty() ? (int)mesh.indicesList.size() : mesh.viewOrders[0].indexCount;
+			levels.push_back({ 0, fullCount, 0.0f });
+		}
+		size_t lodCount = levels.size();
+		for (const ViewOrder& viewOrder : mesh.viewOrders)
+			levels.push_back({ viewOrder.indexStart, viewOrder.indexCount, 0.0f });
+
+		// a triangle's material is that of the submesh owning its vertices
+		vector<int> vertexSubmesh = MeshUtils::VertexSubmeshes(mesh);
+
+		vector<MeshLOD> ranges;
+		vector<int> rangeLevels, rangeMaterials;
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			// an empty level still gets its (empty) range
+			const MeshLOD& level = levels[l];
+			ranges.push_back({ level.indexStart, 0, level.error });
+			rangeLevels.push_back((int)l);
+			rangeMaterials.push_back(-1);
+			for (int i = level.indexStart; i < level.indexStart + level.indexCount; i += 3)
+			{
+				int material = vertexSubmesh.empty() ? -1 : mesh.submeshes[vertexSubmesh[mesh.indicesList[i]]].material;
+				if (ranges.back().indexCount == 0)
+				{
+					rangeMaterials.back() = material;
+				}
+				else if (material != rangeMaterials.back())
+				{
+					ranges.push_back({ i, 0, level.error });
+					rangeLevels.push_back((int)l);
+					rangeMaterials.push_back(material);
+				}
+				ranges.back().indexCount += 3;
+			}
+		}
+
+		vector<int> sourceVertices;
+		HRESULT hr = CreateBuffers(device, mesh.indicesList, (float*)mesh.vertexList.data(), sizeof(T),
+			(int)mesh.vertexList.size(), ranges, &sourceVertices);
+		if (FAILED(hr))
+			return hr;
+
+		vector<vector<DrawRange>> levelRanges(levels.size());
+		for (size_t r = 0; r < ranges.size(); r++)
+		{
+			for (DrawRange range : lodDrawRanges[r])
+			{
+				range.material = rangeMaterials[r];
+				levelRanges[rangeLevels[r]].push_back(range);
+			}
+		}
+		lodDrawRanges.assign(levelRanges.begin(), levelRanges.begin() + lodCount);
+		viewOrderDrawRanges.assign(levelRanges.begin() + lodCount, levelRanges.end());
+		lodErrors.clear();
+		for (size_t l = 0; l < lodCount; l++)
+			lodErrors.push_back(levels[l].error);
+		if (!lodDrawRanges.empty())
+			drawRanges = lodDrawRanges[0];
+		viewOrderDirections.clear();
+		for (const ViewOrder& viewOrder : mesh.viewOrders)
+			viewOrderDirections.push_back(viewOrder.direction);
+
+		if (mesh.positionList.empty())
+			return hr;
+
+		if (sourceVertices.empty())
+			return CreatePositionBuffer(device, mesh.positionList.data(), (int)mesh.positionList.size());
+
+		// follow the vertex duplication of the 16-bit split
+		vector<XMFLOAT3> positions(sourceVertices.size());
+		for (size_t v = 0; v < sourceVertices.size(); v++)
+			positions[v] = mesh.positionList[sourceVertices[v]];
+		return CreatePositionBuffer(device, positions.data(), (int)positions.size());
+	}
+
+	HRESULT CreatePositionBuffer(ID3D11Device* device, const XMFLOAT3* positions, int count)
+	{
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_DEFAULT;
+		bd.ByteWidth = sizeof(XMFLOAT3) * count;
+		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		bd.CPUAccessFlags = 0;
+
+		D3D11_SUBRESOURCE_DATA InitData = {};
+		InitData.pSysMem = positions;
+		return device->CreateBuffer(&bd, &InitData,
+			positionBuffer.ReleaseAndGetAddressOf());
+	}
+
+	// Vertex shader and input layout used by BindPositionsOnly, the shader
+	// gets only POSITION, read from the position stream in slot 1
+	HRESULT CreatePositionShaderFromFile(ID3D11Device* device, const char* filename)
+	{
+		HRESULT hr = S_OK;
+
+		auto vs_blob = load_binary_blob(filename);
+
+		hr = device->CreateVertexShader(vs_blob.data(), vs_blob.size(), nullptr,
+			positionVertexShader.ReleaseAndGetAddressOf());
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+
+		auto layout = InputLayout<XMFLOAT3>(1);
+		hr = device->CreateInputLayout(layout.data(), (UINT)layout.size(), vs_blob.data(),
+			vs_blob.size(),
+			positionInputLayout.ReleaseAndGetAddressOf());
+		return hr;
+	}
+
+	MeshBounds GetWorldBounds() const
+	{
+		return MeshUtils::TransformBounds(bounds, world);
+	}
+
+	// Pick the coarsest level of detail whose error, projected to the screen,
+	// stays below pixelThreshold pixels. projectionScale is the viewport height
+	// over 2 * tan(fovY / 2). Returns the selected level
+	int SelectLOD(FXMVECTOR eye, float projectionScale, float pixelThreshold = 1.0f)
+	{
+		if (lodDrawRanges.empty())
+			return 0;
+
+		// errors are in mesh units, scale them like the world matrix does
+		float worldScale = max(max(XMVectorGetX(XMVector3Length(world.r[0])),
+			XMVectorGetX(XMVector3Length(world.r[1]))), XMVectorGetX(XMVector3Length(world.r[2])));
+		// distance to the bounding sphere when there is one, else to the origin
+		float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(world.r[3], eye)));
+		if (bounds.valid)
+		{
+			MeshBounds worldBounds = GetWorldBounds();
+			distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&worldBounds.sphereCenter), eye))) - worldBounds.sphereRadius;
+		}
+		distance = max(distance, 0.001f);
+
+		int lod = 0;
+		for (int i = 1; i < (int)lodDrawRanges.size(); i++)
+		{
+			if (lodErrors[i] * worldScale / distance * projectionScale > pixelThreshold)
+				break;
+			lod = i;
+		}
+
+		drawRanges = lodDrawRanges[lod];
+		return lod;
+	}
+
+	// Pick the view order sorted for the direction closest to the one from
+	// the eye to the mesh. Returns the selected order, -1 without view orders
+	int SelectViewOrder(FXMVECTOR eye)
+	{
+		if (viewOrderDrawRanges.empty())
+			return -1;
+
+		XMVECTOR center = world.r[3];
+		if (bounds.valid)
+			center = XMLoadFloat3(&GetWorldBounds().sphereCenter);
+		XMVECTOR viewDirection = XMVectorSubtract(center, eye);
+		// to mesh space: the depth of a mesh point p along the world direction
+		// is p * world . d, so the mesh space direction is world * d
+		viewDirection = XMVector3Normalize(XMVector3TransformNormal(viewDirection, XMMatrixTranspose(world)));
+
+		int best = 0;
+		float bestDot = -FLT_MAX;
+		for (int i = 0; i < (int)viewOrderDirections.size(); i++)
+		{
+			float dot = XMVectorGetX(XMVector3Dot(viewDirection, XMLoadFloat3(&viewOrderDirections[i])));
+			if (dot > bestDot)
+			{
+				bestDot = dot;
+				best = i;
+			}
+		}
+
+		drawRanges = viewOrderDrawRanges[best];
+		return best;
+	}
+
+	// Static batches only: draw the submeshes visible(bounds) accepts,
+	// joining neighbouring ones into one range. Returns the number drawn
+	template <typename Visible>
+	int SelectBatchRanges(Visible visible)
+	{
+		drawRanges.clear();
+		int count = 0;
+		for (const MeshUtils::BatchSubmesh& submesh : batchSubmeshes)
+		{
+			if (!visible(submesh.bounds))
+				continue;
+			count++;
+			if (!drawRanges.empty() && drawRanges.back().indexStart + drawRanges.back().indexCount == (UINT)submesh.indexStart)
+				drawRanges.back().indexCount += submesh.indexCount;
+			else
+				drawRanges.push_back({ (UINT)submesh.indexStart, (UINT)submesh.indexCount, 0 });
+		}
+		return count;
+	}
+
+	// Uses 16-bit indices when every index fits, 32-bit otherwise
 	HRESULT CreateIndexBuffer(ID3D11Device* device, vector<int>& indices)
+	{
+		int maxIndex = 0;
+		for (int index : indices)
+			maxIndex = max(maxIndex, index);
+
+		if (maxIndex < maxVertices16)
+		{
+			vector<uint16_t> indices16(indices.begin(), indices.end());
+			return CreateIndexBuffer(device, indices16);
+		}
+
+		indexFormat = DXGI_FORMAT_R32_UINT;
+		return CreateIndexBuffer(device, indices.data(), sizeof(int), (int)indices.size());
+	}
+
+	HRESULT CreateIndexBuffer(ID3D11Device* device, const vector<uint16_t>& indices)
+	{
+		indexFormat = DXGI_FORMAT_R16_UINT;
+		return CreateIndexBuffer(device, indices.data(), sizeof(uint16_t), (int)indices.size());
+	}
+
+	HRESULT CreateIndexBuffer(ID3D11Device* device, const void* indices, UINT indexSize, int count)
 	{
 		HRESULT hr = S_OK;
 
-		indexCount = (int)indices.size();
+		indexCount = count;
+		drawRanges = { { 0, (UINT)indexCount, 0 } };
 		D3D11_BUFFER_DESC bd = {};
 		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(int) * indexCount;
+		bd.ByteWidth = indexSize * indexCount;
 		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
 		bd.CPUAccessFlags = 0;
 
 		D3D11_SUBRESOURCE_DATA InitData = {};
-		InitData.pSysMem = indices.data();
+		InitData.pSysMem = indices;
 		hr = device->CreateBuffer(&bd, &InitData,
 			indexBuffer.ReleaseAndGetAddressOf());
 		return hr;
 	}
 
+	// Walk the triangles of each level, starting a new submesh whenever the
+	// next triangle would take the current one past maxVertices16 vertices.
+	// The levels share the submeshes: a triangle whose vertices are all in
+	// an earlier submesh is drawn from it, the others add their vertices to
+	// the newest one. Vertices are only duplicated where submeshes meet.
+	// Each level gets one range per submesh it draws from, its triangles
+	// grouped by submesh in their original order
+	static void SplitFor16BitIndices(const int* indices, const vector<MeshLOD>& levels,
+		const uint8_t* vertices, int vSize, int vCount,
+		vector<uint16_t>& outIndices, vector<uint8_t>& outVertices,
+		vector<vector<DrawRange>>& levelRanges, vector<int>* sourceVertices = nullptr)
+	{
+		// the submeshes each vertex is in, as a list per vertex
+		struct SplitVertex
+		{
+			int submesh;
+			int localIndex;
+			int next;
+		};
+		vector<int> firstSplit(vCount, -1);
+		vector<SplitVertex> splits;
+		auto localIndex = [&](int v, int submesh)
+		{
+			for (int e = firstSplit[v]; e >= 0; e = splits[e].next)
+			{
+				if (splits[e].submesh == submesh)
+					return splits[e].localIndex;
+			}
+			return -1;
+		};
+
+		vector<INT> baseVertices;
+		int usedVertices = 0;
+		// the current level's indices in each submesh
+		vector<vector<uint16_t>> submeshIndices;
+
+		levelRanges.assign(levels.size(), vector<DrawRange>());
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			const int* levelIndices = indices + levels[l].indexStart;
+			for (vector<uint16_t>& list : submeshIndices)
+				list.clear();
+
+			for (int i = 0; i + 2 < levels[l].indexCount; i += 3)
+			{
+				const int* tri = levelIndices + i;
+				int submesh = -1;
+				for (int e = firstSplit[tri[0]]; e >= 0 && submesh < 0; e = splits[e].next)
+				{
+					if (localIndex(tri[1], splits[e].submesh) >= 0 && localIndex(tri[2], splits[e].submesh) >= 0)
+						submesh = splits[e].submesh;
+				}
+
+				if (submesh < 0)
+				{
+					submesh = (int)baseVertices.size() - 1;
+					int newVertices = 0;
+					for (int k = 0; k < 3; k++)
+					{
+						bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+						newVertices += !repeated && (submesh < 0 || localIndex(tri[k], submesh) < 0);
+					}
+
+					// close the current submesh
+					if (submesh < 0 || usedVertices + newVertices > maxVertices16)
+					{
+						baseVertices.push_back((INT)(outVertices.size() / vSize));
+						submeshIndices.push_back(vector<uint16_t>());
+						submesh++;
+						usedVertices = 0;
+					}
+
+					for (int k = 0; k < 3; k++)
+					{
+						int v = tri[k];
+						if (localIndex(v, submesh) >= 0)
+							continue;
+						splits.push_back({ submesh, usedVertices++, firstSplit[v] });
+						firstSplit[v] = (int)splits.size() - 1;
+						outVertices.insert(outVertices.end(), vertices + (size_t)v * vSize,
+							vertices + (size_t)(v + 1) * vSize);
+						if (sourceVertices)
+							sourceVertices->push_back(v);
+					}
+				}
+
+				for (int k = 0; k < 3; k++)
+					submeshIndices[submesh].push_back((uint16_t)localIndex(tri[k], submesh));
+			}
+
+			for (size_t m = 0; m < submeshIndices.size(); m++)
+			{
+				if (submeshIndices[m].empty())
+					continue;
+				DrawRange range;
+				range.indexStart = (UINT)outIndices.size();
+				range.indexCount = (UINT)submeshIndices[m].size();
+				range.baseVertex = baseVertices[m];
+				levelRanges[l].push_back(range);
+				outIndices.insert(outIndices.end(), submeshIndices[m].begin(), submeshIndices[m].end());
+			}
+			// an empty level still gets its (empty) range
+			if (levelRanges[l].empty())
+				levelRanges[l].push_back({ (UINT)outIndices.size(), 0, 0 });
+		}
+	}
+
 	HRESULT CreateVertexBuffer(ID3D11Device* device, float* vertices, int size, int count)
 	{
 		HRESULT hr = S_OK;
@@ -166,6 +648,14 @@ public:
 		return hr;
 	}
 
+	// Same, with the input layout generated from vertex type T
+	template <typename T>
+	HRESULT CreateVertexShaderAndInputLayoutFromFile(ID3D11Device* device, const char* filename)
+	{
+		auto layout = InputLayout<T>();
+		return CreateVertexShaderAndInputLayoutFromFile(device, filename, layout.data(), (UINT)layout.size());
+	}
+
 	HRESULT CreatePixelShaderFromFile(ID3D11Device* device, const char* filename)
 	{
 		HRESULT hr = S_OK;
@@ -212,6 +702,33 @@ public:
 		return hr;
 	}
 
+	// Load the texture of every material, directory is prepended to the
+	// filenames. Returns the last failure, its material falls back to
+	// resourceView
+	HRESULT CreateMaterialTexturesFromFiles(ID3D11Device* device, const std::string& directory, const vector<std::string>& materials)
+	{
+		HRESULT hr = S_OK;
+
+		materialResourceViews.assign(materials.size(), nullptr);
+		for (size_t i = 0; i < materials.size(); i++)
+		{
+			std::string filename = directory + materials[i];
+			std::wstring widestr = std::wstring(filename.begin(), filename.end());
+			HRESULT result = CreateDDSTextureFromFile(device, widestr.c_str(), nullptr,
+				materialResourceViews[i].ReleaseAndGetAddressOf());
+			if (FAILED(result))
+				hr = result;
+		}
+		return hr;
+	}
+
+	HRESULT CreateNormalTextureFromFile(ID3D11Device* device, std::string filename)
+	{
+		std::wstring widestr = std::wstring(filename.begin(), filename.end());
+		return CreateDDSTextureFromFile(device, widestr.c_str(), nullptr,
+			normalResourceView.ReleaseAndGetAddressOf());
+	}
+
 	HRESULT CreateDefaultSampler(ID3D11Device* device)
 	{
 		HRESULT hr = S_OK;
@@ -230,7 +747,7 @@ public:
 		return hr;
 	}
 
-	void Bind(ID3D11DeviceContext* context)
+	void Bind(ID3D11DeviceContext* context) const
 	{
 		// Set shaders
 		if (constantBufferVS)
@@ -247,33 +764,75 @@ public:
 		// Set texture and sampler.
 		if (resourceView.Get())
 			context->PSSetShaderResources(0, 1, resourceView.GetAddressOf());
+		if (normalResourceView.Get())
+			context->PSSetShaderResources(1, 1, normalResourceView.GetAddressOf());
 		if (samplerState.Get())
 			context->PSSetSamplers(0, 1, samplerState.GetAddressOf());
 
-		// Set vertex buffer
-		UINT stride = vertexSize;
-		UINT offset = 0;
+		BindBuffers(context);
+	}
+
+	// Bind for a pass that only needs positions (depth pre-pass, shadows):
+	// the position stream layout and shader, and no pixel shader
+	void BindPositionsOnly(ID3D11DeviceContext* context) const
+	{
+		if (constantBufferVS)
+			context->VSSetConstantBuffers(0, 1, constantBufferVS.GetAddressOf());
+		context->IASetInputLayout(positionInputLayout.Get());
+		context->VSSetShader(positionVertexShader.Get(), nullptr, 0);
+		context->PSSetShader(nullptr, nullptr, 0);
+
+		BindBuffers(context);
+	}
+
+	void BindBuffers(ID3D11DeviceContext* context) const
+	{
+		// Set the vertex streams, slot 0 interleaved vertices and slot 1
+		// packed positions; the input layout picks what it reads
+		ID3D11Buffer* buffers[2] = { vertexBuffer.Get(), positionBuffer.Get() };
+		UINT strides[2] = { vertexSize, sizeof(XMFLOAT3) };
+		UINT offsets[2] = { 0, 0 };
 		if (vertexBuffer)
-			context->IASetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride,
-				&offset);
+			context->IASetVertexBuffers(0, positionBuffer ? 2 : 1, buffers, strides,
+				offsets);
 		// Set index buffer
 		if (indexBuffer)
-			context->IASetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+			context->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
 		// Set primitive topology
 		context->IASetPrimitiveTopology(primitiveTopology);
 	}
 
-	void Draw(ID3D11DeviceContext* context)
+	// materialTextures false leaves t0 alone, for untextured, wireframe and
+	// position only passes that bind their own texture or none
+	void Draw(ID3D11DeviceContext* context, bool materialTextures = true) const
 	{
 		if (indexBuffer)
-			context->DrawIndexed(indexCount, 0, 0);
+			DrawRanges(context, materialTextures);
 		else if (vertexBuffer)
 			context->Draw(vertexCount, 0);
 	}
 
-	void DrawIndexed(ID3D11DeviceContext* context)
+	void DrawIndexed(ID3D11DeviceContext* context, bool materialTextures = true) const
 	{
 		if (indexBuffer && vertexBuffer)
-			context->DrawIndexed(indexCount, 0, 0);
+			DrawRanges(context, materialTextures);
+	}
+
+	void DrawRanges(ID3D11DeviceContext* context, bool materialTextures = true) const
+	{
+		// Bind set resourceView, switch only when a range wants another texture
+		int boundMaterial = -1;
+		for (const DrawRange& range : drawRanges)
+		{
+			if (materialTextures && range.material != boundMaterial && !materialResourceViews.empty())
+			{
+				ID3D11ShaderResourceView* view = resourceView.Get();
+				if (range.material >= 0 && range.material < (int)materialResourceViews.size() && materialResourceViews[range.material])
+					view = materialResourceViews[range.material].Get();
+				context->PSSetShaderResources(0, 1, &view);
+				boundMaterial = range.material;
+			}
+			context->DrawIndexed(range.indexCount, range.indexStart, range.baseVertex);
+		}
 	}
 };
\ No newline at end of file
@@ -17,6 +17,8 @@
 #include "debug_renderer.h"
 #include "math_types.h"
 #include "LoaderUtils.h"
+#include "ImpostorUtils.h"
+#include "OutOfCoreUtils.h"
 
 using namespace DirectX;
 using namespace std;
@@ -33,6 +35,43 @@ bool RENDER_STYLE_TRANSPARENCY = false;
 bool RASTER_FILL_CULL_NONE = false;
 bool DEPTH_WRITE_ENABLED = true;
 bool SKYBOX_ENABLED = false;
+bool MESH_BENCHMARKS_ENABLED = false;
+// writes and welds a synthetic 50M triangle mesh, needs about 12 GB of disk
+bool OUT_OF_CORE_BENCHMARK_ENABLED = false;
+bool QUANTIZED_VERTICES_ENABLED = false;
+bool MESH_LODS_ENABLED = false;
+bool DEPTH_PREPASS_ENABLED = false;
+bool FRUSTUM_CULLING_ENABLED = true;
+bool PROGRESSIVE_STREAMING_ENABLED = false;
+bool IMPOSTORS_ENABLED = false;
+bool STATIC_BATCHING_ENABLED = true;
+bool ALPHA_CUTOUT_ENABLED = true;
+// off by default: every order is another full copy of the indices, only
+// used with RENDER_STYLE_TRANSPARENCY, and keeps the props out of the
+// static batches
+bool VIEW_ORDERS_ENABLED = false;
+// import the FBX props on worker threads, textures created there too
+bool PARALLEL_LOADING_ENABLED = true;
+// also load the props serially first and report both startup times
+bool LOADING_BENCHMARK_ENABLED = false;
+// back to front triangle orders precomputed for the loaded props when
+// VIEW_ORDERS_ENABLED is set (8 or 26), drawn with RENDER_STYLE_TRANSPARENCY
+int viewOrderBuckets = 26;
+// LODs generated for the loaded props when MESH_LODS_ENABLED is set
+vector<float> meshLODRatios = { 0.5f, 0.25f, 0.125f };
+// levels of the progressive raft stream, the last one is drawn first
+vector<float> progressiveLODRatios = { 0.25f, 0.0625f, 0.015625f };
+// bytes of a progressive stream read each frame, stands in for disk/network
+size_t streamingBytesPerFrame = 4096;
+// props further than this from the eye (to their bounding sphere) draw
+// their impostor when IMPOSTORS_ENABLED is set
+float impostorSwitchDistance = 12.0f;
+int impostorFramesPerSide = 8;
+int impostorFrameSize = 64;
+// outline of the cutout billboards, texels at or below the threshold are
+// treated as fully transparent
+int cutoutMaxVertices = 8;
+uint8_t cutoutAlphaThreshold = 8;
 
 HINSTANCE               g_hInst = nullptr;
 HWND                    g_hWnd = nullptr;
@@ -51,6 +90,9 @@ ID3D11PixelShader*		g_pPixelShaderSolid = nullptr;
 XMMATRIX                g_World;
 XMMATRIX                g_View;
 XMMATRIX                g_Projection;
+XMVECTOR                g_Eye;
+// screen pixels per world unit at distance 1, used for LOD selection
+float                   g_LODProjectionScale = 1.0f;
 ID3D11RasterizerState*	rasterStateDefault;
 ID3D11RasterizerState*	rasterStateWireframe;
 ID3D11RasterizerState*	rasterStateFillNoCull;
@@ -66,6 +108,34 @@ ID3D11Buffer* debugLinesVertexBuffer;
 
 vector<Renderable> renderables;
 
+// A renderable whose mesh is refined as its progressive stream arrives
+struct StreamingMesh
+{
+	size_t renderable = 0;
+	vector<uint8_t> stream;
+	size_t bytesRead = 0;
+	MeshUtils::ProgressiveMeshReader reader;
+};
+vector<StreamingMesh> streamingMeshes;
+
+// Baked impostor of a renderable, drawn as a single quad when it is far away
+struct ImpostorInstance
+{
+	size_t renderable = 0;
+	// only the frame layout and sphere are kept once the atlas is uploaded
+	ImpostorAtlas atlas;
+	Renderable quad;
+};
+vector<ImpostorInstance> impostors;
+
+// CPU copy of a static renderable's mesh, kept until the batches are built
+struct StaticSource
+{
+	size_t renderable = 0;
+	SimpleMesh<SimpleVertex> mesh;
+};
+vector<StaticSource> staticSources;
+
 // Grid mesh
 Renderable gridRenderable;
 
@@ -75,6 +145,35 @@ Renderable skyboxRenderable;
 //ground mesh
 Renderable groundRender;
 
+// The FBX props, loaded together before InitContent creates their renderables
+enum PropIndex
+{
+	PROP_DUCK,
+	PROP_CHEST,
+	PROP_BARREL,
+	PROP_RAFT,
+	PROP_CUBE,
+	PROP_COUNT,
+};
+
+// Every FBX in the assets folder, used by the mesh benchmarks
+vector<std::string> benchmarkAssets =
+{
+	"..//Assets//Character_Female_Pirate_01.fbx",
+	"..//Assets//Chest1-1.fbx",
+	"..//Assets//Chest1.fbx",
+	"..//Assets//Raft.fbx",
+	"..//Assets//barrel.fbx",
+	"..//Assets//barrelTris.fbx",
+	"..//Assets//barrel_tris.fbx",
+	"..//Assets//cube.fbx",
+	"..//Assets//duck_tris.fbx",
+	"..//Assets//raft_tris.fbx",
+	"..//Assets//rock01.fbx",
+	"..//Assets//rowing_boat_tris.fbx",
+	"..//Assets//wc1.fbx",
+};
+
 // Used for overriding the main mesh texture
 // with a generated white pixel texture to
 // simulate no texturing
@@ -89,6 +188,7 @@ HRESULT InitContent();
 void CleanupDevice();
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
 void Update();
+void UpdateStreaming();
 void Render();
 
 //--------------------------------------------------------------------------------------
@@ -361,6 +461,7 @@ HRESULT InitDevice()
 
 	// Initialize the projection matrix
 	g_Projection = XMMatrixPerspectiveFovLH(XM_PIDIV4, width / (FLOAT)height, 0.01f, 1000.0f);
+	g_LODProjectionScale = height / (2.0f * tanf(XM_PIDIV4 / 2));
 
 	return hr;
 }
@@ -613,16 +714,8 @@ HRESULT InitSkybox()
 		// Create the sampler state
 		//hr = skyboxRenderable.CreateDefaultSampler(g_pd3dDevice);
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
 		// Create the shaders
-		hr = skyboxRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Skybox_VS.cso", layout, ARRAYSIZE(layout));
+		hr = skyboxRenderable.CreateVertexShaderAndInputLayoutFromFile<SimpleVertex>(g_pd3dDevice, "Skybox_VS.cso");
 		hr = skyboxRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Skybox_PS.cso");
 
 		// Create the shader constant buffer
@@ -659,15 +752,8 @@ HRESULT initground()
 		// Create the sampler state
 		//hr = skyboxRenderable.CreateDefaultSampler(g_pd3dDevice);
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC lineLayoutDesc[] =
-		{
-			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0}
-		};
-
 		// Create the shaders
-		hr = groundRender.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Debug_VS.cso", lineLayoutDesc, ARRAYSIZE(lineLayoutDesc));
+		hr = groundRender.CreateVertexShaderAndInputLayoutFromFile<ColorVertex>(g_pd3dDevice, "Debug_VS.cso");
 		hr = groundRender.CreatePixelShaderFromFile(g_pd3dDevice, "Debug_PS.cso");
 
 
@@ -676,6 +762,385 @@ HRESULT initground()
 	}
 	return hr;
 }
+// Create the vertex/index buffers, input layout, shaders and constant
+// buffers for a lit, textured mesh. When QUANTIZED_VERTICES_ENABLED is set
+// the vertices are uploaded as 16 byte PackedVertex instead of SimpleVertex.
+// Float meshes also get a position stream when DEPTH_PREPASS_ENABLED is set
+HRESULT CreateMeshRenderable(Renderable& meshRenderable, SimpleMesh<SimpleVertex>& mesh)
+{
+	HRESULT hr = S_OK;
+
+	if (QUANTIZED_VERTICES_ENABLED)
+	{
+		SimpleMesh<PackedVertex> packedMesh;
+		MeshUtils::QuantizationInfo info;
+		MeshUtils::QuantizeMesh(mesh, packedMesh, info);
+
+		hr = meshRenderable.CreateBuffers(g_pd3dDevice, packedMesh);
+		if (FAILED(hr))
+			return hr;
+
+		// Packed_VS rebuilds the position with these
+		meshRenderable.positionScale = XMFLOAT4(info.positionScale.x, info.positionScale.y, info.positionScale.z, 0.0f);
+		meshRenderable.positionOffset = XMFLOAT4(info.positionOffset.x, info.positionOffset.y, info.positionOffset.z, 0.0f);
+
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile<PackedVertex>(g_pd3dDevice, "Packed_VS.cso");
+	}
+	else
+	{
+		// depth pre-pass draws from a separate 12 byte position stream
+		if (DEPTH_PREPASS_ENABLED)
+			MeshUtils::ExtractPositionStream(mesh);
+
+		hr = meshRenderable.CreateBuffers(g_pd3dDevice, mesh);
+		if (FAILED(hr))
+			return hr;
+
+		if (meshRenderable.positionBuffer)
+		{
+			hr = meshRenderable.CreatePositionShaderFromFile(g_pd3dDevice, "Depth_VS.cso");
+			if (FAILED(hr))
+				return hr;
+		}
+
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile<SimpleVertex>(g_pd3dDevice, "Tutorial06_VS.cso");
+	}
+
+	// Create the shaders
+	hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+
+	// Create the shader constant buffer
+	hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
+	hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
+
+	// submeshes with their own texture switch to it between draws, the
+	// ones that fail to load keep the mesh's main texture (LoadProps has
+	// already loaded them for the FBX props)
+	if (mesh.materials.size() > 1 && meshRenderable.materialResourceViews.empty())
+		meshRenderable.CreateMaterialTexturesFromFiles(g_pd3dDevice, "..//Assets//", mesh.materials);
+	return hr;
+}
+
+// Trim the quads of a billboard mesh to a polygon around the opaque part of
+// its texture, so the transparent texels around it aren't rasterized
+void CutoutBillboard(SimpleMesh<SimpleVertex>& mesh, const std::string& textureFilename)
+{
+	if (!ALPHA_CUTOUT_ENABLED)
+		return;
+
+	ImpostorImage texture;
+	if (!ImpostorUtils::LoadDDSImage(textureFilename, texture))
+	{
+		cout << "Cutout: could not read " << textureFilename << ", keeping the full quads" << endl;
+		return;
+	}
+
+	vector<XMFLOAT2> polygon;
+	MeshUtils::ComputeCutoutPolygon(polygon, (const uint8_t*)texture.pixels.data() + 3, texture.width, texture.height, 4,
+		cutoutMaxVertices, cutoutAlphaThreshold);
+	if (!MeshUtils::CutoutQuads(mesh, polygon))
+	{
+		cout << "Cutout: " << textureFilename << " mesh is not made of quads" << endl;
+		return;
+	}
+
+	float coverage = fabsf(MeshUtils::PolygonArea(polygon));
+	float texels = (float)texture.width * texture.height;
+	cout << "Cutout " << textureFilename << ": " << polygon.size() << " vertices, " <<
+		(int)((1.0f - coverage) * texels) << " of " << (int)texels << " texels (" <<
+		(1.0f - coverage) * 100.0f << "%) no longer rasterized per quad" << endl;
+}
+
+// Bake the impostor of a mesh on the CPU, write its color and normal atlases
+// next to the assets as <name>_impostor_color.dds / _normal.dds and load
+// them back onto the quad that replaces the mesh at a distance
+HRESULT CreateImpostor(const SimpleMesh<SimpleVertex>& mesh, const std::string& textureFilename,
+	const std::string& name, ImpostorInstance& impostor)
+{
+	HRESULT hr = S_OK;
+
+	ImpostorImage texture;
+	bool textured = textureFilename != "" && ImpostorUtils::LoadDDSImage("..//Assets//" + textureFilename, texture);
+	ImpostorUtils::BakeImpostor(mesh, textured ? &texture : nullptr, impostorFramesPerSide, impostorFrameSize, impostor.atlas);
+
+	std::string colorFilename = "..//Assets//" + name + "_impostor_color.dds";
+	std::string normalFilename = "..//Assets//" + name + "_impostor_normal.dds";
+	if (!ImpostorUtils::SaveDDSImage(colorFilename, impostor.atlas.color) ||
+		!ImpostorUtils::SaveDDSImage(normalFilename, impostor.atlas.normal))
+		return E_FAIL;
+	impostor.atlas.color = ImpostorImage();
+	impostor.atlas.normal = ImpostorImage();
+
+	Renderable& quad = impostor.quad;
+	SimpleMesh<SimpleVertex> quadMesh;
+	ImpostorUtils::MakeImpostorQuad(quadMesh);
+	hr = quad.CreateBuffers(g_pd3dDevice, quadMesh);
+	if (FAILED(hr))
+		return hr;
+
+	hr = quad.CreateTextureFromFile(g_pd3dDevice, colorFilename);
+	if (FAILED(hr))
+		return hr;
+	hr = quad.CreateNormalTextureFromFile(g_pd3dDevice, normalFilename);
+	if (FAILED(hr))
+		return hr;
+	hr = quad.CreateDefaultSampler(g_pd3dDevice);
+
+	// Create the shaders
+	hr = quad.CreateVertexShaderAndInputLayoutFromFile<SimpleVertex>(g_pd3dDevice, "Impostor_VS.cso");
+	hr = quad.CreatePixelShaderFromFile(g_pd3dDevice, "Impostor_PS.cso");
+
+	// Create the shader constant buffer
+	hr = quad.CreateConstantBufferVS(g_pd3dDevice, sizeof(ImpostorConstantBuffer));
+	hr = quad.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
+	return hr;
+}
+
+// Link an impostor to the renderable about to be pushed
+void AttachImpostor(ImpostorInstance& impostor)
+{
+	impostor.renderable = renderables.size();
+	impostors.push_back(impostor);
+}
+
+// Flag the renderable about to be pushed as static and keep its mesh
+// for BuildStaticBatches
+void MarkStatic(Renderable& meshRenderable, const SimpleMesh<SimpleVertex>& mesh)
+{
+	meshRenderable.isStatic = true;
+	// meshes with view orders stay separate so they can still be sorted,
+	// and a batch has one material, so multi-material meshes do too
+	if (STATIC_BATCHING_ENABLED && mesh.viewOrders.empty() && mesh.materials.size() <= 1)
+		staticSources.push_back({ renderables.size(), mesh });
+}
+
+// Same shaders, layout and textures, so one draw can cover both
+bool SameMaterial(const Renderable& a, const Renderable& b)
+{
+	return a.vertexShader == b.vertexShader && a.pixelShader == b.pixelShader && a.inputLayout == b.inputLayout &&
+		a.resourceView == b.resourceView && a.normalResourceView == b.normalResourceView &&
+		a.samplerState == b.samplerState && a.vertexSize == b.vertexSize;
+}
+
+// Merge static renderables that share a material into pre-transformed
+// batches of at most maxVertices16 vertices, each drawn with one call.
+// The sources stay in renderables (so indices used elsewhere stay valid)
+// but are skipped when drawing; the batches are appended at the end
+HRESULT BuildStaticBatches()
+{
+	HRESULT hr = S_OK;
+
+	auto countDraws = [&]()
+	{
+		size_t draws = 0;
+		for (const Renderable& r : renderables)
+			draws += r.batched ? 0 : r.drawRanges.size();
+		return draws;
+	};
+	size_t drawsBefore = countDraws();
+	size_t sourceCount = renderables.size();
+	int batchCount = 0, mergedCount = 0;
+
+	vector<bool> grouped(staticSources.size(), false);
+	for (size_t i = 0; i < staticSources.size(); i++)
+	{
+		if (grouped[i])
+			continue;
+
+		// only float vertices can be transformed on the CPU, and meshes with
+		// an impostor need their own world matrix to switch to it
+		auto batchable = [&](size_t s)
+		{
+			size_t index = staticSources[s].renderable;
+			for (const ImpostorInstance& impostor : impostors)
+			{
+				if (impostor.renderable == index)
+					return false;
+			}
+			return renderables[index].vertexSize == sizeof(SimpleVertex);
+		};
+		if (!batchable(i))
+			continue;
+
+		vector<size_t> group;
+		for (size_t j = i; j < staticSources.size(); j++)
+		{
+			if (!grouped[j] && batchable(j) && SameMaterial(renderables[staticSources[j].renderable], renderables[staticSources[i].renderable]))
+			{
+				group.push_back(j);
+				grouped[j] = true;
+			}
+		}
+		if (group.size() < 2)
+			continue;
+
+		// the batch takes the shaders, textures and constant buffers of its first source
+		Renderable material = renderables[staticSources[i].renderable];
+		SimpleMesh<SimpleVertex> batch;
+		vector<MeshUtils::BatchSubmesh> submeshes;
+		auto flush = [&]()
+		{
+			if (submeshes.empty())
+				return S_OK;
+
+			Renderable batchRenderable = material;
+			batchRenderable.world = XMMatrixIdentity();
+			batchRenderable.isStatic = true;
+			batchRenderable.batchSubmeshes = submeshes;
+			MeshUtils::ComputeMeshBounds(batch);
+			if (material.positionBuffer)
+				MeshUtils::ExtractPositionStream(batch);
+			HRESULT result = batchRenderable.CreateBuffers(g_pd3dDevice, batch);
+			if (FAILED(result))
+				return result;
+
+			for (const MeshUtils::BatchSubmesh& submesh : submeshes)
+				renderables[submesh.source].batched = true;
+			renderables.push_back(batchRenderable);
+			batchCount++;
+			mergedCount += (int)submeshes.size();
+
+			batch = SimpleMesh<SimpleVertex>();
+			submeshes.clear();
+			return S_OK;
+		};
+
+		for (size_t s : group)
+		{
+			const StaticSource& source = staticSources[s];
+			if (batch.vertexList.size() + source.mesh.vertexList.size() > maxVertices16)
+			{
+				hr = flush();
+				if (FAILED(hr))
+					return hr;
+			}
+			MeshUtils::AppendTransformedMesh(batch, submeshes, source.mesh, renderables[source.renderable].world, (int)source.renderable);
+		}
+		hr = flush();
+		if (FAILED(hr))
+			return hr;
+	}
+
+	// the meshes are in the batches now
+	staticSources.clear();
+
+	cout << "static batching: " << mergedCount << " of " << sourceCount << " renderables merged into " << batchCount
+		<< " batches, draw calls " << drawsBefore << " -> " << countDraws() << endl;
+	return hr;
+}
+
+// streamed meshes are uploaded as floats, so not with quantized vertices
+bool RaftStreamed()
+{
+	return PROGRESSIVE_STREAMING_ENABLED && !QUANTIZED_VERTICES_ENABLED;
+}
+
+// File, scale and processing passes of each prop
+vector<FBXLoadJob> PropLoadJobs()
+{
+	FBXLoadOptions options;
+	if (MESH_LODS_ENABLED)
+		options.lodRatios = meshLODRatios;
+	if (VIEW_ORDERS_ENABLED)
+		options.viewOrderBuckets = viewOrderBuckets;
+
+	// concave props, so also reorder them for less overdraw
+	FBXLoadOptions concaveOptions = options;
+	concaveOptions.optimizeOverdraw = true;
+
+	// the streamed raft gets its progressive levels instead of view orders
+	FBXLoadOptions raftOptions = concaveOptions;
+	if (RaftStreamed())
+	{
+		raftOptions.lodRatios = progressiveLODRatios;
+		raftOptions.viewOrderBuckets = 0;
+	}
+
+	vector<FBXLoadJob> jobs(PROP_COUNT);
+	jobs[PROP_DUCK] = { "..//Assets//duck_tris.fbx", 0.005f, options };
+	jobs[PROP_CHEST] = { "..//Assets//Chest1-1.fbx", 0.025f, concaveOptions };
+	jobs[PROP_BARREL] = { "..//Assets//barrel.fbx", 0.15f, options };
+	jobs[PROP_RAFT] = { "..//Assets//raft_tris.fbx", 0.005f, raftOptions };
+	jobs[PROP_CUBE] = { "..//Assets//cube.fbx", 0.2f };
+	return jobs;
+}
+
+// Load the props and their textures on threadCount threads. The texture
+// (with its sampler and material textures) goes into the matching entry of
+// textured; that only uses the device, whose create calls are free
+// threaded, so it runs on the loading thread. Returns the last failure
+HRESULT LoadProps(vector<FBXLoadJob>& props, vector<Renderable>& textured, unsigned threadCount)
+{
+	props = PropLoadJobs();
+	textured.assign(props.size(), Renderable());
+	vector<HRESULT> results(props.size(), S_OK);
+
+	LoadFBXJobs(props, threadCount, [&](size_t i)
+	{
+		// Load the Texture when texture filename is valid
+		if (props[i].textureFilename != "")
+		{
+			results[i] = textured[i].CreateTextureFromFile(g_pd3dDevice, "..//Assets//" + props[i].textureFilename);
+			if (FAILED(results[i]))
+				return;
+
+			// Create the sampler state
+			results[i] = textured[i].CreateDefaultSampler(g_pd3dDevice);
+		}
+
+		// submeshes with their own texture switch to it between draws, the
+		// ones that fail to load keep the mesh's main texture
+		if (props[i].mesh.materials.size() > 1)
+			textured[i].CreateMaterialTexturesFromFiles(g_pd3dDevice, "..//Assets//", props[i].mesh.materials);
+	});
+
+	HRESULT hr = S_OK;
+	for (HRESULT result : results)
+	{
+		if (FAILED(result))
+			hr = result;
+	}
+	return hr;
+}
+
+// Load the props, in parallel when PARALLEL_LOADING_ENABLED is set, and
+// report the startup time. LOADING_BENCHMARK_ENABLED times the serial load
+// as well for comparison (its results are thrown away)
+HRESULT LoadPropsTimed(vector<FBXLoadJob>& props, vector<Renderable>& textured)
+{
+	unsigned threadCount = PARALLEL_LOADING_ENABLED ? max(thread::hardware_concurrency(), 1u) : 1;
+	threadCount = min(threadCount, (unsigned)PROP_COUNT);
+
+	double serialTime = 0.0;
+	if (LOADING_BENCHMARK_ENABLED && threadCount > 1)
+	{
+		vector<FBXLoadJob> serialProps;
+		vector<Renderable> serialTextured;
+		auto start = chrono::high_resolution_clock::now();
+		HRESULT hr = LoadProps(serialProps, serialTextured, 1);
+		serialTime = MeshUtils::ElapsedMs(start);
+		if (FAILED(hr))
+			return hr;
+	}
+
+	auto start = chrono::high_resolution_clock::now();
+	HRESULT hr = LoadProps(props, textured, threadCount);
+	double loadTime = MeshUtils::ElapsedMs(start);
+
+	// the per prop times add up to about what loading them one by one takes
+	double propTime = 0.0;
+	for (const FBXLoadJob& prop : props)
+		propTime += prop.loadTime;
+
+	cout << "\nprop loading: " << props.size() << " FBX files on " << threadCount << " threads in " << loadTime
+		<< " ms (" << propTime << " ms of per prop work)" << endl;
+	for (const FBXLoadJob& prop : props)
+		cout << "  " << getFileName(prop.filename) << ": " << prop.loadTime << " ms" << endl;
+	if (serialTime > 0.0)
+		cout << "  serial: " << serialTime << " ms, parallel: " << loadTime << " ms, " << serialTime / max(loadTime, 0.001) << "x" << endl;
+	return hr;
+}
+
 HRESULT InitContent()
 {
 	InitDebugTexture();
@@ -684,66 +1149,56 @@ HRESULT InitContent()
 	InitDebugRendererVertexBuffer();
 	InitBlendState();
 	InitFBX();
+	if (MESH_BENCHMARKS_ENABLED)
+	{
+		BenchmarkFBXAssets(benchmarkAssets);
+		// largest asset, tiled up to a few million vertices
+		BenchmarkFBXWeldThreads("..//Assets//raft_tris.fbx", 64);
+	}
+	if (OUT_OF_CORE_BENCHMARK_ENABLED)
+		OutOfCoreUtils::BenchmarkOutOfCore("..//Assets//");
 	InitSkybox();
 	initground();
 
-	HRESULT hr = S_OK;
+	// the FBX props, each block below picks up its own
+	vector<FBXLoadJob> props;
+	vector<Renderable> propTextures;
+	HRESULT hr = LoadPropsTimed(props, propTextures);
+	if (FAILED(hr))
+		return hr;
 
 	//////////////////////////////////////////
 	//Create mesh render components
 	//////////////////////////////////////////
 	{
-		Renderable meshRenderable;
-
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
+		// loaded (and textured) by LoadPropsTimed
+		Renderable meshRenderable = propTextures[PROP_DUCK];
+		SimpleMesh<SimpleVertex>& mesh = props[PROP_DUCK].mesh;
+		std::string& filename = props[PROP_DUCK].textureFilename;
 
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		LoadFBX("..//Assets//duck_tris.fbx", mesh, 0.005f, filename);
-
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
+		// Create the buffers, input layout, shaders and constant buffers
+		hr = CreateMeshRenderable(meshRenderable, mesh);
 
-		// Load the Texture when texture filename is valid
-		if (filename != "")
-		{ 
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, "..//Assets//" + filename);
+		// both ducks share one impostor
+		ImpostorInstance impostor;
+		if (IMPOSTORS_ENABLED)
+		{
+			hr = CreateImpostor(mesh, filename, "duck_tris", impostor);
 			if (FAILED(hr))
 				return hr;
-
-			// Create the sampler state
-			hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
 		}
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
-		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
-
-		// Create the shader constant buffer
-		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
-		hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
 		meshRenderable.setPosition(-3.0f, 0.0f, 0.0f);
+		if (IMPOSTORS_ENABLED)
+			AttachImpostor(impostor);
 		renderables.push_back(meshRenderable);
 
 		// make a second duck, push_back makes a copy
 		meshRenderable.setPosition(2.0f, 1.6f, 0.4f);
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f));
+		if (IMPOSTORS_ENABLED)
+			AttachImpostor(impostor);
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 	}
 
@@ -751,54 +1206,26 @@ HRESULT InitContent()
 	// this block is getting redundant!
 	// these should become a create Renderable funcition
 	{
-		Renderable meshRenderable;
-
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
+		// loaded (and textured) by LoadPropsTimed
+		Renderable meshRenderable = propTextures[PROP_CHEST];
+		SimpleMesh<SimpleVertex>& mesh = props[PROP_CHEST].mesh;
+		std::string& filename = props[PROP_CHEST].textureFilename;
 
-		// Load it!
-		LoadFBX("..//Assets//Chest1-1.fbx", mesh, 0.025f, filename);
-		
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
+		// Create the buffers, input layout, shaders and constant buffers
+		hr = CreateMeshRenderable(meshRenderable, mesh);
 
-		// Load the Texture when texture filename is valid
-		if (filename != "")
+		ImpostorInstance impostor;
+		if (IMPOSTORS_ENABLED)
 		{
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, "..//Assets//" + filename);
+			hr = CreateImpostor(mesh, filename, "Chest1-1", impostor);
 			if (FAILED(hr))
 				return hr;
-
-			// Create the sampler state
-			hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
+			AttachImpostor(impostor);
 		}
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
-		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
-
-		// Create the shader constant buffer
-		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
-		hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
-
 		meshRenderable.setPosition(2.0f, 0.0f, 1.0f);
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f*1.2));
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 	}
 
@@ -806,55 +1233,27 @@ HRESULT InitContent()
 	//Create barrel components
 	//////////////////////////////////////////
 	{
-		Renderable meshRenderable;
-
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		LoadFBX("..//Assets//barrel.fbx", mesh, 0.15f, filename);
+		// loaded (and textured) by LoadPropsTimed
+		Renderable meshRenderable = propTextures[PROP_BARREL];
+		SimpleMesh<SimpleVertex>& mesh = props[PROP_BARREL].mesh;
+		std::string& filename = props[PROP_BARREL].textureFilename;
 
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
+		// Create the buffers, input layout, shaders and constant buffers
+		hr = CreateMeshRenderable(meshRenderable, mesh);
 
-		// Load the Texture when texture filename is valid
-		if (filename != "")
+		ImpostorInstance impostor;
+		if (IMPOSTORS_ENABLED)
 		{
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, "..//Assets//" + filename);
+			hr = CreateImpostor(mesh, filename, "barrel", impostor);
 			if (FAILED(hr))
 				return hr;
-
-			// Create the sampler state
-			hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
+			AttachImpostor(impostor);
 		}
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
-		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
-
-		// Create the shader constant buffer
-		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
-		hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
-
 		meshRenderable.setPosition(-1.f, 1.f, 1.0f);
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f));
 		meshRenderable.setRotation(XMMatrixRotationZ(3.14159265359f/2));
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 	}
 
@@ -864,54 +1263,52 @@ HRESULT InitContent()
 	//Create raft components
 	//////////////////////////////////////////
 	{
-		Renderable meshRenderable;
-
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		LoadFBX("..//Assets//raft_tris.fbx", mesh, 0.005f, filename);
-
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
-
-		// Load the Texture when texture filename is valid
-		if (filename != "")
+		// loaded (and textured) by LoadPropsTimed
+		Renderable meshRenderable = propTextures[PROP_RAFT];
+		SimpleMesh<SimpleVertex>& mesh = props[PROP_RAFT].mesh;
+		std::string& filename = props[PROP_RAFT].textureFilename;
+		bool streamed = RaftStreamed();
+
+		// the encoded stream stands in for a file being read; start from
+		// its coarsest level and let UpdateStreaming refine the rest
+		StreamingMesh streamingMesh;
+		if (streamed)
 		{
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, "..//Assets//" + filename);
-			if (FAILED(hr))
-				return hr;
-
-			// Create the sampler state
-			hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
+			MeshUtils::EncodeProgressiveMesh(streamingMesh.stream, mesh);
+			while (!streamingMesh.reader.Finished() && !streamingMesh.reader.ReadLevel())
+			{
+				// out of bytes without a complete level
+				if (streamingMesh.bytesRead == streamingMesh.stream.size())
+					break;
+				size_t bytes = min(streamingBytesPerFrame, streamingMesh.stream.size() - streamingMesh.bytesRead);
+				streamingMesh.reader.Append(streamingMesh.stream.data() + streamingMesh.bytesRead, bytes);
+				streamingMesh.bytesRead += bytes;
+			}
+			if (streamingMesh.reader.failed || streamingMesh.reader.levelsRead == 0)
+			{
+				cout << "raft stream: no level could be decoded" << endl;
+				return E_FAIL;
+			}
+			mesh = streamingMesh.reader.mesh;
+			cout << "raft stream: " << mesh.indicesList.size() / 3 << " triangles drawable after "
+				<< streamingMesh.bytesRead << " of " << streamingMesh.stream.size() << " bytes" << endl;
 		}
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
-		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
-
-		// Create the shader constant buffer
-		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
-		hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
+		// Create the buffers, input layout, shaders and constant buffers
+		hr = CreateMeshRenderable(meshRenderable, mesh);
 
 		meshRenderable.setPosition(3.0f, 1.2f, 6.0f);
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f / 3));
+		// a streamed mesh keeps changing its buffers, so it can't be batched
+		if (streamed)
+		{
+			streamingMesh.renderable = renderables.size();
+			streamingMeshes.push_back(streamingMesh);
+		}
+		else
+		{
+			MarkStatic(meshRenderable, mesh);
+		}
 		renderables.push_back(meshRenderable);
 	}
 	//////////////////////////////////////////
@@ -926,14 +1323,10 @@ HRESULT InitContent()
 		// filename for texture file
 		MeshUtils::makeCrossHatchPNT(mesh, 0.5f);
 		std::string filename = "grass.dds";
+		CutoutBillboard(mesh, filename);
 
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
+		// Create the vertex buffers (and bounds) from the generated SimpleMesh
+		hr = meshRenderable.CreateBuffers(g_pd3dDevice, mesh);
 
 
 		// Load the Texture
@@ -944,16 +1337,8 @@ HRESULT InitContent()
 		// Create the sampler state
 		hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
 		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile<SimpleVertex>(g_pd3dDevice, "Tutorial06_VS.cso");
 		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
 
 		// Create the shader constant buffer
@@ -962,18 +1347,23 @@ HRESULT InitContent()
 
 		//Create a bunch of bushes
 		meshRenderable.setPosition(-2.0f, 0.0f, -2.0f);
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 
 		meshRenderable.setPosition(4.f, 0.0f, -1.0f);
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 
 		meshRenderable.setPosition(0.0f, 0.0f, -3.0f);
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 
 		meshRenderable.setPosition(1.5f, 0.0f, 3.0f);
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 
 		meshRenderable.setPosition(2.0f, 0.0f, -4.0f);
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 	}
 
@@ -989,14 +1379,10 @@ HRESULT InitContent()
 		// filename for texture file
 		MeshUtils::makeCrossHatchPNT(mesh, 0.5f);
 		std::string filename = "spark.dds";
+		CutoutBillboard(mesh, filename);
 
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
+		// Create the vertex buffers (and bounds) from the generated SimpleMesh
+		hr = meshRenderable.CreateBuffers(g_pd3dDevice, mesh);
 
 
 		// Load the Texture
@@ -1007,16 +1393,8 @@ HRESULT InitContent()
 		// Create the sampler state
 		hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
 		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile<SimpleVertex>(g_pd3dDevice, "Tutorial06_VS.cso");
 		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
 
 		// Create the shader constant buffer
@@ -1036,57 +1414,26 @@ HRESULT InitContent()
 	//Create crate components
 	//////////////////////////////////////////
 	{
-		Renderable meshRenderable;
-
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		LoadFBX("..//Assets//cube.fbx", mesh, 0.2f, filename);
-
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
-
-		// Load the Texture when texture filename is valid
-		if (filename != "")
-		{
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, "..//Assets//" + filename);
-			if (FAILED(hr))
-				return hr;
-
-			// Create the sampler state
-			hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
-		}
-
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
-
-		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+		// loaded (and textured) by LoadPropsTimed
+		Renderable meshRenderable = propTextures[PROP_CUBE];
+		SimpleMesh<SimpleVertex>& mesh = props[PROP_CUBE].mesh;
 
-		// Create the shader constant buffer
-		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
-		hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
+		// Create the buffers, input layout, shaders and constant buffers
+		hr = CreateMeshRenderable(meshRenderable, mesh);
 
 		meshRenderable.setPosition(0.0f, -22.0f, 0.0f);
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f));
+		MarkStatic(meshRenderable, mesh);
 		renderables.push_back(meshRenderable);
 	}
 
+	if (STATIC_BATCHING_ENABLED)
+	{
+		hr = BuildStaticBatches();
+		if (FAILED(hr))
+			return hr;
+	}
+
 	// Create grid render components
 	{
 		// Generate the geometry
@@ -1098,15 +1445,8 @@ HRESULT InitContent()
 
 		gridRenderable.primitiveTopology = D3D11_PRIMITIVE_TOPOLOGY_LINELIST;
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC lineLayoutDesc[] =
-		{
-			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0}
-		};
-
 		// Create the shaders
-		hr = gridRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Debug_VS.cso", lineLayoutDesc, ARRAYSIZE(lineLayoutDesc));
+		hr = gridRenderable.CreateVertexShaderAndInputLayoutFromFile<ColorVertex>(g_pd3dDevice, "Debug_VS.cso");
 		hr = gridRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Debug_PS.cso");
 
 		// Create the shader constant buffer
@@ -1265,6 +1605,8 @@ void Update()
 	renderables[10].setRotation(yrot); 
 	renderables[11].setRotation(yrot);
 
+	UpdateStreaming();
+
 	// Rotate cube around the origin
 	g_World = XMMatrixRotationY(t);
 
@@ -1277,6 +1619,7 @@ void Update()
 	XMVECTOR At = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 	XMVECTOR Up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 	g_View = XMMatrixLookAtLH(Eye, At, Up);
+	g_Eye = Eye;
 
 	// Setup our lighting parameters
 	XMStoreFloat4(&vLightDirs[0], { -0.577f, 0.577f, -0.577f, 1.0f });
@@ -1293,6 +1636,45 @@ void Update()
 	XMStoreFloat4(&vLightDirs[1], vLightDir);
 }
 
+// Feed each progressive stream its share of bytes for this frame and
+// rebuild the renderable's buffers whenever a finer level completes
+void UpdateStreaming()
+{
+	for (StreamingMesh& streamingMesh : streamingMeshes)
+	{
+		if (streamingMesh.reader.Finished())
+			continue;
+
+		size_t bytes = min(streamingBytesPerFrame, streamingMesh.stream.size() - streamingMesh.bytesRead);
+		streamingMesh.reader.Append(streamingMesh.stream.data() + streamingMesh.bytesRead, bytes);
+		streamingMesh.bytesRead += bytes;
+
+		bool refined = false;
+		while (streamingMesh.reader.ReadLevel())
+			refined = true;
+		// a stream that ends short of its last level stays at the level it reached
+		if (!streamingMesh.reader.Finished() && streamingMesh.bytesRead == streamingMesh.stream.size())
+		{
+			cout << "raft stream: ended after " << streamingMesh.reader.levelsRead << " levels" << endl;
+			streamingMesh.reader.failed = true;
+		}
+		if (!refined)
+			continue;
+
+		Renderable& meshRenderable = renderables[streamingMesh.renderable];
+		SimpleMesh<SimpleVertex>& mesh = streamingMesh.reader.mesh;
+		if (meshRenderable.positionBuffer)
+			MeshUtils::ExtractPositionStream(mesh);
+		meshRenderable.CreateBuffers(g_pd3dDevice, mesh);
+		cout << "raft stream: " << mesh.indicesList.size() / 3 << " triangles after "
+			<< streamingMesh.bytesRead << " bytes" << endl;
+
+		// the full mesh is in, the stream is no longer needed
+		if (streamingMesh.reader.Finished())
+			vector<uint8_t>().swap(streamingMesh.stream);
+	}
+}
+
 void renderGrid()
 {
 	// set up default render state
@@ -1333,12 +1715,53 @@ void renderGround()
 	groundRender.Draw(g_pImmediateContext);
 }
 
+// Draw the quad of an impostor in place of the mesh at world
+void renderImpostor(ImpostorInstance& impostor, const XMMATRIX& world)
+{
+	ImpostorConstantBuffer cbImpostor;
+	XMMATRIX quadWorld = ImpostorUtils::ImpostorWorld(impostor.atlas, world, g_Eye, cbImpostor.vAtlasFrame);
+	cbImpostor.mWorld = XMMatrixTranspose(quadWorld);
+	cbImpostor.mView = modelViewProjection.mView;
+	cbImpostor.mProjection = modelViewProjection.mProjection;
+
+	Renderable& quad = impostor.quad;
+	g_pImmediateContext->UpdateSubresource(quad.constantBufferVS.Get(), 0, nullptr, &cbImpostor, 0, 0);
+	g_pImmediateContext->UpdateSubresource(quad.constantBufferPS.Get(), 0, nullptr, &lightsAndColor, 0, 0);
+
+	quad.Bind(g_pImmediateContext);
+
+	// alpha tested in Impostor_PS, so no blending
+	g_pImmediateContext->RSSetState(rasterStateDefault);
+	g_pImmediateContext->OMSetBlendState(nullptr, 0, 0xffffffff);
+	g_pImmediateContext->OMSetDepthStencilState(DEPTH_WRITE_ENABLED ? pDSState : pDSStateNoWrite, 1);
+
+	quad.Draw(g_pImmediateContext);
+}
+
+// Depth only draw that fetches just the position stream
+void renderDepthOnly(const Renderable& meshRenderable)
+{
+	modelViewProjection.mWorld = XMMatrixTranspose(meshRenderable.world);
+	g_pImmediateContext->UpdateSubresource(meshRenderable.constantBufferVS.Get(), 0, nullptr, &modelViewProjection, 0, 0);
+
+	meshRenderable.BindPositionsOnly(g_pImmediateContext);
+
+	if (RASTER_FILL_CULL_NONE)
+		g_pImmediateContext->RSSetState(rasterStateFillNoCull);
+	else
+		g_pImmediateContext->RSSetState(rasterStateDefault);
+
+	meshRenderable.Draw(g_pImmediateContext, false);
+}
+
 // Mesh render routine that supports toggling texturing
 // and toggling overlay wireframe
-void renderMesh(Renderable meshRenderable)
+void renderMesh(const Renderable& meshRenderable)
 {
 	// copy transform to constant buffer
 	modelViewProjection.mWorld = XMMatrixTranspose(meshRenderable.world);
+	modelViewProjection.vPositionScale = meshRenderable.positionScale;
+	modelViewProjection.vPositionOffset = meshRenderable.positionOffset;
 
 	// send the constant buffers to the GPU
 	g_pImmediateContext->UpdateSubresource(meshRenderable.constantBufferVS.Get(), 0, nullptr, &modelViewProjection, 0, 0);
@@ -1368,7 +1791,7 @@ void renderMesh(Renderable meshRenderable)
 	}
 
 	// Bind and Draw the vertices
-	meshRenderable.Draw(g_pImmediateContext);
+	meshRenderable.Draw(g_pImmediateContext, RENDER_STYLE_TEXTURED);
 
 	// redraw the whole mesh in wireframe mode
 	if (RENDER_STYLE_WIREFRAME)
@@ -1386,7 +1809,7 @@ void renderMesh(Renderable meshRenderable)
 		g_pImmediateContext->RSSetState(rasterStateWireframe);
 
 		// Draw the mesh
-		meshRenderable.Draw(g_pImmediateContext);
+		meshRenderable.Draw(g_pImmediateContext, false);
 	}
 }
 
@@ -1487,14 +1910,82 @@ void Render()
 	else
 		g_pImmediateContext->OMSetDepthStencilState(pDSStateNoWrite, 1);
 
+	if (MESH_LODS_ENABLED)
+	{
+		for (auto& r : renderables)
+			r.SelectLOD(g_Eye, g_LODProjectionScale);
+	}
+
+	// Blended meshes draw their full detail triangles back to front
+	if (RENDER_STYLE_TRANSPARENCY)
+	{
+		for (auto& r : renderables)
+			r.SelectViewOrder(g_Eye);
+	}
+
+	// Skip renderables whose bounding sphere is outside the view
+	XMVECTOR frustumPlanes[6];
+	MeshUtils::GetFrustumPlanes(XMMatrixMultiply(g_View, g_Projection), frustumPlanes);
+	auto culled = [&](const Renderable& r)
+	{
+		if (!FRUSTUM_CULLING_ENABLED || !r.bounds.valid)
+			return false;
+		MeshBounds worldBounds = r.GetWorldBounds();
+		return MeshUtils::SphereOutsideFrustum(frustumPlanes, XMLoadFloat3(&worldBounds.sphereCenter), worldBounds.sphereRadius);
+	};
+
+	// Static batches still cull their sources one by one
+	for (auto& r : renderables)
+	{
+		if (r.batchSubmeshes.empty())
+			continue;
+		r.SelectBatchRanges([&](const MeshBounds& bounds)
+		{
+			return !FRUSTUM_CULLING_ENABLED || !bounds.valid ||
+				!MeshUtils::SphereOutsideFrustum(frustumPlanes, XMLoadFloat3(&bounds.sphereCenter), bounds.sphereRadius);
+		});
+	}
+
+	// Far props with an impostor draw its quad instead of the mesh
+	for (ImpostorInstance& impostor : impostors)
+	{
+		Renderable& r = renderables[impostor.renderable];
+		MeshBounds worldBounds = r.GetWorldBounds();
+		float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&worldBounds.sphereCenter), g_Eye))) - worldBounds.sphereRadius;
+		r.replacedByImpostor = IMPOSTORS_ENABLED && distance > impostorSwitchDistance;
+	}
+
+	// Lay down depth from the position streams first, so the shaded pass
+	// below only runs the pixel shader for visible surfaces
+	bool depthPrepass = DEPTH_PREPASS_ENABLED && DEPTH_WRITE_ENABLED && !RENDER_STYLE_TRANSPARENCY;
+	if (depthPrepass)
+	{
+		for (const auto& r : renderables)
+		{
+			if (r.positionBuffer && !r.batched && !culled(r) && !r.replacedByImpostor)
+				renderDepthOnly(r);
+		}
+	}
+
 	// Render all of the renderables in the scene
-	for (auto r : renderables)
+	for (const auto& r : renderables)
 	{
+		if (r.batched || culled(r) || r.replacedByImpostor)
+			continue;
+		if (depthPrepass)
+			g_pImmediateContext->OMSetDepthStencilState(r.positionBuffer ? pDSStateNoWrite : pDSState, 1);
 		renderMesh(r);
 		if (DEBUG_VIEW_ENABLED)
 			debug_renderer::add_transform((end::float4x4&)r.world);
 	}
 
+	for (ImpostorInstance& impostor : impostors)
+	{
+		const Renderable& r = renderables[impostor.renderable];
+		if (r.replacedByImpostor && !culled(r))
+			renderImpostor(impostor, r.world);
+	}
+
 	/// Draw Skybox
 	if (SKYBOX_ENABLED)
 		renderSkyBox();
@@ -0,0 +1,100 @@
+#pragma once
+#include <directxmath.h>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+
+using namespace DirectX;
+
+// Compile time description of a vertex struct: one VertexElement per field
+// with its shader semantic, data type and byte offset. The input layouts
+// (Renderable.h), the welding hash and compare and the packing kernels
+// (MeshUtils.h) are all generated from it, so a new vertex type only needs
+// a VertexFormat specialization next to its struct
+
+// Data type of a vertex element, uploaded as the matching DXGI format
+enum class VertexElementType
+{
+	Float2,
+	Float3,
+	Float4,
+	// positions quantized inside the mesh bounds, w unused
+	UNorm16x4,
+	// octahedral encoded unit vectors
+	SNorm16x2,
+	Half2,
+};
+
+struct VertexElement
+{
+	const char* semantic;
+	unsigned semanticIndex;
+	VertexElementType type;
+	unsigned offset;
+};
+
+constexpr unsigned VertexElementSize(VertexElementType type)
+{
+	return type == VertexElementType::Float2 ? 8 : type == VertexElementType::Float3 ? 12 :
+		type == VertexElementType::Float4 ? 16 : type == VertexElementType::UNorm16x4 ? 8 : 4;
+}
+
+// floats compare by value (so -0.0f == 0.0f), the rest by bits
+constexpr bool VertexElementIsFloat(VertexElementType type)
+{
+	return type == VertexElementType::Float2 || type == VertexElementType::Float3 || type == VertexElementType::Float4;
+}
+
+// Specialize with a static constexpr VertexElement elements[] for each vertex type
+template <typename T>
+struct VertexFormat;
+
+// Bare positions, the layout of the position only stream
+template <>
+struct VertexFormat<XMFLOAT3>
+{
+	static constexpr VertexElement elements[] =
+	{
+		{ "POSITION", 0, VertexElementType::Float3, 0 },
+	};
+};
+
+template <typename T>
+constexpr size_t VertexElementCount = sizeof(VertexFormat<T>::elements) / sizeof(VertexElement);
+
+constexpr bool SemanticEqual(const char* a, const char* b)
+{
+	while (*a != '\0' && *a == *b)
+	{
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+// Index of the element of T with the given semantic, or -1
+template <typename T>
+constexpr int FindVertexElement(const char* semantic, unsigned semanticIndex)
+{
+	for (size_t i = 0; i < VertexElementCount<T>; i++)
+	{
+		if (SemanticEqual(VertexFormat<T>::elements[i].semantic, semantic) && VertexFormat<T>::elements[i].semanticIndex == semanticIndex)
+			return (int)i;
+	}
+	return -1;
+}
+
+template <typename T, typename Func, size_t... I>
+void ForEachVertexElement(Func&& func, std::index_sequence<I...>)
+{
+	(func(std::integral_constant<size_t, I>()), ...);
+}
+
+// Call func(std::integral_constant<size_t, I>) for every element I of T,
+// unrolled at compile time so VertexFormat<T>::elements[I] is a constant
+template <typename T, typename Func>
+void ForEachVertexElement(Func&& func)
+{
+	ForEachVertexElement<T>(func, std::make_index_sequence<VertexElementCount<T>>());
+}